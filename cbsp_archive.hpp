@@ -0,0 +1,423 @@
+#ifndef _CBSP_ARCHIVE_H_
+#define _CBSP_ARCHIVE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cbsp_structor.hpp"
+#include "cbsp_error.hpp"
+#include "cbsp_buffer.hpp"
+#include "cbsp_file.hpp"
+#include "cbsp_utils.hpp"
+#include "cbsp_tree.hpp"
+#include "cbsp_crc.hpp"
+#include "cbsp_mixer.hpp"
+#include "cbsp_trace.hpp"
+
+/*
+ * a cbsp file opened once for many reads
+ * open checks the chain and loads the header, the blockers, their tables and the member paths,
+ * after that nothing of the archive is changed or read again but contents
+ * find, list, read and extract may be called from any thread, contents are read with pread
+ * the file must not be written while it is open
+ */
+namespace cbsp
+{
+    typedef struct _CBSP_MEMBER
+    {
+        // the path as printTree lists it
+        std::string path;
+        // the offset of its blocker
+        uint64_t at = 0;
+        CBSP_BLOCKER blocker;
+        std::vector<CBSP_SEGMENT> segments;
+        // a dense file is one extent of its stored content
+        std::vector<CBSP_EXTENT> extents;
+        // the block table checked before a read, a member without one is checked at extract only
+        uint64_t blockSize = 0;
+        std::vector<uint32_t> blocks;
+        // the bytes of the file, and the bytes stored
+        uint64_t size = 0;
+        uint64_t length = 0;
+    } CBSP_MEMBER;
+
+    class Archive
+    {
+    public:
+        Archive() = default;
+        Archive(const Archive &) = delete;
+        Archive &operator=(const Archive &) = delete;
+        ~Archive() { close(); }
+
+        /*
+         * open path and load its members, the chain is checked once at verify
+         * at full verify a read checks the blocks under it the first time they are read,
+         * a member without a block table is not read whole for it
+         */
+        int open(const char *path, const int &verify = verifyLevel())
+        {
+            close();
+            if (!path)
+            {
+                return CBSP_ERR_BAD_PATH;
+            }
+            CBSP_TRACE_SPAN("archive", path);
+            CBSPFile fp;
+            int ret = fp.open(path);
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                return ret;
+            }
+            if (!isCBSP(&fp))
+            {
+                return CBSP_ERR_NO_CBSP;
+            }
+            if (!verifyMatch(&fp, verify))
+            {
+                return CBSP_ERR_BAD_CBSP;
+            }
+
+            auto header = getHeader(&fp);
+            CBSP_TREE tr;
+            if (header.count > 0)
+            {
+                dirTree(&fp, tr);
+                cropTree(tr);
+            }
+            std::vector<CBSP_MEMBER> members;
+            members.reserve(header.count);
+            uint64_t at = header.first;
+            auto blocker = getFirst(&fp, header);
+            for (size_t i = 0; i < header.count; i++, at = blocker.next, blocker = getCBSPBlocker(&fp, blocker.next))
+            {
+                if (!isCBSP(blocker))
+                {
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                if (isDeleted(blocker))
+                {
+                    continue;
+                }
+                CBSP_MEMBER member;
+                member.path = memberPath(tr, i);
+                member.at = at;
+                member.blocker = blocker;
+                member.segments = getSegments(&fp, blocker);
+                for (auto &segment : member.segments)
+                {
+                    member.length += segment.length;
+                }
+                if (!getExtents(&fp, blocker, member.extents) ||
+                    (verify > CBSP_VERIFY_NONE && !getBlocks(&fp, blocker, member.blocks)))
+                {
+                    ErrorMessage::setMessage("Tables of %s broken", member.path.c_str());
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                if (!isSparse(blocker))
+                {
+                    member.extents.assign(1, {0, member.length});
+                }
+                member.size = isSparse(blocker) ? blocker.fileSize : member.length;
+                member.blockSize = member.blocks.empty() ? 0 : blocker.blockSize;
+                members.push_back(std::move(member));
+            }
+
+            m_fd = dup(fileno(&fp));
+            if (m_fd < 0)
+            {
+                return CBSP_ERR_NO_TARGET;
+            }
+            m_verify = verify;
+            m_header = header;
+            m_members = std::move(members);
+            size_t blocks = 0;
+            for (size_t i = 0; i < m_members.size(); i++)
+            {
+                // the first path wins, as in findMember
+                m_paths.emplace(m_members[i].path, i);
+                m_bases.push_back(blocks);
+                blocks += m_members[i].blocks.size();
+            }
+            m_checked.reset(new std::atomic<bool>[blocks]());
+            return CBSP_ERR_SUCCESS;
+        }
+
+        void close()
+        {
+            if (m_fd >= 0)
+            {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+            m_header = CBSP_HEADER();
+            m_members.clear();
+            m_paths.clear();
+            m_bases.clear();
+            m_checked.reset();
+        }
+
+        operator bool() const { return m_fd >= 0; }
+        const CBSP_HEADER &header() const noexcept { return m_header; }
+        const std::vector<CBSP_MEMBER> &members() const noexcept { return m_members; }
+        size_t size() const noexcept { return m_members.size(); }
+
+        // a member by its path as printTree lists it, nullptr if there is none
+        const CBSP_MEMBER *find(const std::string &path) const
+        {
+            auto found = m_paths.find(path);
+            return (found != m_paths.end()) ? &m_members[found->second] : nullptr;
+        }
+
+        std::vector<std::string> list() const
+        {
+            std::vector<std::string> paths;
+            paths.reserve(m_members.size());
+            for (auto &member : m_members)
+            {
+                paths.push_back(member.path);
+            }
+            return paths;
+        }
+
+        /*
+         * read [offset, offset + length) of a member into dst
+         * length is cut to the end of the file, and set to the bytes read
+         * the holes of a sparse file read as zeros
+         */
+        int read(const CBSP_MEMBER &member, const uint64_t &offset, uint64_t &length, char *dst) const
+        {
+            CBSP_TRACE_SPAN("archive read", member.path);
+            length = (offset < member.size) ? std::min(length, member.size - offset) : 0;
+            if (length == 0)
+            {
+                return CBSP_ERR_SUCCESS;
+            }
+            if (isSparse(member.blocker))
+            {
+                memset(dst, 0, length);
+            }
+
+            // the extents under the range are stored one after another
+            struct Piece
+            {
+                uint64_t stored;
+                uint64_t length;
+                char *dst;
+            };
+            std::vector<Piece> pieces;
+            uint64_t stored = 0;
+            for (auto &extent : member.extents)
+            {
+                uint64_t begin = std::max(offset, extent.offset);
+                uint64_t end = std::min(offset + length, extent.offset + extent.length);
+                if (begin < end)
+                {
+                    pieces.push_back({stored + begin - extent.offset, end - begin, dst + begin - offset});
+                }
+                stored += extent.length;
+            }
+            if (pieces.empty())
+            {
+                return CBSP_ERR_SUCCESS;
+            }
+
+            int ret = check(member, pieces.front().stored, pieces.back().stored + pieces.back().length);
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                length = 0;
+                return ret;
+            }
+            for (auto &piece : pieces)
+            {
+                if (!readStored(member, piece.stored, piece.length, piece.dst))
+                {
+                    length = 0;
+                    return CBSP_ERR_BAD_CBSP;
+                }
+            }
+            return CBSP_ERR_SUCCESS;
+        }
+
+        int read(const char *path, const uint64_t &offset, uint64_t &length, char *dst) const
+        {
+            auto member = path ? find(path) : nullptr;
+            if (!member)
+            {
+                length = 0;
+                return CBSP_ERR_NO_EXIST;
+            }
+            return read(*member, offset, length, dst);
+        }
+
+        // write a member to filepath, which must not exist
+        int extract(const CBSP_MEMBER &member, const char *filepath) const
+        {
+            if (!filepath)
+            {
+                return CBSP_ERR_BAD_PATH;
+            }
+            CBSP_TRACE_SPAN("archive extract", filepath);
+            int fd = ::open(filepath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+            if (fd < 0)
+            {
+                if (errno == EEXIST)
+                {
+                    ErrorMessage::setMessage("%s already exists", filepath);
+                    return CBSP_ERR_AL_EXIST;
+                }
+                return CBSP_ERR_NO_TARGET;
+            }
+
+            // the holes are left unwritten, the size covers a hole at the end
+            Buffer buffer(std::max<uint64_t>(1, std::min(member.length, chunkLimit())));
+            uint32_t crc = 0x0;
+            uint64_t stored = 0;
+            int ret = CBSP_ERR_SUCCESS;
+            for (auto &extent : member.extents)
+            {
+                for (uint64_t done = 0; done < extent.length && ret == CBSP_ERR_SUCCESS;)
+                {
+                    uint64_t n = std::min<uint64_t>(buffer.size(), extent.length - done);
+                    if (!readStored(member, stored + done, n, buffer.get()))
+                    {
+                        ret = CBSP_ERR_BAD_CBSP;
+                        break;
+                    }
+                    crc = crc32(buffer.get(), n, crc);
+                    CBSP_STATS_ADD(SYSCALLS, 1);
+                    if (pwrite(fd, buffer.get(), n, extent.offset + done) != static_cast<ssize_t>(n))
+                    {
+                        ErrorMessage::setMessage("Extract %s failed", filepath);
+                        ret = CBSP_ERR_NO_TARGET;
+                    }
+                    done += n;
+                }
+                stored += extent.length;
+            }
+            if (ret == CBSP_ERR_SUCCESS && ftruncate(fd, member.size) != 0)
+            {
+                ErrorMessage::setMessage("Extract %s failed", filepath);
+                ret = CBSP_ERR_NO_TARGET;
+            }
+            ::close(fd);
+            bool matched = isLegacy(m_header, member.blocker)
+                               ? legacyMatch(m_fd, member.blocker.offset, member.blocker.mixer, member.blocker)
+                               : crc == member.blocker.crc;
+            if (ret == CBSP_ERR_SUCCESS && m_verify >= CBSP_VERIFY_FULL && !matched)
+            {
+                ErrorMessage::setMessage("Extract %s failed", filepath);
+                ErrorMessage::setMessage("Mismatch crc 0x%x 0x%x", crc, member.blocker.crc);
+                ret = CBSP_ERR_AL_MODIFY | CBSP_ERR_BAD_CBSP;
+            }
+            return ret;
+        }
+
+        int extract(const char *path, const char *filepath) const
+        {
+            auto member = path ? find(path) : nullptr;
+            return member ? extract(*member, filepath) : CBSP_ERR_NO_EXIST;
+        }
+
+    private:
+        // read the stored bytes [stored, stored + length) of a member to dst, unmixed
+        bool readStored(const CBSP_MEMBER &member, uint64_t stored, uint64_t length, char *dst) const
+        {
+            uint64_t start = 0;
+            for (auto &segment : member.segments)
+            {
+                if (length == 0)
+                {
+                    break;
+                }
+                if (stored < start + segment.length)
+                {
+                    uint64_t skip = stored - start;
+                    uint64_t n = std::min(length, segment.length - skip);
+                    CBSP_STATS_ADD(SYSCALLS, 1);
+                    if (pread(m_fd, dst, n, segment.offset + skip) != static_cast<ssize_t>(n))
+                    {
+                        return false;
+                    }
+                    CBSP_STATS_ADD(BYTES_READ, n);
+                    mixer(dst, n, member.blocker.mixer, stored);
+                    dst += n;
+                    stored += n;
+                    length -= n;
+                }
+                start += segment.length;
+            }
+            return length == 0;
+        }
+
+        /*
+         * at full verify, check the blocks under the stored bytes [from, to) of a member
+         * a block that matched is remembered, it is not read twice for a check
+         */
+        int check(const CBSP_MEMBER &member, const uint64_t &from, const uint64_t &to) const
+        {
+            if (m_verify < CBSP_VERIFY_FULL || from >= to || member.blockSize == 0)
+            {
+                return CBSP_ERR_SUCCESS;
+            }
+            cbsp_assert(&member >= m_members.data() && &member < m_members.data() + m_members.size());
+            auto checked = m_checked.get() + m_bases[&member - m_members.data()];
+            uint64_t last = std::min<uint64_t>((to - 1) / member.blockSize + 1, member.blocks.size());
+            Buffer buffer;
+            for (uint64_t block = from / member.blockSize; block < last; block++)
+            {
+                if (checked[block].load(std::memory_order_acquire))
+                {
+                    continue;
+                }
+                CBSP_TRACE_SPAN("verify");
+                uint64_t at = block * member.blockSize;
+                uint64_t length = std::min(member.blockSize, member.length - at);
+                if (buffer.size() == 0)
+                {
+                    buffer = Buffer(std::min(member.blockSize, chunkLimit()));
+                }
+                uint32_t crc = 0x0;
+                for (uint64_t done = 0; done < length;)
+                {
+                    uint64_t n = std::min<uint64_t>(buffer.size(), length - done);
+                    if (!readStored(member, at + done, n, buffer.get()))
+                    {
+                        return CBSP_ERR_BAD_CBSP;
+                    }
+                    crc = crc32(buffer.get(), n, crc);
+                    done += n;
+                }
+                if (crc != member.blocks[block])
+                {
+                    ErrorMessage::setMessage("Block %lu of %s broken, bytes %lu to %lu", block, member.path.c_str(),
+                                             at, at + length);
+                    return CBSP_ERR_AL_MODIFY | CBSP_ERR_BAD_CBSP;
+                }
+                checked[block].store(true, std::memory_order_release);
+            }
+            return CBSP_ERR_SUCCESS;
+        }
+
+        int m_fd = -1;
+        int m_verify = CBSP_VERIFY_FULL;
+        CBSP_HEADER m_header;
+        std::vector<CBSP_MEMBER> m_members;
+        std::unordered_map<std::string, size_t> m_paths;
+        // the first flag of each member in m_checked, a flag per block
+        std::vector<size_t> m_bases;
+        std::unique_ptr<std::atomic<bool>[]> m_checked;
+    };
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include <map>
 #include <cstdio>
 #include <memory>
+#include <mutex>
 #include <cstring>
 #include <algorithm>
 
@@ -26,18 +27,26 @@ namespace cbsp
         {
         public:
             Buffer() : m_buffer(empty()) {}
-            Buffer(Buffer &&buffer) { *this = std::move(buffer); }
+            Buffer(Buffer &&buffer) : m_buffer(empty()) { *this = std::move(buffer); }
             Buffer(const size_t &size) noexcept
             {
-                auto it = getBufferFromFree(size);
-                if (isEmpty(it))
                 {
-                    auto buffer = generateBuffer(size);
-                    it = setBufferToFree(buffer);
+                    std::lock_guard<std::mutex> lock(buffer_mutex);
+                    auto it = getBufferFromFree(size);
+                    if (isEmpty(it))
+                    {
+                        auto buffer = generateBuffer(size);
+                        it = setBufferToFree(buffer);
+                        CBSP_STATS_ADD(BUFFER_MISSES, 1);
+                    }
+                    else
+                    {
+                        CBSP_STATS_ADD(BUFFER_HITS, 1);
+                    }
+                    m_buffer = setBufferToBusy(it);
+                    cbsp_assert(!isEmpty());
+                    removeBufferFromFree(it);
                 }
-                m_buffer = setBufferToBusy(it);
-                cbsp_assert(!isEmpty());
-                removeBufferFromFree(it);
                 memset(this->get(), 0, this->size());
             }
             ~Buffer()
@@ -81,27 +90,32 @@ namespace cbsp
 
             static const size_t capacity(const size_t &size) noexcept
             {
+                std::lock_guard<std::mutex> lock(buffer_mutex);
                 size_full = size;
                 return size_full;
             }
 
             static const size_t count() noexcept
             {
+                std::lock_guard<std::mutex> lock(buffer_mutex);
                 return buffer_free.size() + buffer_busy.size();
             }
 
             static const size_t validCount() noexcept
             {
+                std::lock_guard<std::mutex> lock(buffer_mutex);
                 return buffer_free.size();
             }
 
             static const size_t inValidCount() noexcept
             {
+                std::lock_guard<std::mutex> lock(buffer_mutex);
                 return buffer_busy.size();
             }
 
             static const void clear() noexcept
             {
+                std::lock_guard<std::mutex> lock(buffer_mutex);
                 cbsp_assert_msg(buffer_busy.size() == 0, "Busy buffer exists\n");
                 buffer_busy.clear();
                 buffer_free.clear();
@@ -110,6 +124,7 @@ namespace cbsp
         private:
             void reset() noexcept
             {
+                std::lock_guard<std::mutex> lock(buffer_mutex);
                 setBufferToFree(m_buffer);
                 removeBufferFromBusy(m_buffer);
                 m_buffer = empty();
@@ -149,9 +164,11 @@ namespace cbsp
 
             CBSP_BUFFER generateBuffer(const size_t &size) noexcept
             {
-                for (bool is_full = count() >= size_full;
-                     is_full && validCount() > 0;
-                     is_full = count() >= size_full)
+                auto total = []
+                { return buffer_free.size() + buffer_busy.size(); };
+                for (bool is_full = total() >= size_full;
+                     is_full && buffer_free.size() > 0;
+                     is_full = total() >= size_full)
                 {
                     auto it = getBufferFromFree(0);
                     if (!isEmpty(it))
@@ -227,11 +244,14 @@ namespace cbsp
             static size_t size_full;
             static CBSP_BUFFER_RB buffer_free;
             static CBSP_BUFFER_RB buffer_busy;
+            // buffers are taken and returned from any thread
+            static std::mutex buffer_mutex;
         };
 
         size_t Buffer::size_full = 10;
         CBSP_BUFFER_RB Buffer::buffer_free;
         CBSP_BUFFER_RB Buffer::buffer_busy;
+        std::mutex Buffer::buffer_mutex;
     }
 }
 
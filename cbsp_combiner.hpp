@@ -4,11 +4,19 @@
 #include <fstream>
 #include <memory>
 #include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <utility>
+#include <algorithm>
 
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <sys/param.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "cbsp_structor.hpp"
 #include "cbsp_error.hpp"
@@ -16,36 +24,159 @@
 #include "cbsp_utils.hpp"
 #include "cbsp_tree.hpp"
 #include "cbsp_crc.hpp"
+#include "cbsp_mixer.hpp"
+#include "cbsp_index.hpp"
 
 namespace cbsp
 {
     namespace combiner
     {
-        inline bool alreadyExist(std::FILE *&fp, const char *filepath)
+        /*
+         * return the offset of the blocker of filepath, 0 if not exists
+         * prefix is the size of the blockers before it, the chain is walked for it
+         */
+        inline uint64_t find(std::FILE *&fp, const char *filepath, uint64_t *prev = nullptr, uint64_t *prefix = nullptr)
         {
             if (!filepath)
-                return CBSP_ERR_BAD_PATH;
+                return 0;
 
             std::string filename = fileName(filepath);
             std::string filedir = fileDir(filepath);
             uint32_t pathDigest = crc32(filepath, strlen(filepath));
 
+            // an index has the digests in one column, only the blockers with the digest are read
+            CBSPIndex index;
+            if (!prefix && index.open(fp))
+            {
+                for (auto &i : index.find(pathDigest))
+                {
+                    auto blocker = getCBSPBlocker(fp, index.blockers()[i]);
+                    if (filename == getFileName(fp, blocker) && filedir == getFileDir(fp, blocker))
+                    {
+                        if (prev)
+                            *prev = (i > 0) ? index.blockers()[i - 1] : 0;
+                        return index.blockers()[i];
+                    }
+                }
+                return 0;
+            }
+
             auto header = getHeader(fp);
             auto offset = header.first;
             auto count = header.count;
+            uint64_t previous = 0;
+            uint64_t size = 0;
             while (count-- > 0)
             {
                 auto blocker = getCBSPBlocker(fp, offset);
                 if (pathDigest == blocker.pathDigest &&
                     filename == getFileName(fp, blocker) &&
                     filedir == getFileDir(fp, blocker))
-                    return true;
+                {
+                    if (prev)
+                        *prev = previous;
+                    if (prefix)
+                        *prefix = size;
+                    return offset;
+                }
+                previous = offset;
+                size += blocker.size;
                 offset = blocker.next;
             }
-            return false;
+            return 0;
+        }
+
+        inline bool alreadyExist(std::FILE *&fp, const char *filepath)
+        {
+            return find(fp, filepath) != 0;
+        }
+
+        // blockers of the files with more than one link added in this run, by (st_dev, st_ino)
+        using CBSP_LINKS = std::map<std::pair<uint64_t, uint64_t>, uint64_t>;
+
+        /*
+         * link a written blocker at stOffset to the end of the chain
+         * header crc = all blocker header
+         * patch it with the changed last and the new blocker, no chain walking
+         */
+        inline int chain(std::FILE *&fp, CBSP_BLOCKER &blocker, const uint64_t &stOffset)
+        {
+            CBSP_STATS_TIMER(HEADER);
+            CBSP_TRACE_SPAN("header");
+            auto header = getHeader(fp);
+            uint32_t bcrc = crc32(reinterpret_cast<uint8_t *>(&blocker), blocker.size);
+            if (hasLast(header))
+            {
+                auto last = getLast(fp, header);
+                auto before = last;
+                last.next = stOffset;
+                setLast(fp, header, last);
+                header.crc = crc32Patch(header.crc, &before, &last, last.size, 0);
+                header.crc = crc32Combine(header.crc, bcrc, blocker.size);
+            }
+            else
+            {
+                header.first = stOffset;
+                header.crc = bcrc;
+            }
+
+            header.count++;
+            header.last = stOffset;
+            header.blockers += blocker.size;
+            // if write header failed, the process failed
+            if (setHeader(fp, header) < static_cast<int>(header.size))
+            {
+                return CBSP_ERR_CREATE_FAILED;
+            }
+
+            return CBSP_ERR_SUCCESS;
         }
 
-        int add(std::FILE *&fp, const char *opath)
+        /*
+         * an archive of a legacy version gets its first write here
+         * every blocker of it is marked legacy, then the version is the current one
+         * so that the members written after it are checked with the whole crc
+         */
+        inline int upgradeLegacy(std::FILE *&fp)
+        {
+            auto header = getHeader(fp);
+            if (!isLegacy(header))
+            {
+                return CBSP_ERR_SUCCESS;
+            }
+
+            auto offset = header.first;
+            auto count = header.count;
+            while (count-- > 0)
+            {
+                auto blocker = getCBSPBlocker(fp, offset);
+                if (!isCBSP(blocker))
+                {
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                blocker.type |= CBSP_TYPE_LEGACY;
+                if (write(fp, blocker, offset, blocker.size) < static_cast<int>(blocker.size))
+                {
+                    return CBSP_ERR_CREATE_FAILED;
+                }
+                offset = blocker.next;
+            }
+
+            header.version = CBSP_HEADER().version;
+            header.crc = crcBlocker(fp, header);
+            if (setHeader(fp, header) < static_cast<int>(header.size))
+            {
+                return CBSP_ERR_CREATE_FAILED;
+            }
+            return CBSP_ERR_SUCCESS;
+        }
+
+        /*
+         * add a file to cbsp
+         * with links, a file met again through another hard link
+         * gets a blocker sharing the content of the first one
+         */
+        inline int add(std::FILE *&fp, const char *opath, CBSP_LINKS *links = nullptr)
         {
             if (!opath)
             {
@@ -63,6 +194,7 @@ namespace cbsp
             {
                 return CBSP_ERR_NO_SOURCE;
             }
+            CBSP_TRACE_SPAN("add", filepath);
 
             if (access(filepath, R_OK) != 0)
             {
@@ -132,11 +264,61 @@ namespace cbsp
                 return CBSP_ERR_BAD_CBSP;
             }
 
+            // the content goes where the index was
+            int ret = dropIndex(fp);
+            if (ret == CBSP_ERR_SUCCESS)
+            {
+                ret = upgradeLegacy(fp);
+            }
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                std::fclose(file);
+                return ret;
+            }
+            std::fseek(fp, 0, SEEK_END);
+            offset = std::ftell(fp);
+
+            struct stat sts;
+            bool linkable = links && fstat(fileno(file), &sts) == 0 && S_ISREG(sts.st_mode) && sts.st_nlink > 1;
+            auto origin = linkable ? links->find({sts.st_dev, sts.st_ino}) : CBSP_LINKS::iterator();
+            if (linkable && origin != links->end())
+            {
+                // blocker | name | dir, the content is the one of origin
+                CBSP_BLOCKER blocker = getCBSPBlocker(fp, origin->second);
+                if (isCBSP(blocker) && !isDeleted(blocker))
+                {
+                    std::fclose(file);
+                    blocker.size = sizeof(CBSP_BLOCKER);
+                    blocker.type = (blocker.type | CBSP_TYPE_LINK) & ~CBSP_TYPE_SHARED;
+                    blocker.link = origin->second;
+                    blocker.next = 0;
+                    blocker.fnameOffset = offset + blocker.size;
+                    blocker.fnameLength = filename.size();
+                    blocker.fdirOffset = blocker.fnameOffset + blocker.fnameLength;
+                    blocker.fdirLength = filedir.size();
+                    blocker.pathDigest = crc32(filepath, strlen(filepath));
+                    write(fp, blocker, offset, blocker.size);
+                    write(fp, const_cast<char *>(filename.c_str()), blocker.fnameOffset, blocker.fnameLength);
+                    write(fp, const_cast<char *>(filedir.c_str()), blocker.fdirOffset, blocker.fdirLength);
+                    return chain(fp, blocker, offset);
+                }
+            }
+
             // get the source file length
             uint64_t length = fileLenght(file);
 
+            // a sparse file stores its data extents only
+            std::vector<CBSP_EXTENT> extents;
+            bool sparse = dataExtents(fileno(file), length, extents);
+            std::vector<CBSP_EXTENT> ranges = sparse ? extents : std::vector<CBSP_EXTENT>{{0, length}};
+            uint64_t stored = 0;
+            for (auto &range : ranges)
+            {
+                stored += range.length;
+            }
+
             // struct offset
-            uint64_t stOffset = offset + length;
+            uint64_t stOffset = offset + stored;
 
             // fname offset
             uint64_t fnameOffset = stOffset + sizeof(CBSP_BLOCKER);
@@ -153,66 +335,906 @@ namespace cbsp
             blocker.magic = CBSP_MAGIC;
             blocker.size = sizeof(CBSP_BLOCKER);
             blocker.offset = offset;
-            blocker.length = length;
+            blocker.length = stored;
             blocker.fnameOffset = fnameOffset;
             blocker.fnameLength = fnameLength;
             blocker.fdirOffset = fdirOffset;
             blocker.fdirLength = fdirLength;
             blocker.pathDigest = crc32(filepath, strlen(filepath));
+            auto header = getHeader(fp);
+            blocker.mixer = header.mixer;
+            blocker.volume = header.volume;
+            // a link met later shares the content
+            if (linkable)
+            {
+                blocker.type |= CBSP_TYPE_SHARED;
+            }
+            if (sparse)
+            {
+                blocker.type |= CBSP_TYPE_SPARSE;
+                blocker.extentOffset = fdirOffset + fdirLength;
+                blocker.extentCount = extents.size();
+                blocker.extentCrc = crcExtents(extents);
+                blocker.fileSize = length;
+            }
+
+            // a large content gets a crc for each block, the table follows the extents
+            uint64_t block = crcBlockSize();
+            std::vector<uint32_t> blocks;
+            if (block > 0 && stored > block)
+            {
+                blocker.type |= CBSP_TYPE_BLOCKS;
+                blocker.blockSize = block;
+                blocker.blockOffset = fdirOffset + fdirLength + extents.size() * sizeof(CBSP_EXTENT);
+                blocker.blockCount = (stored + block - 1) / block;
+                blocks.reserve(blocker.blockCount);
+            }
+            else
+            {
+                block = stored;
+            }
 
             // cp source to target
+            // crc is of the source, the content is mixed
+            // the crc of each block is combined into the crc of the content, data is read once
             uint32_t crc = 0x0;
+            uint32_t bcrc = 0x0;
+            uint64_t phase = 0;
             std::fseek(fp, offset, SEEK_SET);
+            for (auto &range : ranges)
             {
-                ChunkFile chunkfile(file, batch_size);
-
-                for (auto it = chunkfile.begin(); it != chunkfile.end(); it++)
+                // the next chunk is read while this one is written
+                ChunkStream stream(file, range.offset, range.length);
+                char *data = nullptr;
+                uint64_t size = 0;
+                while (stream.next(data, size))
                 {
-                    auto &chunk = *it;
-                    cbsp_assert(!chunk.empty());
-                    if (chunk.empty())
+                    for (uint64_t done = 0; done < size;)
                     {
-                        std::fclose(file);
-                        return CBSP_ERR_NO_SOURCE;
+                        uint64_t n = std::min(size - done, block - phase % block);
+                        bcrc = crc32Mix(data + done, n, blocker.mixer, phase, bcrc);
+                        phase += n;
+                        done += n;
+                        if (phase % block == 0 || phase == stored)
+                        {
+                            crc = crc32Combine(crc, bcrc, (phase - 1) % block + 1);
+                            blocks.push_back(bcrc);
+                            bcrc = 0x0;
+                        }
                     }
-                    write(fp, chunk.data(), chunk.size());
-                    crc = crc32(chunk.data(), chunk.size(), crc);
+                    CBSP_TRACE_SPAN("write");
+                    write(fp, data, size);
+                }
+                if (!stream.good())
+                {
+                    std::fclose(file);
+                    return CBSP_ERR_NO_SOURCE;
                 }
             }
             std::fclose(file);
+            if (phase != stored)
+            {
+                return CBSP_ERR_NO_SOURCE;
+            }
 
             // set blocker header
             blocker.crc = crc;
+            if (hasBlocks(blocker))
+            {
+                blocker.blockCrc = crc32(reinterpret_cast<uint8_t *>(blocks.data()), blocks.size() * sizeof(uint32_t));
+            }
             write(fp, blocker, stOffset, sizeof(CBSP_BLOCKER));
             write(fp, const_cast<char *>(filename.c_str()), fnameOffset, fnameLength);
             write(fp, const_cast<char *>(filedir.c_str()), fdirOffset, fdirLength);
+            if (sparse && !extents.empty())
+            {
+                write(fp, extents.data(), blocker.extentOffset, extents.size() * sizeof(CBSP_EXTENT));
+            }
+            if (hasBlocks(blocker))
+            {
+                write(fp, blocks.data(), blocker.blockOffset, blocks.size() * sizeof(uint32_t));
+            }
 
             // after write done
+            // header crc = all blocker header
+            int result = chain(fp, blocker, stOffset);
+            if (result == CBSP_ERR_SUCCESS && linkable)
+            {
+                (*links)[{sts.st_dev, sts.st_ino}] = stOffset;
+            }
+            return result;
+        }
+
+        /*
+         * a writable piece of member content
+         * at is where the blocker or the append describing it is stored
+         */
+        typedef struct _CBSP_SLOT
+        {
+            uint64_t at = 0;
+            uint64_t offset = 0;
+            uint64_t capacity = 0;
+            uint64_t used = 0;
+        } CBSP_SLOT;
+
+        // content is written right before its blocker or append
+        inline uint64_t capacity(const uint64_t &at, const uint64_t &offset, const uint64_t &length)
+        {
+            return (at >= offset + length) ? at - offset : length;
+        }
+
+        /*
+         * update a file already in cbsp
+         * the content is overwritten in place while it fits,
+         * the overflow is appended to the end through CBSP_BLOCKER_APPEND
+         */
+        inline int update(std::FILE *&fp, const char *opath, CBSP_LINKS *links = nullptr)
+        {
+            if (!opath)
+            {
+                return CBSP_ERR_BAD_PATH;
+            }
+
+            if (!fp)
+            {
+                return CBSP_ERR_NO_TARGET;
+            }
+
+            char filepath[PATH_MAX];
+            if (!realpath(opath, filepath))
+            {
+                return CBSP_ERR_NO_SOURCE;
+            }
+
+            // not in cbsp yet, just add it
+            uint64_t prefix = 0;
+            uint64_t at = find(fp, filepath, nullptr, &prefix);
+            if (at == 0)
+            {
+                return add(fp, opath, links);
+            }
+            CBSP_TRACE_SPAN("update", filepath);
+
+            if (access(filepath, R_OK) != 0)
+            {
+                ErrorMessage::setMessage("Access deined %s", filepath);
+                return CBSP_ERR_DEN_ACCESS;
+            }
+
+            if (!crcMatch(fp) || dropIndex(fp) != CBSP_ERR_SUCCESS)
+            {
+                return CBSP_ERR_BAD_CBSP;
+            }
+            int ret = upgradeLegacy(fp);
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                return ret;
+            }
+
+            std::FILE *file = std::fopen(filepath, "rb");
+            if (!file)
+            {
+                return CBSP_ERR_NO_SOURCE;
+            }
+
+            // the content shared with a hard link is kept for it, the new one goes to the end
+            auto blocker = getCBSPBlocker(fp, at);
+            auto former = blocker;
+            bool shared = isShared(blocker);
+            std::vector<CBSP_SLOT> slots;
+            slots.push_back({at, blocker.offset, shared ? 0 : capacity(at, blocker.offset, blocker.length), 0});
+            for (auto offset = shared ? 0 : blocker.append; offset > 0;)
+            {
+                auto append = getCBSPAppend(fp, offset);
+                if (!isCBSP(append))
+                {
+                    std::fclose(file);
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                slots.push_back({offset, append.offset, capacity(offset, append.offset, append.length), 0});
+                offset = append.next;
+            }
+
+            // overflow content goes to the end of cbsp
+            std::fseek(fp, 0, SEEK_END);
+            CBSP_SLOT overflow{0, static_cast<uint64_t>(std::ftell(fp)), 0, 0};
+
+            uint32_t crc = 0x0;
+            uint64_t phase = 0;
+            {
+                size_t k = 0;
+                ChunkStream stream(file);
+                char *data = nullptr;
+                uint64_t size = 0;
+                while (stream.next(data, size))
+                {
+                    crc = crc32Mix(data, size, blocker.mixer, phase, crc);
+                    phase += size;
+
+                    uint64_t done = 0;
+                    while (done < size)
+                    {
+                        auto &slot = (k < slots.size()) ? slots[k] : overflow;
+                        uint64_t room = (k < slots.size()) ? slot.capacity - slot.used : size - done;
+                        if (room == 0)
+                        {
+                            k++;
+                            continue;
+                        }
+                        uint64_t n = std::min(room, size - done);
+                        CBSP_TRACE_SPAN("write");
+                        write(fp, data + done, slot.offset + slot.used, n);
+                        slot.used += n;
+                        done += n;
+                    }
+                }
+                if (!stream.good())
+                {
+                    std::fclose(file);
+                    return CBSP_ERR_NO_SOURCE;
+                }
+            }
+            std::fclose(file);
+
+            if (overflow.used > 0)
+            {
+                CBSP_BLOCKER_APPEND append;
+                append.magic = CBSP_MAGIC;
+                append.size = sizeof(CBSP_BLOCKER_APPEND);
+                append.offset = overflow.offset;
+                append.length = overflow.used;
+                overflow.at = overflow.offset + overflow.used;
+                write(fp, append, overflow.at, sizeof(CBSP_BLOCKER_APPEND));
+            }
+
+            // the lengths of the appends, and the link to the overflow
+            for (size_t k = slots.size(); k-- > 1;)
+            {
+                auto append = getCBSPAppend(fp, slots[k].at);
+                append.length = slots[k].used;
+                if (k + 1 == slots.size() && overflow.used > 0)
+                {
+                    append.next = overflow.at;
+                }
+                write(fp, append, slots[k].at, append.size);
+            }
+
+            blocker.length = slots.front().used;
+            if (shared)
+            {
+                blocker.append = 0;
+            }
+            if (slots.size() == 1 && overflow.used > 0)
+            {
+                blocker.append = overflow.at;
+            }
+            // a link has no tables after its dir, they were the ones of its origin
+            if (isLink(blocker))
+            {
+                blocker.extentOffset = 0;
+                blocker.extentCount = 0;
+                blocker.extentCrc = 0;
+                blocker.blockOffset = 0;
+                blocker.blockCount = 0;
+                blocker.blockCrc = 0;
+            }
+            // the content is written dense and without block crcs,
+            // the tables of the former content stay after the dir
+            blocker.type &= ~(CBSP_TYPE_SPARSE | CBSP_TYPE_LINK | CBSP_TYPE_BLOCKS | CBSP_TYPE_LEGACY);
+            blocker.fileSize = 0;
+            blocker.link = 0;
+            blocker.crc = crc;
+            write(fp, blocker, at, blocker.size);
+
+            // crc = prefix + blocker + suffix, patched with the changed bytes
+            CBSP_STATS_TIMER(HEADER);
+            CBSP_TRACE_SPAN("header");
             auto header = getHeader(fp);
-            if (hasLast(header))
+            if (hasBlockers(header))
             {
-                auto last = getLast(fp, header);
-                last.next = stOffset;
-                setLast(fp, header, last);
+                header.crc = crc32Patch(header.crc, &former, &blocker, blocker.size, header.blockers - prefix - blocker.size);
             }
             else
             {
-                header.size = sizeof(CBSP_HEADER);
-                header.first = stOffset;
+                header.crc = crcBlocker(fp, header);
+            }
+            if (setHeader(fp, header) < static_cast<int>(header.size))
+            {
+                return CBSP_ERR_CREATE_FAILED;
+            }
+
+            return CBSP_ERR_SUCCESS;
+        }
+
+        // the absolute path of opath without touching the file system, "." and ".." resolved
+        inline std::string absolutePath(const char *opath)
+        {
+            char cwd[PATH_MAX];
+            std::string path = (opath[0] == '/' || !getcwd(cwd, PATH_MAX)) ? std::string(opath) : std::string(cwd) + "/" + opath;
+            std::vector<std::string> parts;
+            std::string::size_type pos = 0;
+            while (pos < path.size())
+            {
+                auto end = path.find('/', pos);
+                if (end == std::string::npos)
+                    end = path.size();
+                auto part = path.substr(pos, end - pos);
+                pos = end + 1;
+                if (part.empty() || part == ".")
+                    continue;
+                if (part == "..")
+                {
+                    if (!parts.empty())
+                        parts.pop_back();
+                    continue;
+                }
+                parts.push_back(part);
+            }
+            std::string out;
+            for (auto &part : parts)
+            {
+                out += "/" + part;
+            }
+            return out.empty() ? "/" : out;
+        }
+
+        /*
+         * delete a file from cbsp
+         * the blocker is marked as deleted and unlinked from the chain,
+         * its content is left until compact
+         */
+        inline int erase(std::FILE *&fp, const char *opath)
+        {
+            if (!opath)
+            {
+                return CBSP_ERR_BAD_PATH;
+            }
+
+            if (!fp)
+            {
+                return CBSP_ERR_NO_TARGET;
+            }
+
+            if (!isCBSP(fp))
+            {
+                return CBSP_ERR_NO_CBSP;
+            }
+
+            // the source may not exist anymore
+            char filepath[PATH_MAX];
+            if (!realpath(opath, filepath))
+            {
+                snprintf(filepath, PATH_MAX, "%s", absolutePath(opath).c_str());
+            }
+            CBSP_TRACE_SPAN("erase", filepath);
+
+            if (!crcMatch(fp) || dropIndex(fp) != CBSP_ERR_SUCCESS)
+            {
+                return CBSP_ERR_BAD_CBSP;
+            }
+
+            std::string filename = fileName(filepath);
+            std::string filedir = fileDir(filepath);
+            uint32_t pathDigest = crc32(filepath, strlen(filepath));
+
+            auto header = getHeader(fp);
+            // crc of the blockers before prev, and before target
+            uint32_t crcPrev = 0x0;
+            uint32_t crcPrefix = 0x0;
+            uint64_t prefix = 0;
+            uint64_t prevOffset = 0;
+            CBSP_BLOCKER prev;
+
+            uint64_t offset = header.first;
+            CBSP_BLOCKER blocker;
+            bool found = false;
+            for (auto count = header.count; count > 0; count--)
+            {
+                blocker = getCBSPBlocker(fp, offset);
+                if (!isCBSP(blocker))
+                {
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                if (pathDigest == blocker.pathDigest &&
+                    filename == getFileName(fp, blocker) &&
+                    filedir == getFileDir(fp, blocker))
+                {
+                    found = true;
+                    break;
+                }
+                crcPrev = crcPrefix;
+                crcPrefix = crc32(reinterpret_cast<uint8_t *>(&blocker), blocker.size, crcPrefix);
+                prefix += blocker.size;
+                prevOffset = offset;
+                prev = blocker;
+                offset = blocker.next;
+            }
+
+            if (!found)
+            {
+                ErrorMessage::setMessage("%s not exists", opath);
+                return CBSP_ERR_NO_EXIST;
+            }
+
+            // unlink
+            CBSP_STATS_TIMER(HEADER);
+            CBSP_TRACE_SPAN("header");
+            uint32_t crcLinked = 0x0;
+            if (prevOffset > 0)
+            {
+                prev.next = blocker.next;
+                write(fp, prev, prevOffset, prev.size);
+                crcLinked = crc32(reinterpret_cast<uint8_t *>(&prev), prev.size, crcPrev);
+            }
+            else
+            {
+                header.first = blocker.next;
+            }
+            if (header.last == offset)
+            {
+                header.last = prevOffset;
+            }
+
+            // crc = prefix + suffix, the suffix is never read
+            header.count--;
+            if (hasBlockers(header))
+            {
+                uint64_t suffix = header.blockers - prefix - blocker.size;
+                uint32_t crcTarget = crc32(reinterpret_cast<uint8_t *>(&blocker), blocker.size, crcPrefix);
+                uint32_t crcSuffix = header.crc ^ crc32Shift(crcTarget, suffix);
+                header.crc = crc32Combine(crcLinked, crcSuffix, suffix);
+                header.blockers -= blocker.size;
+            }
+            else
+            {
+                header.crc = crcBlocker(fp, header);
             }
 
-            // header crc = all blocker header
-            header.count++;
-            header.last = stOffset;
-            header.crc = crcBlocker(fp, header);
-            // if write header failed, the process failed
             if (setHeader(fp, header) < static_cast<int>(header.size))
             {
                 return CBSP_ERR_CREATE_FAILED;
             }
 
+            // tombstone
+            blocker.type |= CBSP_TYPE_DELETED;
+            write(fp, blocker, offset, blocker.size);
+
+            return CBSP_ERR_SUCCESS;
+        }
+
+        // blockers written back to back in a chain, and their crc
+        typedef struct _CBSP_CHAIN
+        {
+            uint64_t first = 0;
+            uint64_t last = 0;
+            uint32_t count = 0;
+            uint64_t blockers = 0;
+            uint32_t crc = 0x0;
+            // the blocker at last
+            CBSP_BLOCKER tail;
+            // where the written members end
+            uint64_t end = 0;
+        } CBSP_CHAIN;
+
+        // link from after to, the crc of to is patched, no blocker is read
+        inline bool joinChain(int out, CBSP_CHAIN &to, const CBSP_CHAIN &from)
+        {
+            if (from.count == 0)
+            {
+                return true;
+            }
+            if (to.count > 0)
+            {
+                auto before = to.tail;
+                to.tail.next = from.first;
+                if (pwrite(out, &to.tail, to.tail.size, to.last) != static_cast<ssize_t>(to.tail.size))
+                {
+                    return false;
+                }
+                to.crc = crc32Patch(to.crc, &before, &to.tail, to.tail.size, 0);
+                to.crc = crc32Combine(to.crc, from.crc, from.blockers);
+            }
+            else
+            {
+                to.first = from.first;
+                to.crc = from.crc;
+            }
+            to.last = from.last;
+            to.tail = from.tail;
+            to.count += from.count;
+            to.blockers += from.blockers;
+            return true;
+        }
+
+        /*
+         * copy the living files of fp to out from pos, in the order of their content offsets
+         * content | blocker | name | dir | extents | blocks, a hard link is blocker | name | dir
+         * contents are copied as they are, only offsets and links of the blockers change
+         * with paths, a file which path is in it is skipped, the others are added to it
+         */
+        inline int copyMembers(std::FILE *&fp, int out, uint64_t pos, const uint32_t &volume, CBSP_CHAIN &chain,
+                               std::unordered_set<std::string> *paths = nullptr)
+        {
+            struct Member
+            {
+                CBSP_BLOCKER blocker;
+                std::vector<CBSP_SEGMENT> segments;
+                std::string filename;
+                std::string filedir;
+                std::vector<CBSP_EXTENT> extents;
+                std::vector<uint32_t> blocks;
+                // the member which content this one shares, itself if none
+                size_t origin = 0;
+                // the blocker written for it, and where
+                CBSP_BLOCKER placed;
+                uint64_t at = 0;
+            };
+            int result = CBSP_ERR_SUCCESS;
+            std::vector<Member> members;
+            auto header = getHeader(fp);
+            auto blocker = getFirst(fp, header);
+            for (auto count = header.count; count > 0; count--, blocker = getCBSPBlocker(fp, blocker.next))
+            {
+                if (!isCBSP(blocker))
+                {
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                auto filename = getFileName(fp, blocker);
+                auto filedir = getFileDir(fp, blocker);
+                if (paths && !paths->insert(filedir + "/" + filename).second)
+                {
+                    ErrorMessage::setMessage("%s/%s already exists", filedir.c_str(), filename.c_str());
+                    result |= CBSP_ERR_AL_EXIST;
+                    continue;
+                }
+                members.push_back({blocker, getSegments(fp, blocker), filename, filedir, {}, {}, 0, {}, 0});
+                if (!getExtents(fp, blocker, members.back().extents) ||
+                    !getBlocks(fp, blocker, members.back().blocks))
+                {
+                    return CBSP_ERR_BAD_CBSP;
+                }
+            }
+            std::stable_sort(members.begin(), members.end(), [](const Member &a, const Member &b)
+                             { return a.blocker.offset < b.blocker.offset; });
+
+            // a hard link shares the content of the first member with the same content
+            for (size_t i = 0; i < members.size(); i++)
+            {
+                auto &m = members[i];
+                m.origin = i;
+                for (size_t j = i; isLink(m.blocker) && j-- > 0 && members[j].blocker.offset == m.blocker.offset;)
+                {
+                    if (members[j].blocker.length == m.blocker.length && members[j].blocker.append == m.blocker.append)
+                    {
+                        m.origin = members[j].origin;
+                        members[m.origin].blocker.type |= CBSP_TYPE_SHARED;
+                        break;
+                    }
+                }
+            }
+            // the bytes before the blocker of member i
+            auto content = [&members](const size_t &i)
+            {
+                uint64_t length = 0;
+                for (auto &segment : members[i].segments)
+                {
+                    length += segment.length;
+                }
+                return (members[i].origin == i) ? length : 0;
+            };
+
+            int in = fileno(fp);
+            bool ok = true;
+            chain = CBSP_CHAIN();
+            for (size_t i = 0; ok && i < members.size(); i++)
+            {
+                auto &m = members[i];
+                bool owner = m.origin == i;
+                uint64_t offset = pos;
+                for (size_t k = 0; owner && k < m.segments.size(); k++)
+                {
+                    ok = ok && copyRange(in, m.segments[k].offset, out, pos, m.segments[k].length);
+                    pos += m.segments[k].length;
+                }
+
+                CBSP_BLOCKER nblocker = m.blocker;
+                nblocker.size = sizeof(CBSP_BLOCKER);
+                nblocker.type &= ~CBSP_TYPE_DELETED;
+                // the larger blocker keeps telling how its crc was taken
+                if (isLegacy(header, m.blocker))
+                {
+                    nblocker.type |= CBSP_TYPE_LEGACY;
+                }
+                nblocker.volume = volume;
+                nblocker.offset = offset;
+                nblocker.length = pos - offset;
+                nblocker.append = 0;
+                nblocker.fnameOffset = pos + nblocker.size;
+                nblocker.fnameLength = m.filename.size();
+                nblocker.fdirOffset = nblocker.fnameOffset + nblocker.fnameLength;
+                nblocker.fdirLength = m.filedir.size();
+                // a dense file drops the tables it may keep from an update
+                nblocker.extentOffset = isSparse(nblocker) ? nblocker.fdirOffset + nblocker.fdirLength : 0;
+                nblocker.extentCount = m.extents.size();
+                uint64_t table = m.extents.size() * sizeof(CBSP_EXTENT);
+                nblocker.blockOffset = hasBlocks(nblocker) ? nblocker.fdirOffset + nblocker.fdirLength + table : 0;
+                nblocker.blockCount = m.blocks.size();
+                uint64_t btable = m.blocks.size() * sizeof(uint32_t);
+                if (owner)
+                {
+                    // the origin of a link may be deleted, the first link owns the content then
+                    nblocker.type &= ~CBSP_TYPE_LINK;
+                    nblocker.link = 0;
+                }
+                else
+                {
+                    auto &origin = members[m.origin];
+                    nblocker.offset = origin.placed.offset;
+                    nblocker.length = origin.placed.length;
+                    nblocker.extentOffset = origin.placed.extentOffset;
+                    nblocker.blockOffset = origin.placed.blockOffset;
+                    nblocker.link = origin.at;
+                    table = 0;
+                    btable = 0;
+                }
+                nblocker.next = 0;
+                // the next blocker follows the whole content of the next file
+                if (i + 1 < members.size())
+                {
+                    nblocker.next = nblocker.fdirOffset + nblocker.fdirLength + table + btable + content(i + 1);
+                }
+
+                ok = ok &&
+                     pwrite(out, &nblocker, nblocker.size, pos) == static_cast<ssize_t>(nblocker.size) &&
+                     pwrite(out, m.filename.data(), m.filename.size(), nblocker.fnameOffset) == static_cast<ssize_t>(m.filename.size()) &&
+                     pwrite(out, m.filedir.data(), m.filedir.size(), nblocker.fdirOffset) == static_cast<ssize_t>(m.filedir.size()) &&
+                     (table == 0 || pwrite(out, m.extents.data(), table, nblocker.extentOffset) == static_cast<ssize_t>(table)) &&
+                     (btable == 0 || pwrite(out, m.blocks.data(), btable, nblocker.blockOffset) == static_cast<ssize_t>(btable));
+
+                m.placed = nblocker;
+                m.at = pos;
+                if (i == 0)
+                    chain.first = pos;
+                chain.last = pos;
+                chain.tail = nblocker;
+                chain.count++;
+                chain.blockers += nblocker.size;
+                chain.crc = crc32(reinterpret_cast<uint8_t *>(&nblocker), nblocker.size, chain.crc);
+                pos = nblocker.fdirOffset + nblocker.fdirLength + table + btable;
+            }
+            chain.end = pos;
+
+            return ok ? result : (result | CBSP_ERR_CREATE_FAILED);
+        }
+
+        /*
+         * rewrite the living files of target into a new cbsp,
+         * and replace target with it
+         * files are copied in the order of their content offsets
+         */
+        inline int compact(const char *target)
+        {
+            if (!target)
+            {
+                return CBSP_ERR_BAD_PATH;
+            }
+
+            std::FILE *fp = std::fopen(target, "rb");
+            if (!fp)
+            {
+                return CBSP_ERR_NO_TARGET;
+            }
+            if (!isCBSP(fp))
+            {
+                std::fclose(fp);
+                return CBSP_ERR_NO_CBSP;
+            }
+            if (!crcMatch(fp))
+            {
+                std::fclose(fp);
+                return CBSP_ERR_BAD_CBSP;
+            }
+
+            std::string tmp = std::string(target) + ".XXXXXX";
+            int out = mkstemp(&tmp[0]);
+            if (out < 0)
+            {
+                std::fclose(fp);
+                return CBSP_ERR_CREATE_FAILED;
+            }
+
+            auto header = getHeader(fp);
+            CBSP_HEADER nheader;
+            nheader.size = sizeof(CBSP_HEADER);
+            nheader.magic = CBSP_MAGIC;
+            nheader.type = header.type;
+            nheader.mixer = header.mixer;
+            nheader.keyCheck = header.keyCheck;
+            nheader.volume = header.volume;
+            nheader.volumes = header.volumes;
+            nheader.generation = header.generation + 1;
+
+            CBSP_CHAIN chain;
+            int result = copyMembers(fp, out, nheader.size, header.volume, chain);
+            std::fclose(fp);
+            if (result != CBSP_ERR_SUCCESS)
+            {
+                close(out);
+                unlink(tmp.c_str());
+                ErrorMessage::setMessage("Compact %s failed", target);
+                return result;
+            }
+            nheader.first = chain.first;
+            nheader.last = chain.last;
+            nheader.count = chain.count;
+            nheader.blockers = chain.blockers;
+            nheader.crc = chain.crc;
+
+            bool ok = pwrite(out, &nheader, nheader.size, 0) == static_cast<ssize_t>(nheader.size) &&
+                      fsync(out) == 0;
+            close(out);
+
+            // keep the mode of target
+            struct stat sts;
+            if (ok && stat(target, &sts) == 0)
+            {
+                chmod(tmp.c_str(), sts.st_mode & 07777);
+            }
+            if (!ok || rename(tmp.c_str(), target) != 0)
+            {
+                unlink(tmp.c_str());
+                ErrorMessage::setMessage("Compact %s failed", target);
+                return CBSP_ERR_CREATE_FAILED;
+            }
+
             return CBSP_ERR_SUCCESS;
         }
+
+        /*
+         * append the files of sources to target, target is created if it does not exist
+         * contents are copied as they are, in kernel if possible, and never hashed again,
+         * the header crc is patched from the written blockers
+         * a path already in target is skipped
+         */
+        inline int merge(const char *target, const std::vector<std::string> &sources)
+        {
+            if (!target)
+            {
+                return CBSP_ERR_BAD_PATH;
+            }
+            if (sources.empty())
+            {
+                return CBSP_ERR_NO_SOURCE;
+            }
+
+            int out = open(target, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+            struct stat sts;
+            if (out < 0 || fstat(out, &sts) != 0)
+            {
+                if (out >= 0)
+                    close(out);
+                return CBSP_ERR_NO_TARGET;
+            }
+            uint64_t size = sts.st_size;
+
+            // the chain of target and the paths in it
+            CBSP_HEADER header;
+            CBSP_CHAIN chain;
+            std::unordered_set<std::string> paths;
+            if (size == 0)
+            {
+                header.size = sizeof(CBSP_HEADER);
+                header.magic = CBSP_MAGIC;
+            }
+            else
+            {
+                std::FILE *fp = std::fopen(target, "rb+");
+                int ret = !fp ? CBSP_ERR_NO_TARGET : !isCBSP(fp) ? CBSP_ERR_NO_CBSP
+                                                 : !crcMatch(fp) ? CBSP_ERR_BAD_CBSP
+                                                                 : upgradeLegacy(fp);
+                if (ret == CBSP_ERR_SUCCESS)
+                {
+                    header = getHeader(fp);
+                    chain.first = header.first;
+                    chain.last = header.last;
+                    chain.count = header.count;
+                    chain.blockers = header.blockers;
+                    chain.crc = header.crc;
+                    // the new files go where the index of target was
+                    CBSP_INDEX index;
+                    uint64_t at = 0;
+                    if (getIndex(fp, index, at) && ftruncate(out, at) == 0)
+                    {
+                        size = at;
+                    }
+                    auto blocker = getFirst(fp, header);
+                    for (auto count = header.count; count > 0; count--)
+                    {
+                        paths.insert(getFileDir(fp, blocker) + "/" + getFileName(fp, blocker));
+                        chain.tail = blocker;
+                        blocker = getCBSPBlocker(fp, blocker.next);
+                    }
+                }
+                if (fp)
+                    std::fclose(fp);
+                if (ret != CBSP_ERR_SUCCESS)
+                {
+                    close(out);
+                    return ret;
+                }
+            }
+
+            char tpath[PATH_MAX];
+            realpath(target, tpath);
+            int result = CBSP_ERR_SUCCESS;
+            uint64_t pos = std::max<uint64_t>(size, header.size);
+            CBSP_CHAIN added;
+            for (auto &source : sources)
+            {
+                CBSP_TRACE_SPAN("merge", source);
+                char spath[PATH_MAX];
+                if (!realpath(source.c_str(), spath) || strcmp(spath, tpath) == 0)
+                {
+                    ErrorMessage::setMessage("Merge %s failed", source.c_str());
+                    result |= CBSP_ERR_BAD_PATH;
+                    continue;
+                }
+                std::FILE *fp = std::fopen(spath, "rb");
+                int ret = !fp ? CBSP_ERR_NO_SOURCE : !isCBSP(fp) ? CBSP_ERR_NO_CBSP
+                                                 : !crcMatch(fp) ? CBSP_ERR_BAD_CBSP
+                                                                 : CBSP_ERR_SUCCESS;
+                if (ret != CBSP_ERR_SUCCESS)
+                {
+                    if (fp)
+                        std::fclose(fp);
+                    ErrorMessage::setMessage("Merge %s failed", source.c_str());
+                    result |= ret;
+                    continue;
+                }
+                // a new target mixes like its first source, a stream of it needs no remixing
+                if (size == 0 && chain.count == 0 && added.count == 0)
+                {
+                    header.mixer = getHeader(fp).mixer;
+                    header.keyCheck = getHeader(fp).keyCheck;
+                }
+
+                CBSP_CHAIN part;
+                ret = copyMembers(fp, out, pos, header.volume, part, &paths);
+                std::fclose(fp);
+                if ((ret & CBSP_ERR_CREATE_FAILED) || !joinChain(out, added, part))
+                {
+                    // nothing is linked to what was written yet
+                    ErrorMessage::setMessage("Merge %s failed", source.c_str());
+                    ftruncate(out, size);
+                    close(out);
+                    return result | ret | CBSP_ERR_CREATE_FAILED;
+                }
+                result |= ret;
+                pos = part.end;
+            }
+
+            // the new files are written before they are linked to target
+            CBSP_STATS_TIMER(HEADER);
+            CBSP_TRACE_SPAN("header");
+            bool ok = fsync(out) == 0 && joinChain(out, chain, added);
+            header.first = chain.first;
+            header.last = chain.last;
+            header.count = chain.count;
+            header.blockers = chain.blockers;
+            header.crc = chain.crc;
+            header.generation++;
+            ok = ok &&
+                 pwrite(out, &header, header.size, 0) == static_cast<ssize_t>(header.size) &&
+                 fsync(out) == 0;
+            close(out);
+            if (!ok)
+            {
+                ErrorMessage::setMessage("Merge into %s failed", target);
+                return result | CBSP_ERR_CREATE_FAILED;
+            }
+
+            return result;
+        }
     }
 }
 
@@ -1,14 +1,25 @@
 #ifndef _CBSP_CRC_H_
 #define _CBSP_CRC_H_
 
+#include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <sys/stat.h>
 
 #include "cbsp_structor.hpp"
 #include "cbsp_file.hpp"
 #include "cbsp_error.hpp"
 #include "cbsp_utils.hpp"
+#include "cbsp_mixer.hpp"
 
 namespace cbsp
 {
@@ -22,26 +33,329 @@ namespace cbsp
      * Alias:   CRC_32/ADCCP
      * Use:     WinRAR,ect.
      *****************************************************************************/
-    inline uint32_t crc32(const uint8_t *data, uint16_t length, uint32_t crc = 0x0)
+    // slice-by-8 tables, tables[0] is the classic byte table
+    inline const std::array<std::array<uint32_t, 256>, 8> &crc32Tables()
     {
-        uint8_t i;
-        crc = ~crc;
+        static const auto tables = []
+        {
+            std::array<std::array<uint32_t, 256>, 8> t;
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : (c >> 1); // 0xEDB88320= reverse 0x04C11DB7
+                }
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                for (int k = 1; k < 8; k++)
+                {
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+                }
+            }
+            return t;
+        }();
+        return tables;
+    }
+
+    // update a non-inverted crc register
+    inline uint32_t crc32Update(uint32_t crc, const uint8_t *data, uint64_t length)
+    {
+        auto &t = crc32Tables();
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        for (; length >= 8; length -= 8, data += 8)
+        {
+            uint32_t lo, hi;
+            memcpy(&lo, data, sizeof(uint32_t));
+            memcpy(&hi, data + 4, sizeof(uint32_t));
+            lo ^= crc;
+            crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+                  t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        }
+#endif
         while (length--)
         {
-            crc ^= *data++; // crc ^= *data; data++;
-            for (i = 0; i < 8; ++i)
+            crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+        }
+        return crc;
+    }
+
+    inline uint32_t crc32(const uint8_t *data, uint64_t length, uint32_t crc = 0x0)
+    {
+        CBSP_STATS_TIMER(CRC);
+        CBSP_STATS_ADD(CRC_BYTES, length);
+        return ~crc32Update(~crc, data, length);
+    }
+    inline uint32_t crc32(const char *data, uint64_t length, uint32_t crc = 0x0)
+    {
+        return crc32(reinterpret_cast<const uint8_t *>(data), length, crc);
+    }
+
+    // a * b modulo the crc polynomial, reflected
+    inline uint32_t crc32Mult(uint32_t a, uint32_t b)
+    {
+        uint32_t m = 1u << 31;
+        uint32_t p = 0;
+        while (m)
+        {
+            if (a & m)
             {
-                if (crc & 1)
-                    crc = (crc >> 1) ^ 0xEDB88320; // 0xEDB88320= reverse 0x04C11DB7
-                else
-                    crc = (crc >> 1);
+                p ^= b;
+                if ((a & (m - 1)) == 0)
+                    break;
             }
+            m >>= 1;
+            b = (b & 1) ? (b >> 1) ^ 0xEDB88320 : b >> 1;
+        }
+        return p;
+    }
+
+    // x^(8 * length) modulo the crc polynomial
+    inline uint32_t crc32Power(uint64_t length)
+    {
+        // x^(2^k) for k in [0, 64)
+        static const auto table = []
+        {
+            std::array<uint32_t, 64> t{};
+            uint32_t p = 1u << 30;
+            for (auto &e : t)
+            {
+                e = p;
+                p = crc32Mult(p, p);
+            }
+            return t;
+        }();
+
+        uint32_t p = 1u << 31;
+        for (unsigned k = 3; length; length >>= 1, k++)
+        {
+            if (length & 1)
+                p = crc32Mult(table[k & 63], p);
+        }
+        return p;
+    }
+
+    // crc of length zeros appended, without the init and xorout
+    inline uint32_t crc32Shift(uint32_t crc, uint64_t length)
+    {
+        return crc32Mult(crc32Power(length), crc);
+    }
+
+    // crc(A + B) from crc(A), crc(B) and length(B)
+    inline uint32_t crc32Combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB)
+    {
+        return crc32Shift(crcA, lengthB) ^ crcB;
+    }
+
+    // crc after length bytes followed by tail bytes changed from before to after
+    inline uint32_t crc32Patch(uint32_t crc, const void *before, const void *after, uint64_t length, uint64_t tail)
+    {
+        std::vector<uint8_t> delta(length);
+        auto b = reinterpret_cast<const uint8_t *>(before);
+        auto a = reinterpret_cast<const uint8_t *>(after);
+        for (uint64_t i = 0; i < length; i++)
+        {
+            delta[i] = b[i] ^ a[i];
+        }
+        // the pure polynomial part, starts from a zero register
+        uint32_t raw = ~crc32(delta.data(), length, 0xFFFFFFFF);
+        return crc ^ crc32Shift(raw, tail);
+    }
+
+    /*
+     * fused mixer and crc, data is touched once while it is in cache
+     * crc32Mix: crc the data, then mix it (source -> cbsp)
+     * mixCrc32: unmix the data, then crc it (cbsp -> source)
+     */
+    const uint64_t mix_crc_block = 16 * mix_pad_size;
+
+    template <bool MixFirst>
+    inline uint32_t mixCrc32Block(uint8_t *data, uint64_t length, int type, uint64_t phase, uint32_t crc)
+    {
+        CBSP_TRACE_SPAN(MixFirst ? "unmix crc" : "crc mix");
+        auto pad = mixerPad(type);
+        if (pad == nullptr)
+        {
+            return crc32(data, length, crc);
+        }
+
+        CBSP_STATS_TIMER(CRC);
+        CBSP_STATS_ADD(CRC_BYTES, length);
+        alignas(64) uint8_t pattern[mix_pad_size];
+        mixPattern(*pad, phase, pattern);
+        auto kernel = mixKernel();
+        crc = ~crc;
+        // blocks are a multiple of the pad, the pattern keeps its phase
+        while (length > 0)
+        {
+            uint64_t n = std::min(length, mix_crc_block);
+            if (MixFirst)
+            {
+                kernel(data, n, pattern);
+                crc = crc32Update(crc, data, n);
+            }
+            else
+            {
+                crc = crc32Update(crc, data, n);
+                kernel(data, n, pattern);
+            }
+            data += n;
+            length -= n;
         }
         return ~crc;
     }
-    inline uint32_t crc32(const char *data, uint16_t length, uint32_t crc = 0x0)
+
+    inline uint32_t crc32Mix(char *data, uint64_t length, int type, uint64_t phase, uint32_t crc = 0x0)
     {
-        return crc32(reinterpret_cast<const uint8_t *>(data), length, crc);
+        return mixCrc32Block<false>(reinterpret_cast<uint8_t *>(data), length, type, phase, crc);
+    }
+
+    inline uint32_t mixCrc32(char *data, uint64_t length, int type, uint64_t phase, uint32_t crc = 0x0)
+    {
+        return mixCrc32Block<true>(reinterpret_cast<uint8_t *>(data), length, type, phase, crc);
+    }
+
+    inline uint32_t crcExtents(const std::vector<CBSP_EXTENT> &extents)
+    {
+        return crc32(reinterpret_cast<const uint8_t *>(extents.data()), extents.size() * sizeof(CBSP_EXTENT));
+    }
+
+    // the table matches its crc, the extents are in order, inside the file and as long as the content
+    inline bool checkExtents(const CBSP_BLOCKER &blocker, const std::vector<CBSP_EXTENT> &extents)
+    {
+        if (crcExtents(extents) != blocker.extentCrc)
+        {
+            return false;
+        }
+        uint64_t end = 0, stored = 0;
+        for (auto &extent : extents)
+        {
+            if (extent.offset < end || extent.offset > blocker.fileSize ||
+                extent.length > blocker.fileSize - extent.offset)
+            {
+                return false;
+            }
+            end = extent.offset + extent.length;
+            stored += extent.length;
+        }
+        return stored == blocker.length;
+    }
+
+    // the extents of a sparse blocker, false if its table is broken
+    inline bool getExtents(std::FILE *&fp, const CBSP_BLOCKER &blocker, std::vector<CBSP_EXTENT> &extents)
+    {
+        extents.clear();
+        if (!isSparse(blocker))
+        {
+            return true;
+        }
+        // every extent holds a byte at least
+        if (blocker.extentCount > blocker.fileSize || blocker.append > 0)
+        {
+            return false;
+        }
+        extents.resize(blocker.extentCount);
+        if (!extents.empty())
+        {
+            read(fp, extents.data(), blocker.extentOffset, extents.size() * sizeof(CBSP_EXTENT));
+        }
+        return checkExtents(blocker, extents);
+    }
+
+    const size_t verify_threads = 8;
+
+    // bytes covered by each crc of a block table, 0 writes no table
+    inline uint64_t &crcBlockSize()
+    {
+        static uint64_t size = 1 << 20;
+        return size;
+    }
+
+    // the crc of a whole content from the crcs of its blocks
+    inline uint32_t crcBlocks(const std::vector<uint32_t> &blocks, const uint64_t &blockSize, const uint64_t &length)
+    {
+        uint32_t crc = 0x0;
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            crc = crc32Combine(crc, blocks[i], std::min<uint64_t>(blockSize, length - i * blockSize));
+        }
+        return crc;
+    }
+
+    // the block crcs of a blocker, false if its table is broken or does not add up to its crc
+    inline bool getBlocks(std::FILE *&fp, const CBSP_BLOCKER &blocker, std::vector<uint32_t> &blocks)
+    {
+        blocks.clear();
+        if (!hasBlocks(blocker))
+        {
+            return true;
+        }
+        if (blocker.blockSize == 0 || blocker.append > 0 ||
+            blocker.blockCount != (blocker.length + blocker.blockSize - 1) / blocker.blockSize ||
+            blocker.blockCount > fileLenght(fp) / sizeof(uint32_t))
+        {
+            return false;
+        }
+        blocks.resize(blocker.blockCount);
+        if (!blocks.empty())
+        {
+            read(fp, blocks.data(), blocker.blockOffset, blocks.size() * sizeof(uint32_t));
+        }
+        return crc32(reinterpret_cast<uint8_t *>(blocks.data()), blocks.size() * sizeof(uint32_t)) == blocker.blockCrc &&
+               crcBlocks(blocks, blocker.blockSize, blocker.length) == blocker.crc;
+    }
+
+    /*
+     * check the blocks [first, last) of a blocker on threads, return the broken ones
+     * every block is read and checked on its own, no pass over the whole content
+     */
+    inline std::vector<uint64_t> verifyBlocks(std::FILE *&fp, const CBSP_BLOCKER &blocker, const std::vector<uint32_t> &blocks,
+                                              const uint64_t &first, uint64_t last)
+    {
+        CBSP_TRACE_SPAN("verify blocks");
+        std::vector<uint64_t> broken;
+        last = std::min<uint64_t>(last, blocks.size());
+        if (first >= last)
+        {
+            return broken;
+        }
+
+        int fd = fileno(fp);
+        std::mutex mutex;
+        std::atomic<uint64_t> next{first};
+        auto worker = [&]()
+        {
+            Buffer buffer(blocker.blockSize);
+            for (uint64_t i = next++; i < last; i = next++)
+            {
+                uint64_t offset = i * blocker.blockSize;
+                uint64_t length = std::min(blocker.blockSize, blocker.length - offset);
+                bool ok = pread(fd, buffer.get(), length, blocker.offset + offset) == static_cast<ssize_t>(length);
+                CBSP_STATS_ADD(SYSCALLS, 1);
+                CBSP_STATS_ADD(BYTES_READ, ok ? length : 0);
+                if (!ok || mixCrc32(buffer.get(), length, blocker.mixer, offset) != blocks[i])
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    broken.push_back(i);
+                }
+            }
+        };
+
+        size_t threads = std::min<uint64_t>({last - first, std::max(1u, std::thread::hardware_concurrency()), verify_threads});
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < threads; i++)
+        {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : pool)
+        {
+            thread.join();
+        }
+        std::sort(broken.begin(), broken.end());
+        return broken;
     }
 
     inline uint32_t crcBlocker(std::FILE *&fp, const CBSP_BLOCKER &blocker)
@@ -52,18 +366,66 @@ namespace cbsp
             return crc;
         }
 
+        uint64_t phase = 0;
+        for (auto &segment : getSegments(fp, blocker))
         {
-            ChunkFile chunkfile(fp, batch_size, blocker.offset, blocker.length);
-            for (auto it = chunkfile.begin(); it != chunkfile.end(); it++)
+            ChunkStream stream(fp, segment.offset, segment.length);
+            char *data = nullptr;
+            uint64_t size = 0;
+            while (stream.next(data, size))
             {
-                auto chunk = *it;
-                crc = crc32(chunk.data(), chunk.size(), crc);
+                crc = mixCrc32(data, size, blocker.mixer, phase, crc);
+                phase += size;
             }
         }
 
         return crc;
     }
 
+    /*
+     * the first releases passed lengths to crc32 as 16 bits,
+     * every 10 MiB chunk of a content added its first length % 65536 bytes to the crc,
+     * so a crc covers that part of the last chunk only
+     * their archives are told by the header version, every member crc there is legacy,
+     * a blocker copied from such an archive into a newer one is marked legacy
+     */
+    const uint32_t whole_crc_version = 26u << 24 | 10u << 16 | 18u << 8;
+    const uint64_t legacy_chunk_size = 10485760;
+
+    inline bool isLegacy(const CBSP_HEADER &header)
+    {
+        return versionOf(header) < whole_crc_version;
+    }
+
+    inline bool isLegacy(const CBSP_HEADER &header, const CBSP_BLOCKER &blocker)
+    {
+        return isLegacy(header) || (blocker.type & CBSP_TYPE_LEGACY);
+    }
+
+    // the legacy crc of the length bytes at offset of fd, false if they can not be read
+    inline bool legacyCrc(const int &fd, const uint64_t &offset, const uint64_t &length, const int &mix, uint32_t &crc)
+    {
+        uint64_t start = length / legacy_chunk_size * legacy_chunk_size;
+        uint64_t size = (length - start) & 0xFFFF;
+        std::vector<char> data(size);
+        CBSP_STATS_ADD(SYSCALLS, 1);
+        if (size > 0 && pread(fd, data.data(), size, offset + start) != static_cast<ssize_t>(size))
+        {
+            return false;
+        }
+        crc = mixCrc32(data.data(), size, mix, start);
+        return true;
+    }
+
+    // the legacy crc of blocker matches the content at offset of fd, mixed with mix
+    // the first releases wrote neither appended nor sparse contents
+    inline bool legacyMatch(const int &fd, const uint64_t &offset, const int &mix, const CBSP_BLOCKER &blocker)
+    {
+        uint32_t crc = 0x0;
+        return blocker.append == 0 && !isSparse(blocker) &&
+               legacyCrc(fd, offset, blocker.length, mix, crc) && crc == blocker.crc;
+    }
+
     inline uint32_t crcBlocker(std::FILE *&fp, const CBSP_HEADER &header)
     {
         if (!fp)
@@ -97,6 +459,8 @@ namespace cbsp
         if (!fp)
             return false;
 
+        CBSP_STATS_TIMER(HEADER);
+        CBSP_TRACE_SPAN("verify header");
         auto header = getHeader(fp);
 
         // not a cbsp header
@@ -115,6 +479,134 @@ namespace cbsp
 
         return match;
     }
+
+    // how much of an archive is checked before it is read
+    // none trusts it, meta checks the blocker chain and the tables,
+    // full also checks every member content before and after it is extracted
+    const int CBSP_VERIFY_NONE = 0;
+    const int CBSP_VERIFY_META = 1;
+    const int CBSP_VERIFY_FULL = 2;
+
+    // the level of the calls that are not given one
+    inline std::atomic<int> &verifyLevel()
+    {
+        static std::atomic<int> level{CBSP_VERIFY_FULL};
+        return level;
+    }
+
+    /*
+     * archives whose blocker chain matched in this process
+     * an entry holds while the file keeps its inode, size, times, generation and crc,
+     * so an unchanged archive is not walked again however often it is opened
+     * the record is not persisted, a check only reads the archive,
+     * so every new process walks the chain once
+     */
+    typedef struct _CBSP_VERIFIED
+    {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        int64_t ctime = 0;
+        uint64_t generation = 0;
+        uint32_t crc = 0;
+        // when it was verified
+        time_t at = 0;
+    } CBSP_VERIFIED;
+
+    struct VerifiedCache
+    {
+        std::mutex mutex;
+        std::map<std::pair<uint64_t, uint64_t>, CBSP_VERIFIED> entries;
+    };
+
+    inline VerifiedCache &verifiedCache()
+    {
+        static VerifiedCache cache;
+        return cache;
+    }
+
+    // the state of fp now, false if it can not be read
+    inline bool verifiedState(std::FILE *&fp, std::pair<uint64_t, uint64_t> &key, CBSP_VERIFIED &state)
+    {
+        struct stat sts;
+        if (!fp || fstat(fileno(fp), &sts) != 0)
+        {
+            return false;
+        }
+        auto header = getHeader(fp);
+        key = {sts.st_dev, sts.st_ino};
+        state.size = sts.st_size;
+        state.mtime = sts.st_mtim.tv_sec * 1000000000ll + sts.st_mtim.tv_nsec;
+        state.ctime = sts.st_ctim.tv_sec * 1000000000ll + sts.st_ctim.tv_nsec;
+        state.generation = header.generation;
+        state.crc = header.crc;
+        return true;
+    }
+
+    // true if fp is unchanged since its chain matched, at is when that was
+    inline bool isVerified(std::FILE *&fp, time_t *at = nullptr)
+    {
+        std::pair<uint64_t, uint64_t> key;
+        CBSP_VERIFIED state;
+        if (!verifiedState(fp, key, state))
+        {
+            return false;
+        }
+        auto &cache = verifiedCache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto entry = cache.entries.find(key);
+        if (entry == cache.entries.end() ||
+            entry->second.size != state.size || entry->second.mtime != state.mtime ||
+            entry->second.ctime != state.ctime || entry->second.generation != state.generation ||
+            entry->second.crc != state.crc)
+        {
+            return false;
+        }
+        if (at)
+        {
+            *at = entry->second.at;
+        }
+        return true;
+    }
+
+    inline void setVerified(std::FILE *&fp)
+    {
+        std::pair<uint64_t, uint64_t> key;
+        CBSP_VERIFIED state;
+        if (!verifiedState(fp, key, state))
+        {
+            return;
+        }
+        state.at = time(nullptr);
+        auto &cache = verifiedCache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.entries[key] = state;
+    }
+
+    inline void clearVerified()
+    {
+        auto &cache = verifiedCache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.entries.clear();
+    }
+
+    // crcMatch at a level, a chain that matched before and is unchanged is not walked again
+    inline bool verifyMatch(std::FILE *&fp, const int &level = verifyLevel())
+    {
+        if (level <= CBSP_VERIFY_NONE)
+        {
+            return fp && isCBSP(getHeader(fp));
+        }
+        if (isVerified(fp))
+        {
+            return true;
+        }
+        if (!crcMatch(fp))
+        {
+            return false;
+        }
+        setVerified(fp);
+        return true;
+    }
 }
 
 #endif
\ No newline at end of file
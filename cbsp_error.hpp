@@ -3,6 +3,8 @@
 
 #include <list>
 #include <deque>
+#include <mutex>
+#include <string>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
@@ -22,6 +24,8 @@ namespace cbsp
     const int32_t CBSP_ERR_BAD_PATH = 1 << (__LINE__ - CBSP_ERR_BAIS - 1);
     const int32_t CBSP_ERR_BAD_OFFSET = 1 << (__LINE__ - CBSP_ERR_BAIS - 1);
     const int32_t CBSP_ERR_DEN_ACCESS = 1 << (__LINE__ - CBSP_ERR_BAIS - 1);
+    const int32_t CBSP_ERR_NO_EXIST = 1 << (__LINE__ - CBSP_ERR_BAIS - 1);
+    const int32_t CBSP_ERR_BAD_KEY = 1 << (__LINE__ - CBSP_ERR_BAIS - 1);
 
     inline std::list<int32_t> extError(int32_t err)
     {
@@ -66,6 +70,10 @@ namespace cbsp
             return "Bad offset";
         case CBSP_ERR_DEN_ACCESS:
             return "Access denied";
+        case CBSP_ERR_NO_EXIST:
+            return "Not exists";
+        case CBSP_ERR_BAD_KEY:
+            return "Wrong key";
         default:
             return "Unkown";
         }
@@ -78,6 +86,7 @@ namespace cbsp
         public:
             static const char *getMessage()
             {
+                std::lock_guard<std::mutex> lock(m_mutex);
                 m_ridx = std::min(++m_ridx, m_wmax);
                 return m_msgs[m_ridx - 1].c_str();
             }
@@ -95,6 +104,7 @@ namespace cbsp
             }
             static void setMessage(std::string &&msg)
             {
+                std::lock_guard<std::mutex> lock(m_mutex);
                 if (m_widx < m_wmax)
                 {
                     m_widx++;
@@ -108,6 +118,7 @@ namespace cbsp
             }
             static bool hasMessage()
             {
+                std::lock_guard<std::mutex> lock(m_mutex);
                 return m_ridx < m_widx;
             }
 
@@ -120,11 +131,14 @@ namespace cbsp
             static int m_ridx;
             static int m_widx;
             static int m_wmax;
+            // the volumes of an archive fail on their own threads
+            static std::mutex m_mutex;
         };
         std::deque<std::string> ErrorMessage::m_msgs{};
         int ErrorMessage::m_ridx = 0;
         int ErrorMessage::m_widx = 0;
         int ErrorMessage::m_wmax = 512;
+        std::mutex ErrorMessage::m_mutex;
     }
 
     inline void printError(int32_t err)
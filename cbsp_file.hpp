@@ -5,45 +5,92 @@
 #include <cstdio>
 #include <cstring>
 #include <limits>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "cbsp_structor.hpp"
 #include "cbsp_error.hpp"
 #include "cbsp_buffer.hpp"
 #include "cbsp_utils.hpp"
+#include "cbsp_mixer.hpp"
 
 namespace cbsp
 {
     const static uint64_t batch_size = 10485760;
+    const static size_t stream_depth = 3;
+
+    // memory for the chunks of one operation, a stream ring and its consumer
+    inline std::atomic<uint64_t> &chunkBudget()
+    {
+        static std::atomic<uint64_t> budget{(stream_depth + 1) * batch_size};
+        return budget;
+    }
+
+    // the largest chunk within the budget
+    inline uint64_t chunkLimit(const uint64_t &block = 4096)
+    {
+        uint64_t limit = chunkBudget() / (stream_depth + 1) / block * block;
+        return std::max<uint64_t>(limit, std::max<uint64_t>(block, 64 * 1024));
+    }
+
+    /*
+     * the chunk size to read length bytes of fd
+     * a multiple of the preferred io block, no larger than needed or than the limit
+     */
+    inline uint64_t chunkSize(const int &fd, const uint64_t &length)
+    {
+        uint64_t block = 4096;
+        struct stat sts;
+        if (fd >= 0 && fstat(fd, &sts) == 0 && sts.st_blksize > 0)
+        {
+            block = sts.st_blksize;
+        }
+        uint64_t size = (length + block - 1) / block * block;
+        return std::max<uint64_t>(block, std::min(size, chunkLimit(block)));
+    }
+    inline uint64_t chunkSize(std::FILE *file, const uint64_t &length)
+    {
+        return chunkSize(file ? fileno(file) : -1, length);
+    }
 
     class Chunk
     {
     public:
         Chunk() = default;
-        Chunk(const uint64_t &size) : m_size(0), m_data(size), m_rsize(size) {}
+        Chunk(const uint64_t &size) : m_size(0), m_rsize(size), m_data(std::make_shared<Buffer>(size)) {}
         virtual ~Chunk() = default;
 
-        virtual char *data() const noexcept { return m_data.get(); }
+        virtual char *data() const noexcept { return m_data ? m_data->get() : nullptr; }
         virtual uint64_t size() const noexcept { return m_size; }
-        virtual bool empty() const noexcept { return m_data.get() == nullptr || m_size == 0; }
+        virtual bool empty() const noexcept { return data() == nullptr || m_size == 0; }
 
     protected:
-        uint64_t m_size;
-        uint64_t m_rsize;
-        Buffer m_data;
+        uint64_t m_size = 0;
+        uint64_t m_rsize = 0;
+        // copies of a chunk share the buffer
+        std::shared_ptr<Buffer> m_data;
     };
 
     class ChunkFile : public Chunk
     {
     public:
         ChunkFile() = default;
+        // a copy is an iterator on the same file, it does not restore the file
         ChunkFile(const ChunkFile &other) { *this = other; }
-        ChunkFile(std::FILE *&file) : m_file(file),                // file pointer
-                                      Chunk(flength(file)),        // memory allocated
-                                      m_storage(std::ftell(file)), // current position
-                                      m_mlength(flength(file)),    // file length
-                                      m_length(m_mlength),         // chunk length <= file length, the end of the chunk
-                                      m_offset(0),                 // start position
-                                      m_bsize(m_mlength)           // expected chunk size
+        ChunkFile(std::FILE *&file) : m_file(file),                          // file pointer
+                                      Chunk(chunkSize(file, flength(file))), // memory allocated, bounded
+                                      m_storage(std::ftell(file)),           // current position
+                                      m_mlength(flength(file)),              // file length
+                                      m_length(m_mlength),                   // chunk length <= file length, the end of the chunk
+                                      m_offset(0),                           // start position
+                                      m_bsize(chunkSize(file, m_mlength))    // expected chunk size
         {
         }
         ChunkFile(std::FILE *&file, const uint64_t &size) : m_file(file),
@@ -75,12 +122,21 @@ namespace cbsp
         }
         virtual ~ChunkFile()
         {
-            reset();
+            if (m_owner)
+                reset();
         };
 
         ChunkFile &operator=(const ChunkFile &other)
         {
-            std::memcpy(this, &other, sizeof(ChunkFile));
+            Chunk::operator=(other);
+            m_file = other.m_file;
+            m_storage = other.m_storage;
+            m_mlength = other.m_mlength;
+            m_length = other.m_length;
+            m_offset = other.m_offset;
+            m_bsize = other.m_bsize;
+            m_owner = false;
+            return *this;
         }
         bool operator==(const ChunkFile &other) const noexcept
         {
@@ -117,8 +173,10 @@ namespace cbsp
             else
             {
                 std::fseek(m_file, m_offset, SEEK_SET);
-                memset(m_data.get(), 0, m_rsize);
-                m_size = std::fread(m_data.get(), sizeof(char), m_bsize, m_file);
+                memset(data(), 0, m_rsize);
+                m_size = std::fread(data(), sizeof(char), m_bsize, m_file);
+                CBSP_STATS_ADD(BYTES_READ, m_size);
+                CBSP_STATS_ADD(SEEKS, 2);
                 if (m_size != m_bsize)
                 {
                     m_bsize = m_size;
@@ -131,7 +189,8 @@ namespace cbsp
 
         void reset() noexcept
         {
-            std::fseek(m_file, m_storage, SEEK_SET);
+            if (m_file)
+                std::fseek(m_file, m_storage, SEEK_SET);
         }
         ChunkFile &begin() noexcept
         {
@@ -150,6 +209,8 @@ namespace cbsp
             static ChunkFile chunkfile;
             chunkfile = *this;
             chunkfile.m_offset = m_length;
+            // the end is never read
+            chunkfile.m_data.reset();
 
             return chunkfile;
         }
@@ -162,13 +223,14 @@ namespace cbsp
 
     private:
         // keep file first
-        std::FILE *m_file;
-        uint64_t m_storage;
-        uint64_t m_mlength;
-        uint64_t m_length;
+        std::FILE *m_file = nullptr;
+        uint64_t m_storage = 0;
+        uint64_t m_mlength = 0;
+        uint64_t m_length = 0;
         // keep last
-        uint64_t m_offset;
-        uint64_t m_bsize;
+        uint64_t m_offset = 0;
+        uint64_t m_bsize = 0;
+        bool m_owner = true;
 
         uint64_t flength(std::FILE *&file) noexcept
         {
@@ -188,6 +250,289 @@ namespace cbsp
         }
     };
 
+    // the ring holds Buffers, the stream has the linkage of the Buffer
+    namespace
+    {
+        /*
+         * read a range of a file ahead of its consumer
+         * a reader thread fills a ring of buffers with pread,
+         * while the consumer checks, mixes and writes the previous chunk
+         * a range of one chunk is read in place, without a thread
+         */
+        class ChunkStream
+        {
+        public:
+            ChunkStream(std::FILE *&file, const uint64_t &offset, const uint64_t &length,
+                        const uint64_t &size = 0, const size_t &depth = stream_depth)
+                : m_fd(fileno(file)),
+                  m_offset(offset),
+                  m_end(offset + length),
+                  m_bsize(std::max<uint64_t>(1, std::min(size ? size : chunkSize(m_fd, length), length))),
+                  m_depth(std::max<size_t>(2, depth))
+            {
+                // buffered writes of this FILE must reach the fd before pread
+                std::fflush(file);
+                m_ring.reserve(m_depth);
+                if (length > m_bsize)
+                {
+                    for (size_t i = 0; i < m_depth; i++)
+                    {
+                        m_ring.push_back({Buffer(m_bsize), 0});
+                    }
+                    m_reader = std::thread(&ChunkStream::fill, this);
+                }
+                else
+                {
+                    m_ring.push_back({Buffer(m_bsize), 0});
+                }
+            }
+            // the rest of a file from its current position
+            ChunkStream(std::FILE *&file) : ChunkStream(file, std::ftell(file), restLength(file))
+            {
+            }
+            ChunkStream(const ChunkStream &) = delete;
+            ChunkStream &operator=(const ChunkStream &) = delete;
+            ~ChunkStream()
+            {
+                if (m_reader.joinable())
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_stop = true;
+                    }
+                    m_cond.notify_all();
+                    m_reader.join();
+                }
+            }
+
+            /*
+             * the next chunk, false at the end or on a read error
+             * data is owned by the stream until the next call
+             */
+            bool next(char *&data, uint64_t &size)
+            {
+                // the time the consumer waits for data
+                CBSP_STATS_TIMER(READ);
+                CBSP_TRACE_SPAN("read");
+                if (!m_reader.joinable())
+                {
+                    return readInPlace(data, size);
+                }
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_taken)
+                {
+                    m_taken = false;
+                    m_head = (m_head + 1) % m_depth;
+                    m_count--;
+                    m_cond.notify_all();
+                }
+                m_cond.wait(lock, [this]
+                            { return m_count > 0 || m_done; });
+                if (m_count == 0)
+                {
+                    return false;
+                }
+                auto &slot = m_ring[m_head];
+                m_taken = true;
+                data = slot.data.get();
+                size = slot.size;
+                return true;
+            }
+
+            // the range was read completely
+            bool good() const noexcept { return !m_error; }
+
+        private:
+            struct Slot
+            {
+                Buffer data;
+                uint64_t size;
+            };
+
+            static uint64_t restLength(std::FILE *&file)
+            {
+                long offset = std::ftell(file);
+                std::fseek(file, 0, SEEK_END);
+                long length = std::ftell(file);
+                std::fseek(file, offset, SEEK_SET);
+                return (length > offset) ? length - offset : 0;
+            }
+
+            // read a whole chunk at offset, short only at the end of file
+            bool readAt(char *data, const uint64_t &size, const uint64_t &offset, uint64_t &done)
+            {
+                CBSP_TRACE_SPAN("pread");
+                done = 0;
+                while (done < size)
+                {
+                    ssize_t n = pread(m_fd, data + done, size - done, offset + done);
+                    CBSP_STATS_ADD(SYSCALLS, 1);
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    if (n < 0)
+                        return false;
+                    if (n == 0)
+                        break;
+                    done += n;
+                }
+                CBSP_STATS_ADD(BYTES_READ, done);
+                return true;
+            }
+
+            bool readInPlace(char *&data, uint64_t &size)
+            {
+                if (m_error || m_offset >= m_end)
+                {
+                    return false;
+                }
+                auto &slot = m_ring.front();
+                uint64_t want = std::min(m_bsize, m_end - m_offset);
+                if (!readAt(slot.data.get(), want, m_offset, slot.size) || slot.size == 0)
+                {
+                    m_error = slot.size == 0 ? m_error : true;
+                    m_offset = m_end;
+                    return false;
+                }
+                m_offset += slot.size;
+                data = slot.data.get();
+                size = slot.size;
+                return true;
+            }
+
+            void fill()
+            {
+                size_t tail = 0;
+                while (m_offset < m_end)
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        m_cond.wait(lock, [this]
+                                    { return m_count < m_depth || m_stop; });
+                        if (m_stop)
+                            break;
+                    }
+
+                    // the slot at tail is not seen by the consumer until count grows
+                    auto &slot = m_ring[tail];
+                    uint64_t want = std::min(m_bsize, m_end - m_offset);
+                    bool ok = readAt(slot.data.get(), want, m_offset, slot.size);
+
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (!ok || slot.size == 0)
+                    {
+                        m_error = !ok;
+                        break;
+                    }
+                    m_offset += slot.size;
+                    tail = (tail + 1) % m_depth;
+                    m_count++;
+                    m_cond.notify_all();
+                }
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done = true;
+                m_cond.notify_all();
+            }
+
+            int m_fd = -1;
+            uint64_t m_offset = 0;
+            uint64_t m_end = 0;
+            uint64_t m_bsize = 0;
+            size_t m_depth = 0;
+            std::vector<Slot> m_ring;
+
+            std::thread m_reader;
+            std::mutex m_mutex;
+            std::condition_variable m_cond;
+            size_t m_head = 0;
+            size_t m_count = 0;
+            bool m_taken = false;
+            bool m_done = false;
+            bool m_stop = false;
+            bool m_error = false;
+        };
+    }
+
+    /*
+     * the data extents of a file with holes, false if it has no hole
+     * asked with SEEK_DATA and SEEK_HOLE, a file system without them has no holes
+     */
+    inline bool dataExtents(const int &fd, const uint64_t &length, std::vector<CBSP_EXTENT> &extents)
+    {
+        extents.clear();
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        off_t restore = lseek(fd, 0, SEEK_CUR);
+        uint64_t stored = 0;
+        bool ok = true;
+        for (uint64_t pos = 0; pos < length;)
+        {
+            off_t data = lseek(fd, pos, SEEK_DATA);
+            // only a hole up to the end
+            if (data < 0 && errno == ENXIO)
+                break;
+            off_t hole = (data < 0) ? -1 : lseek(fd, data, SEEK_HOLE);
+            if (hole < 0)
+            {
+                ok = false;
+                break;
+            }
+            uint64_t end = std::min<uint64_t>(hole, length);
+            if (static_cast<uint64_t>(data) >= end)
+                break;
+            extents.push_back({static_cast<uint64_t>(data), end - data});
+            stored += end - data;
+            pos = end;
+        }
+        lseek(fd, restore, SEEK_SET);
+        if (ok && stored < length)
+        {
+            return true;
+        }
+#endif
+        extents.clear();
+        return false;
+    }
+
+    // copy length bytes from in to out, in kernel if possible
+    inline bool copyRange(int in, uint64_t inOffset, int out, uint64_t outOffset, uint64_t length)
+    {
+        while (length > 0)
+        {
+            loff_t ioff = inOffset, ooff = outOffset;
+            ssize_t n = copy_file_range(in, &ioff, out, &ooff, length, 0);
+            CBSP_STATS_ADD(SYSCALLS, 1);
+            if (n <= 0)
+                break;
+            CBSP_STATS_ADD(BYTES_READ, n);
+            CBSP_STATS_ADD(BYTES_WRITTEN, n);
+            inOffset += n;
+            outOffset += n;
+            length -= n;
+        }
+        if (length == 0)
+        {
+            return true;
+        }
+
+        // not supported by the file system, copy through user space
+        Buffer buffer(chunkSize(in, length));
+        while (length > 0)
+        {
+            ssize_t n = pread(in, buffer.get(), std::min<uint64_t>(length, buffer.size()), inOffset);
+            CBSP_STATS_ADD(SYSCALLS, 2);
+            if (n <= 0 || pwrite(out, buffer.get(), n, outOffset) != n)
+            {
+                return false;
+            }
+            CBSP_STATS_ADD(BYTES_READ, n);
+            CBSP_STATS_ADD(BYTES_WRITTEN, n);
+            inOffset += n;
+            outOffset += n;
+            length -= n;
+        }
+        return true;
+    }
+
     class CBSPFile
     {
     public:
@@ -232,8 +577,8 @@ namespace cbsp
         }
 
         // open a cbsp file for read and write
-        // create if not exist
-        int create(const char *filename)
+        // create if not exist, a new cbsp mixes its content with mixer
+        int create(const char *filename, const int &mixer = 0)
         {
             close();
             // if exists, move to the end
@@ -257,6 +602,8 @@ namespace cbsp
             {
                 CBSP_HEADER header;
                 header.size = sizeof(CBSP_HEADER);
+                header.mixer = mixer;
+                header.keyCheck = (mixer == CBSP_MIX_XOR) ? mixKeyCheck() : 0;
                 setHeader(m_file, header);
             }
 
@@ -278,6 +625,12 @@ namespace cbsp
                 close();
                 return CBSP_ERR_NO_CBSP;
             }
+            // a wrong --key is told before any content is mixed with it
+            if (length > 0 && !keyMatch(getHeader(m_file)))
+            {
+                close();
+                return CBSP_ERR_BAD_KEY;
+            }
 
             return CBSP_ERR_SUCCESS;
         }
@@ -0,0 +1,299 @@
+#ifndef _CBSP_INDEX_H_
+#define _CBSP_INDEX_H_
+
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "cbsp_structor.hpp"
+#include "cbsp_error.hpp"
+#include "cbsp_utils.hpp"
+#include "cbsp_crc.hpp"
+#include "cbsp_trace.hpp"
+
+/*
+ * blocker index
+ * the fields a scan needs are copied column-wise to one region at the end of the cbsp file,
+ * a lookup or a sum reads a column instead of a blocker per member
+ * the index belongs to the chain it was built for, a write drops it and buildIndex makes it again
+ */
+namespace cbsp
+{
+    inline bool isIndex(const CBSP_INDEX &index, const CBSP_HEADER &header)
+    {
+        return index.magic == CBSP_INDEX_MAGIC && index.size >= sizeof(CBSP_INDEX) &&
+               index.headerCrc == header.crc && index.count == header.count;
+    }
+
+    // the index region at the end of fp and where it starts, false if there is none for this chain
+    inline bool getIndex(std::FILE *&fp, CBSP_INDEX &index, uint64_t &at)
+    {
+        uint64_t length = fileLenght(fp);
+        if (length < sizeof(CBSP_HEADER) + sizeof(CBSP_INDEX) + sizeof(CBSP_INDEX_TAIL))
+        {
+            return false;
+        }
+        auto tail = read<CBSP_INDEX_TAIL>(fp, length - sizeof(CBSP_INDEX_TAIL), sizeof(CBSP_INDEX_TAIL));
+        if (tail.magic != CBSP_INDEX_MAGIC || tail.size != sizeof(CBSP_INDEX_TAIL) || tail.offset >= length)
+        {
+            return false;
+        }
+        at = tail.offset;
+        index = read<CBSP_INDEX>(fp, at, sizeof(CBSP_INDEX));
+        return isIndex(index, getHeader(fp)) && index.length == length - at;
+    }
+
+    // cut the index off fp, the chain is about to change
+    inline int dropIndex(std::FILE *&fp)
+    {
+        CBSP_INDEX index;
+        uint64_t at = 0;
+        if (!fp || !getIndex(fp, index, at))
+        {
+            return CBSP_ERR_SUCCESS;
+        }
+        std::fflush(fp);
+        if (ftruncate(fileno(fp), at) != 0)
+        {
+            ErrorMessage::setMessage("Drop index failed");
+            return CBSP_ERR_CREATE_FAILED;
+        }
+        return CBSP_ERR_SUCCESS;
+    }
+
+    // write the index of the chain of fp to its end, an old one is replaced
+    inline int buildIndex(std::FILE *&fp)
+    {
+        CBSP_TRACE_SPAN("index");
+        if (!fp)
+        {
+            return CBSP_ERR_NO_TARGET;
+        }
+        if (!isCBSP(fp))
+        {
+            return CBSP_ERR_NO_CBSP;
+        }
+        if (!crcMatch(fp))
+        {
+            return CBSP_ERR_BAD_CBSP;
+        }
+        int ret = dropIndex(fp);
+        if (ret != CBSP_ERR_SUCCESS)
+        {
+            return ret;
+        }
+
+        auto header = getHeader(fp);
+        std::vector<uint32_t> digests;
+        std::vector<uint64_t> blockers, offsets, lengths, sizes;
+        digests.reserve(header.count);
+        blockers.reserve(header.count);
+        offsets.reserve(header.count);
+        lengths.reserve(header.count);
+        sizes.reserve(header.count);
+        uint64_t at = header.first;
+        auto blocker = getFirst(fp, header);
+        for (auto count = header.count; count > 0; count--)
+        {
+            if (!isCBSP(blocker))
+            {
+                return CBSP_ERR_BAD_CBSP;
+            }
+            uint64_t length = getLength(fp, blocker);
+            digests.push_back(blocker.pathDigest);
+            blockers.push_back(at);
+            offsets.push_back(blocker.offset);
+            lengths.push_back(length);
+            sizes.push_back(isSparse(blocker) ? blocker.fileSize : length);
+            at = blocker.next;
+            blocker = getCBSPBlocker(fp, blocker.next);
+        }
+
+        // the columns are 8 aligned in the file, so in a mapping of it
+        uint64_t start = fileLenght(fp);
+        auto align = [&start](const uint64_t &offset)
+        {
+            return ((start + offset + 7) & ~7ull) - start;
+        };
+        CBSP_INDEX index;
+        index.magic = CBSP_INDEX_MAGIC;
+        index.size = sizeof(CBSP_INDEX);
+        index.headerCrc = header.crc;
+        index.count = header.count;
+        index.digests = align(sizeof(CBSP_INDEX));
+        index.blockers = align(index.digests + digests.size() * sizeof(uint32_t));
+        index.offsets = index.blockers + blockers.size() * sizeof(uint64_t);
+        index.lengths = index.offsets + offsets.size() * sizeof(uint64_t);
+        index.sizes = index.lengths + lengths.size() * sizeof(uint64_t);
+        uint64_t end = index.sizes + sizes.size() * sizeof(uint64_t);
+        index.length = end + sizeof(CBSP_INDEX_TAIL);
+
+        CBSP_INDEX_TAIL tail;
+        tail.magic = CBSP_INDEX_MAGIC;
+        tail.size = sizeof(CBSP_INDEX_TAIL);
+        tail.offset = start;
+
+        std::vector<char> region(index.length, 0);
+        auto put = [&region](const uint64_t &offset, const void *data, const size_t &size)
+        {
+            if (size > 0)
+                memcpy(region.data() + offset, data, size);
+        };
+        put(index.digests, digests.data(), digests.size() * sizeof(uint32_t));
+        put(index.blockers, blockers.data(), blockers.size() * sizeof(uint64_t));
+        put(index.offsets, offsets.data(), offsets.size() * sizeof(uint64_t));
+        put(index.lengths, lengths.data(), lengths.size() * sizeof(uint64_t));
+        put(index.sizes, sizes.data(), sizes.size() * sizeof(uint64_t));
+        index.crc = crc32(region.data() + index.digests, end - index.digests);
+        put(0, &index, sizeof(CBSP_INDEX));
+        put(end, &tail, sizeof(CBSP_INDEX_TAIL));
+
+        std::fflush(fp);
+        if (pwrite(fileno(fp), region.data(), region.size(), start) != static_cast<ssize_t>(region.size()))
+        {
+            ftruncate(fileno(fp), start);
+            ErrorMessage::setMessage("Write index failed");
+            return CBSP_ERR_CREATE_FAILED;
+        }
+        CBSP_STATS_ADD(BYTES_WRITTEN, region.size());
+        return CBSP_ERR_SUCCESS;
+    }
+
+    /*
+     * the index of a cbsp file, mapped read only
+     * the columns are plain arrays, a scan of one runs at memory speed
+     */
+    class CBSPIndex
+    {
+    public:
+        CBSPIndex() = default;
+        CBSPIndex(const CBSPIndex &) = delete;
+        CBSPIndex &operator=(const CBSPIndex &) = delete;
+        ~CBSPIndex() { close(); }
+
+        // map the index of fp, false if it has none for its chain
+        // the columns are checked against their crc unless verify is none
+        bool open(std::FILE *&fp, const int &verify = verifyLevel())
+        {
+            close();
+            if (!fp)
+            {
+                return false;
+            }
+            std::fflush(fp);
+            CBSP_INDEX index;
+            uint64_t at = 0;
+            if (!getIndex(fp, index, at))
+            {
+                return false;
+            }
+            uint64_t end = index.length - sizeof(CBSP_INDEX_TAIL);
+            uint64_t count = index.count;
+            if (index.digests + count * sizeof(uint32_t) > index.blockers || (at + index.blockers) % sizeof(uint64_t) != 0 ||
+                index.blockers + count * sizeof(uint64_t) > index.offsets ||
+                index.offsets + count * sizeof(uint64_t) > index.lengths ||
+                index.lengths + count * sizeof(uint64_t) > index.sizes ||
+                index.sizes + count * sizeof(uint64_t) > end)
+            {
+                return false;
+            }
+
+            uint64_t page = sysconf(_SC_PAGESIZE);
+            uint64_t start = at - at % page;
+            m_length = at + index.length - start;
+            void *map = mmap(nullptr, m_length, PROT_READ, MAP_SHARED, fileno(fp), start);
+            CBSP_STATS_ADD(SYSCALLS, 1);
+            if (map == MAP_FAILED)
+            {
+                m_length = 0;
+                return false;
+            }
+            m_map = map;
+            const char *base = static_cast<const char *>(map) + (at - start);
+            if (verify > CBSP_VERIFY_NONE && crc32(base + index.digests, end - index.digests) != index.crc)
+            {
+                ErrorMessage::setMessage("Index crc mismatch");
+                close();
+                return false;
+            }
+            m_count = count;
+            m_digests = reinterpret_cast<const uint32_t *>(base + index.digests);
+            m_blockers = reinterpret_cast<const uint64_t *>(base + index.blockers);
+            m_offsets = reinterpret_cast<const uint64_t *>(base + index.offsets);
+            m_lengths = reinterpret_cast<const uint64_t *>(base + index.lengths);
+            m_sizes = reinterpret_cast<const uint64_t *>(base + index.sizes);
+            return true;
+        }
+
+        void close()
+        {
+            if (m_map)
+            {
+                munmap(m_map, m_length);
+                m_map = nullptr;
+            }
+            m_length = 0;
+            m_count = 0;
+        }
+
+        operator bool() const { return m_map != nullptr; }
+        size_t size() const noexcept { return m_count; }
+        const uint32_t *digests() const noexcept { return m_digests; }
+        const uint64_t *blockers() const noexcept { return m_blockers; }
+        const uint64_t *offsets() const noexcept { return m_offsets; }
+        const uint64_t *lengths() const noexcept { return m_lengths; }
+        const uint64_t *sizes() const noexcept { return m_sizes; }
+
+        // the members with a path digest, in chain order
+        std::vector<size_t> find(const uint32_t &digest) const
+        {
+            std::vector<size_t> found;
+            for (size_t i = 0; i < m_count; i++)
+            {
+                if (m_digests[i] == digest)
+                {
+                    found.push_back(i);
+                }
+            }
+            return found;
+        }
+
+        // the bytes of all files, holes included
+        uint64_t totalSize() const
+        {
+            return std::accumulate(m_sizes, m_sizes + m_count, uint64_t(0));
+        }
+
+        // the n largest members, largest first
+        std::vector<size_t> largest(size_t n) const
+        {
+            std::vector<size_t> order(m_count);
+            std::iota(order.begin(), order.end(), size_t(0));
+            n = std::min(n, order.size());
+            auto sizes = m_sizes;
+            std::partial_sort(order.begin(), order.begin() + n, order.end(), [sizes](const size_t &a, const size_t &b)
+                              { return sizes[a] > sizes[b] || (sizes[a] == sizes[b] && a < b); });
+            order.resize(n);
+            return order;
+        }
+
+    private:
+        void *m_map = nullptr;
+        uint64_t m_length = 0;
+        size_t m_count = 0;
+        const uint32_t *m_digests = nullptr;
+        const uint64_t *m_blockers = nullptr;
+        const uint64_t *m_offsets = nullptr;
+        const uint64_t *m_lengths = nullptr;
+        const uint64_t *m_sizes = nullptr;
+    };
+}
+
+#endif
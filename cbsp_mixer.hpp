@@ -1,6 +1,7 @@
 #ifndef _CBSP_MIXER_H_
 #define _CBSP_MIXER_H_
 
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
@@ -9,8 +10,144 @@
 #include "cbsp_error.hpp"
 #include "cbsp_utils.hpp"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CBSP_MIX_X86
+#include <immintrin.h>
+#endif
+
 namespace cbsp
 {
+    /*
+     * every mixer xors the content with a 64 bytes pad
+     * the pad byte of a content byte is pad[(phase + index) % 64],
+     * phase is the offset of data in the file content
+     * mixing twice with the same pad restores the content
+     * it is obfuscation, not encryption: the pad repeats every 64 bytes,
+     * so 64 known bytes of a content give it away
+     */
+    const uint64_t mix_pad_size = 64;
+
+    typedef struct _CBSP_MIX_PAD
+    {
+        alignas(64) uint8_t pad[mix_pad_size];
+    } CBSP_MIX_PAD;
+
+    // xor data with a pattern which repeats every 64 bytes from data[0]
+    using MixKernel = void (*)(uint8_t *data, uint64_t length, const uint8_t *pattern);
+
+    inline void mixScalar(uint8_t *data, uint64_t length, const uint8_t *pattern)
+    {
+        uint64_t words[mix_pad_size / sizeof(uint64_t)];
+        memcpy(words, pattern, mix_pad_size);
+        for (; length >= mix_pad_size; length -= mix_pad_size, data += mix_pad_size)
+        {
+            for (size_t i = 0; i < mix_pad_size / sizeof(uint64_t); i++)
+            {
+                uint64_t word;
+                memcpy(&word, data + i * sizeof(uint64_t), sizeof(uint64_t));
+                word ^= words[i];
+                memcpy(data + i * sizeof(uint64_t), &word, sizeof(uint64_t));
+            }
+        }
+        for (uint64_t i = 0; i < length; i++)
+        {
+            data[i] ^= pattern[i];
+        }
+    }
+
+#ifdef CBSP_MIX_X86
+    __attribute__((target("sse2"))) inline void mixSSE2(uint8_t *data, uint64_t length, const uint8_t *pattern)
+    {
+        const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+        const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 16));
+        const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 32));
+        const __m128i p3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 48));
+        for (; length >= mix_pad_size; length -= mix_pad_size, data += mix_pad_size)
+        {
+            auto d = reinterpret_cast<__m128i *>(data);
+            _mm_storeu_si128(d + 0, _mm_xor_si128(_mm_loadu_si128(d + 0), p0));
+            _mm_storeu_si128(d + 1, _mm_xor_si128(_mm_loadu_si128(d + 1), p1));
+            _mm_storeu_si128(d + 2, _mm_xor_si128(_mm_loadu_si128(d + 2), p2));
+            _mm_storeu_si128(d + 3, _mm_xor_si128(_mm_loadu_si128(d + 3), p3));
+        }
+        mixScalar(data, length, pattern);
+    }
+
+    __attribute__((target("avx2"))) inline void mixAVX2(uint8_t *data, uint64_t length, const uint8_t *pattern)
+    {
+        const __m256i p0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pattern));
+        const __m256i p1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pattern + 32));
+        for (; length >= 2 * mix_pad_size; length -= 2 * mix_pad_size, data += 2 * mix_pad_size)
+        {
+            auto d = reinterpret_cast<__m256i *>(data);
+            _mm256_storeu_si256(d + 0, _mm256_xor_si256(_mm256_loadu_si256(d + 0), p0));
+            _mm256_storeu_si256(d + 1, _mm256_xor_si256(_mm256_loadu_si256(d + 1), p1));
+            _mm256_storeu_si256(d + 2, _mm256_xor_si256(_mm256_loadu_si256(d + 2), p0));
+            _mm256_storeu_si256(d + 3, _mm256_xor_si256(_mm256_loadu_si256(d + 3), p1));
+        }
+        mixScalar(data, length, pattern);
+    }
+
+    __attribute__((target("avx512f"))) inline void mixAVX512(uint8_t *data, uint64_t length, const uint8_t *pattern)
+    {
+        const __m512i p = _mm512_loadu_si512(pattern);
+        for (; length >= 4 * mix_pad_size; length -= 4 * mix_pad_size, data += 4 * mix_pad_size)
+        {
+            _mm512_storeu_si512(data, _mm512_xor_si512(_mm512_loadu_si512(data), p));
+            _mm512_storeu_si512(data + 64, _mm512_xor_si512(_mm512_loadu_si512(data + 64), p));
+            _mm512_storeu_si512(data + 128, _mm512_xor_si512(_mm512_loadu_si512(data + 128), p));
+            _mm512_storeu_si512(data + 192, _mm512_xor_si512(_mm512_loadu_si512(data + 192), p));
+        }
+        mixScalar(data, length, pattern);
+    }
+#endif
+
+    // the best kernel of this cpu, selected once
+    inline MixKernel mixKernel()
+    {
+        static const MixKernel kernel = []() -> MixKernel
+        {
+#ifdef CBSP_MIX_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+                return mixAVX512;
+            if (__builtin_cpu_supports("avx2"))
+                return mixAVX2;
+            if (__builtin_cpu_supports("sse2"))
+                return mixSSE2;
+#endif
+            return mixScalar;
+        }();
+        return kernel;
+    }
+
+    // rotate the pad, so that the pattern starts at data[0]
+    inline void mixPattern(const CBSP_MIX_PAD &pad, uint64_t phase, uint8_t *pattern)
+    {
+        for (size_t i = 0; i < mix_pad_size; i++)
+        {
+            pattern[i] = pad.pad[(phase + i) % mix_pad_size];
+        }
+    }
+
+    inline void mixPad(uint8_t *data, uint64_t length, const CBSP_MIX_PAD &pad, uint64_t phase)
+    {
+        alignas(64) uint8_t pattern[mix_pad_size];
+        mixPattern(pad, phase, pattern);
+        mixKernel()(data, length, pattern);
+    }
+
+    inline const CBSP_MIX_PAD &mixLinearPad()
+    {
+        static const CBSP_MIX_PAD pad = []
+        {
+            CBSP_MIX_PAD p;
+            memset(p.pad, 0xFF, mix_pad_size);
+            return p;
+        }();
+        return pad;
+    }
+
     inline int mixLinear(uint8_t *data, uint64_t length)
     {
         if (data == nullptr)
@@ -18,27 +155,110 @@ namespace cbsp
             return CBSP_ERR_BAD_OFFSET;
         }
 
-        while (length-- > 0)
+        mixPad(data, length, mixLinearPad(), 0);
+
+        return CBSP_ERR_SUCCESS;
+    }
+
+    // the key of xor mixer, it is not stored in cbsp
+    inline std::atomic<uint64_t> &mixKey()
+    {
+        static std::atomic<uint64_t> key{CBSP_MAGIC};
+        return key;
+    }
+
+    inline uint64_t splitmix64(uint64_t &state)
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // the xor pad expanded from the key by splitmix64
+    // every thread has its own pad, a thread rebuilding it never races a reader
+    inline const CBSP_MIX_PAD &mixKeyPad()
+    {
+        thread_local uint64_t key = ~mixKey();
+        thread_local CBSP_MIX_PAD pad;
+        uint64_t current = mixKey();
+        if (key != current)
+        {
+            key = current;
+            uint64_t state = key;
+            for (size_t i = 0; i < mix_pad_size; i += sizeof(uint64_t))
+            {
+                uint64_t z = splitmix64(state);
+                memcpy(pad.pad + i, &z, sizeof(uint64_t));
+            }
+        }
+        return pad;
+    }
+
+    // stored in the header of a xor archive, drawn past the pad so it tells nothing of it
+    inline uint32_t mixKeyCheck()
+    {
+        uint64_t state = mixKey();
+        for (size_t i = 0; i < mix_pad_size; i += sizeof(uint64_t))
+        {
+            splitmix64(state);
+        }
+        uint32_t check = static_cast<uint32_t>(splitmix64(state) >> 32);
+        return check ? check : 1;
+    }
+
+    inline int mixXor(uint8_t *data, uint64_t length, uint64_t phase)
+    {
+        if (data == nullptr)
         {
-            *data = ~*data;
-            data++;
+            return CBSP_ERR_BAD_OFFSET;
         }
 
+        mixPad(data, length, mixKeyPad(), phase);
+
         return CBSP_ERR_SUCCESS;
     }
 
     const int CBSP_MIX_LINEAR = 1;
-    inline int mixer(uint8_t *data, uint64_t length, int type)
+    const int CBSP_MIX_XOR = 2;
+    inline int mixer(uint8_t *data, uint64_t length, int type, uint64_t phase = 0)
     {
         switch (type)
         {
         case CBSP_MIX_LINEAR:
             return mixLinear(data, length);
+        case CBSP_MIX_XOR:
+            return mixXor(data, length, phase);
         default:
             return CBSP_ERR_SUCCESS;
         }
         return CBSP_ERR_SUCCESS;
     }
+    inline int mixer(char *data, uint64_t length, int type, uint64_t phase = 0)
+    {
+        return mixer(reinterpret_cast<uint8_t *>(data), length, type, phase);
+    }
+
+    // the key is right for the archive of header, an archive without a check value takes any
+    inline bool keyMatch(const CBSP_HEADER &header)
+    {
+        return header.mixer != CBSP_MIX_XOR || header.keyCheck == 0 || header.keyCheck == mixKeyCheck();
+    }
+
+    // the pad of a mixer, nullptr if it does not mix
+    inline const CBSP_MIX_PAD *mixerPad(int type)
+    {
+        switch (type)
+        {
+        case CBSP_MIX_LINEAR:
+            return &mixLinearPad();
+        case CBSP_MIX_XOR:
+            return &mixKeyPad();
+        default:
+            return nullptr;
+        }
+        return nullptr;
+    }
 }
 
-#endif
\ No newline at end of file
+#endif
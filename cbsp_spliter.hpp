@@ -2,38 +2,118 @@
 #define _CBSP_SPLITER_H_
 
 #include <fstream>
+#include <map>
+#include <tuple>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <string>
 #include <cstdio>
 #include <memory>
 #include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "cbsp_structor.hpp"
 #include "cbsp_error.hpp"
 #include "cbsp_utils.hpp"
 #include "cbsp_tree.hpp"
 #include "cbsp_crc.hpp"
+#include "cbsp_mixer.hpp"
 
 namespace cbsp
 {
     namespace spliter
     {
-        inline int genFile(std::FILE *&fp, const char *filepath, const CBSP_BLOCKER &blocker)
+        /*
+         * write the content of a sparse file at its extents, seeking over the holes
+         * next is the extent being written, left is what it still needs
+         */
+        inline void writeSparse(std::FILE *file, char *data, uint64_t size,
+                                const std::vector<CBSP_EXTENT> &extents, size_t &next, uint64_t &left)
+        {
+            while (size > 0 && next < extents.size())
+            {
+                if (left == 0)
+                {
+                    left = extents[next].length;
+                    std::fseek(file, extents[next].offset, SEEK_SET);
+                }
+                uint64_t n = std::min(size, left);
+                write(file, data, n);
+                data += n;
+                size -= n;
+                left -= n;
+                if (left == 0)
+                {
+                    next++;
+                }
+            }
+        }
+
+        /*
+         * the file is created in its directory handle from dirs
+         * at full verify its content is checked before and after it is written
+         */
+        inline int genFile(std::FILE *&fp, DirCache &dirs, const char *filepath, const CBSP_BLOCKER &blocker,
+                           const int &verify = verifyLevel())
         {
             if (!filepath)
                 return CBSP_ERR_BAD_PATH;
-            std::FILE *file = std::fopen(filepath, "r");
-            if (file)
+            CBSP_TRACE_SPAN("extract", filepath);
+            std::string name;
+            int dirfd = dirs.parent(filepath, name);
+            if (dirfd == -1)
+            {
+                return CBSP_ERR_NO_TARGET;
+            }
+            if (faccessat(dirfd, name.c_str(), F_OK, 0) == 0)
             {
-                std::fclose(file);
                 ErrorMessage::setMessage("%s already exists", filepath);
                 return CBSP_ERR_AL_EXIST;
             }
-            file = nullptr;
+            std::FILE *file = nullptr;
             auto _offset = std::ftell(fp);
 
             std::fseek(fp, blocker.offset, SEEK_SET);
             uint64_t length = blocker.length;
 
-            uint32_t crc = crcBlocker(fp, blocker);
+            uint32_t crc = blocker.crc;
+            bool full = verify >= CBSP_VERIFY_FULL;
+            // a legacy crc covers a part of the last chunk only, it is checked in the cbsp file
+            bool legacy = full && !hasBlocks(blocker) && isLegacy(getHeader(fp), blocker);
+            if (legacy && !legacyMatch(fileno(fp), blocker.offset, blocker.mixer, blocker))
+            {
+                ErrorMessage::setMessage("Blocker %s broken", filepath);
+                ErrorMessage::setMessage("Mismatch legacy crc 0x%x", blocker.crc);
+                return CBSP_ERR_AL_MODIFY | CBSP_ERR_BAD_CBSP;
+            }
+            if (full && hasBlocks(blocker))
+            {
+                // the blocks are checked on threads, a broken one is named
+                std::vector<uint32_t> blocks;
+                if (!getBlocks(fp, blocker, blocks))
+                {
+                    ErrorMessage::setMessage("Blocks of %s broken", filepath);
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                auto broken = verifyBlocks(fp, blocker, blocks, 0, blocks.size());
+                for (auto &block : broken)
+                {
+                    uint64_t offset = block * blocker.blockSize;
+                    ErrorMessage::setMessage("Block %lu of %s broken, bytes %lu to %lu", block, filepath,
+                                             offset, std::min(offset + blocker.blockSize, blocker.length));
+                }
+                if (!broken.empty())
+                {
+                    return CBSP_ERR_AL_MODIFY | CBSP_ERR_BAD_CBSP;
+                }
+            }
+            else if (full && !legacy)
+            {
+                crc = crcBlocker(fp, blocker);
+            }
             if (crc != blocker.crc)
             {
                 ErrorMessage::setMessage("Blocker %s broken", filepath);
@@ -41,34 +121,104 @@ namespace cbsp
                 return CBSP_ERR_AL_MODIFY | CBSP_ERR_BAD_CBSP;
             }
 
-            file = std::fopen(filepath, "wb");
+            std::vector<CBSP_EXTENT> extents;
+            if (!getExtents(fp, blocker, extents))
+            {
+                ErrorMessage::setMessage("Extents of %s broken", filepath);
+                return CBSP_ERR_BAD_CBSP;
+            }
+
+            int fd = openat(dirfd, name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+            file = (fd >= 0) ? fdopen(fd, "wb") : nullptr;
             if (!file)
             {
+                if (fd >= 0)
+                    close(fd);
                 return CBSP_ERR_NO_TARGET;
             }
 
-            ChunkFile chunkfile(fp, batch_size, blocker.offset, blocker.length);
-            for (auto it = chunkfile.begin(); it != chunkfile.end(); it++)
+            uint64_t phase = 0;
+            size_t next = 0;
+            uint64_t left = 0;
+            for (auto &segment : getSegments(fp, blocker))
             {
-                auto &chunk = *it;
-                write(file, chunk.data(), chunk.size());
+                ChunkStream stream(fp, segment.offset, segment.length);
+                char *data = nullptr;
+                uint64_t size = 0;
+                while (stream.next(data, size))
+                {
+                    mixer(data, size, blocker.mixer, phase);
+                    phase += size;
+                    CBSP_TRACE_SPAN("write");
+                    if (isSparse(blocker))
+                        writeSparse(file, data, size, extents, next, left);
+                    else
+                        write(file, data, size);
+                }
+                // a short read of the archive leaves the file short
+                if (!stream.good())
+                {
+                    std::fclose(file);
+                    ErrorMessage::setMessage("Extract %s failed", filepath);
+                    return CBSP_ERR_BAD_CBSP;
+                }
             }
 
+            // the holes are left unwritten, the size covers a hole at the end
+            bool sized = !isSparse(blocker) ||
+                         (std::fflush(file) == 0 && ftruncate(fileno(file), blocker.fileSize) == 0);
             std::fclose(file);
+            if (!sized)
+            {
+                ErrorMessage::setMessage("Extract %s failed", filepath);
+                return CBSP_ERR_NO_TARGET;
+            }
             std::fseek(fp, _offset, SEEK_SET);
+            if (!full)
+            {
+                return CBSP_ERR_SUCCESS;
+            }
 
             // after write done, check the outfile crc again
-            file = std::fopen(filepath, "rb");
+            fd = openat(dirfd, name.c_str(), O_RDONLY | O_CLOEXEC);
+            file = (fd >= 0) ? fdopen(fd, "rb") : nullptr;
             if (!file)
             {
+                if (fd >= 0)
+                    close(fd);
                 return CBSP_ERR_NO_TARGET;
             }
             crc = 0x0;
-            ChunkFile chunkTest(file, batch_size);
-            for (auto it = chunkTest.begin(); it != chunkTest.end(); it++)
+            if (legacy)
             {
-                auto &chunk = *it;
-                crc = crc32(chunk.data(), chunk.size(), crc);
+                CBSP_TRACE_SPAN("verify");
+                crc = legacyMatch(fileno(file), 0, 0, blocker) ? blocker.crc : ~blocker.crc;
+            }
+            else if (isSparse(blocker))
+            {
+                // the crc is of the extents only
+                CBSP_TRACE_SPAN("verify");
+                for (auto &extent : extents)
+                {
+                    ChunkStream stream(file, extent.offset, extent.length);
+                    char *data = nullptr;
+                    uint64_t size = 0;
+                    while (stream.next(data, size))
+                    {
+                        crc = crc32(data, size, crc);
+                    }
+                }
+            }
+            else
+            {
+                CBSP_TRACE_SPAN("verify");
+                ChunkStream stream(file);
+                char *data = nullptr;
+                uint64_t size = 0;
+                while (stream.next(data, size))
+                {
+                    crc = crc32(data, size, crc);
+                }
             }
             std::fclose(file);
 
@@ -82,86 +232,409 @@ namespace cbsp
             return CBSP_ERR_SUCCESS;
         }
 
-        inline int extract(std::FILE *&fp, const char *outdir = nullptr)
+        /*
+         * read the stored bytes [stored, stored + length) of a member to dst, unmixed
+         * the content may be spread over the segments of an updated member
+         */
+        inline bool readStored(std::FILE *&fp, const CBSP_BLOCKER &blocker, const std::vector<CBSP_SEGMENT> &segments,
+                               uint64_t stored, uint64_t length, char *dst)
         {
+            int fd = fileno(fp);
+            uint64_t start = 0;
+            for (auto &segment : segments)
+            {
+                if (length == 0)
+                {
+                    break;
+                }
+                if (stored < start + segment.length)
+                {
+                    uint64_t skip = stored - start;
+                    uint64_t n = std::min(length, segment.length - skip);
+                    CBSP_STATS_ADD(SYSCALLS, 1);
+                    if (pread(fd, dst, n, segment.offset + skip) != static_cast<ssize_t>(n))
+                    {
+                        return false;
+                    }
+                    CBSP_STATS_ADD(BYTES_READ, n);
+                    mixer(dst, n, blocker.mixer, stored);
+                    dst += n;
+                    stored += n;
+                    length -= n;
+                }
+                start += segment.length;
+            }
+            return length == 0;
+        }
+
+        /*
+         * read [offset, offset + length) of a member into dst, without extracting it
+         * length is cut to the end of the file, and set to the bytes read
+         * the holes of a sparse file read as zeros
+         * at full verify a member with a block table has the blocks under the range checked, no more,
+         * other members are read unchecked, their crc covers the whole content
+         */
+        inline int readRange(std::FILE *&fp, const CBSP_BLOCKER &blocker, const uint64_t &offset, uint64_t &length, char *dst,
+                             const int &verify = verifyLevel())
+        {
+            CBSP_TRACE_SPAN("read range");
+            if (!isCBSP(blocker) || isDeleted(blocker))
+            {
+                length = 0;
+                return CBSP_ERR_NO_EXIST;
+            }
+            auto segments = getSegments(fp, blocker);
+            std::vector<CBSP_EXTENT> extents;
+            if (!getExtents(fp, blocker, extents))
+            {
+                length = 0;
+                return CBSP_ERR_BAD_CBSP;
+            }
+            uint64_t size = 0;
+            for (auto &segment : segments)
+            {
+                size += segment.length;
+            }
+            // a dense file is one extent of its stored content
+            if (isSparse(blocker))
+            {
+                size = blocker.fileSize;
+            }
+            else
+            {
+                extents.assign(1, {0, size});
+            }
+            length = (offset < size) ? std::min(length, size - offset) : 0;
+            if (length == 0)
+            {
+                return CBSP_ERR_SUCCESS;
+            }
+
+            // the extents under the range are stored one after another
+            struct Piece
+            {
+                uint64_t stored;
+                uint64_t length;
+                char *dst;
+            };
+            std::vector<Piece> pieces;
+            uint64_t stored = 0;
+            for (auto &extent : extents)
+            {
+                uint64_t begin = std::max(offset, extent.offset);
+                uint64_t end = std::min(offset + length, extent.offset + extent.length);
+                if (begin < end)
+                {
+                    pieces.push_back({stored + begin - extent.offset, end - begin, dst + begin - offset});
+                }
+                stored += extent.length;
+            }
+            if (isSparse(blocker))
+            {
+                memset(dst, 0, length);
+            }
+            if (pieces.empty())
+            {
+                return CBSP_ERR_SUCCESS;
+            }
+
+            if (verify >= CBSP_VERIFY_FULL && hasBlocks(blocker))
+            {
+                std::vector<uint32_t> blocks;
+                if (!getBlocks(fp, blocker, blocks))
+                {
+                    length = 0;
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                uint64_t first = pieces.front().stored / blocker.blockSize;
+                uint64_t last = (pieces.back().stored + pieces.back().length - 1) / blocker.blockSize + 1;
+                auto broken = verifyBlocks(fp, blocker, blocks, first, last);
+                for (auto &block : broken)
+                {
+                    uint64_t at = block * blocker.blockSize;
+                    ErrorMessage::setMessage("Block %lu broken, bytes %lu to %lu", block, at,
+                                             std::min(at + blocker.blockSize, blocker.length));
+                }
+                if (!broken.empty())
+                {
+                    length = 0;
+                    return CBSP_ERR_AL_MODIFY | CBSP_ERR_BAD_CBSP;
+                }
+            }
+
+            for (auto &piece : pieces)
+            {
+                if (!readStored(fp, blocker, segments, piece.stored, piece.length, piece.dst))
+                {
+                    length = 0;
+                    return CBSP_ERR_BAD_CBSP;
+                }
+            }
+            return CBSP_ERR_SUCCESS;
+        }
+
+        const uint64_t test_piece = 1 << 20;
+
+        /*
+         * check the chain and the content of every member, nothing is written
+         * the contents are cut into pieces at segment and block ends,
+         * pieces are read with pread and their crcs taken on threads,
+         * then combined into the crc of each member and of each of its blocks
+         * the paths of the broken members go to broken
+         */
+        inline int test(std::FILE *&fp, size_t threads = verify_threads, std::vector<std::string> *broken = nullptr)
+        {
+            CBSP_TRACE_SPAN("test");
             if (!fp)
             {
                 return CBSP_ERR_NO_TARGET;
             }
-
             if (!isCBSP(fp))
             {
                 return CBSP_ERR_NO_CBSP;
             }
-
             if (!crcMatch(fp))
             {
                 return CBSP_ERR_BAD_CBSP;
             }
 
-            if (getHeader(fp).count <= 0)
+            struct Member
             {
-                return CBSP_ERR_NO_CBSP;
+                CBSP_BLOCKER blocker;
+                std::string path;
+                std::vector<uint32_t> blocks;
+                // the member checking the content, a link shares the result of its origin
+                size_t origin;
+                bool ok;
+                uint32_t crc;
+            };
+            struct Piece
+            {
+                size_t member;
+                // offset in the content, and in the archive
+                uint64_t stored;
+                uint64_t offset;
+                uint64_t length;
+                uint32_t crc;
+            };
+            std::vector<Member> members;
+            std::vector<Piece> pieces;
+            std::map<std::tuple<uint64_t, uint64_t, uint64_t>, size_t> contents;
+            int result = CBSP_ERR_SUCCESS;
+
+            auto header = getHeader(fp);
+            auto blocker = getFirst(fp, header);
+            for (auto count = header.count; count > 0; count--, blocker = getCBSPBlocker(fp, blocker.next))
+            {
+                if (!isCBSP(blocker))
+                {
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                size_t index = members.size();
+                members.push_back({blocker, getFileDir(fp, blocker) + "/" + getFileName(fp, blocker), {}, index, true, 0x0});
+                auto &m = members.back();
+                std::vector<CBSP_EXTENT> extents;
+                if (!getExtents(fp, blocker, extents) || !getBlocks(fp, blocker, m.blocks))
+                {
+                    ErrorMessage::setMessage("Tables of %s broken", m.path.c_str());
+                    m.ok = false;
+                    continue;
+                }
+                auto content = contents.emplace(std::make_tuple(blocker.offset, blocker.length, blocker.append), index);
+                if (!content.second)
+                {
+                    m.origin = content.first->second;
+                    continue;
+                }
+
+                uint64_t block = hasBlocks(blocker) ? blocker.blockSize : test_piece;
+                uint64_t stored = 0;
+                for (auto &segment : getSegments(fp, blocker))
+                {
+                    for (uint64_t done = 0; done < segment.length;)
+                    {
+                        uint64_t n = std::min({segment.length - done, block - stored % block, test_piece});
+                        pieces.push_back({index, stored, segment.offset + done, n, 0});
+                        stored += n;
+                        done += n;
+                    }
+                }
             }
 
-            int result = CBSP_ERR_SUCCESS;
-            auto hasout = [&outdir]() -> bool
-            { return !std::string(outdir).empty(); }();
+            int fd = fileno(fp);
+            std::atomic<size_t> next{0};
+            auto worker = [&]()
+            {
+                Buffer buffer(test_piece);
+                for (size_t i = next++; i < pieces.size(); i = next++)
+                {
+                    auto &piece = pieces[i];
+                    CBSP_TRACE_SPAN("test piece");
+                    bool ok = pread(fd, buffer.get(), piece.length, piece.offset) == static_cast<ssize_t>(piece.length);
+                    CBSP_STATS_ADD(SYSCALLS, 1);
+                    CBSP_STATS_ADD(BYTES_READ, ok ? piece.length : 0);
+                    // a short read can not match, the crc of the piece is flipped
+                    piece.crc = mixCrc32(buffer.get(), ok ? piece.length : 0, members[piece.member].blocker.mixer, piece.stored);
+                    piece.crc ^= ok ? 0x0 : 0xffffffff;
+                }
+            };
+            threads = std::max<size_t>(1, std::min<size_t>(threads, pieces.size()));
+            std::vector<std::thread> pool;
+            for (size_t i = 1; i < threads; i++)
+            {
+                pool.emplace_back(worker);
+            }
+            worker();
+            for (auto &thread : pool)
+            {
+                thread.join();
+            }
 
-            auto tr = dirTree(fp);
-            tr = cropTree(tr);
-            auto old_tr = tr;
+            // combine the pieces of each member, and of each block
+            for (size_t i = 0; i < pieces.size();)
+            {
+                auto &m = members[pieces[i].member];
+                uint32_t bcrc = 0x0;
+                uint64_t blength = 0;
+                for (; i < pieces.size() && &members[pieces[i].member] == &m; i++)
+                {
+                    m.crc = crc32Combine(m.crc, pieces[i].crc, pieces[i].length);
+                    bcrc = crc32Combine(bcrc, pieces[i].crc, pieces[i].length);
+                    blength += pieces[i].length;
+                    uint64_t end = pieces[i].stored + pieces[i].length;
+                    if (hasBlocks(m.blocker) && (end % m.blocker.blockSize == 0 || end == m.blocker.length))
+                    {
+                        uint64_t index = (end - 1) / m.blocker.blockSize;
+                        if (index >= m.blocks.size() || bcrc != m.blocks[index])
+                        {
+                            ErrorMessage::setMessage("Block %lu of %s broken, bytes %lu to %lu", index, m.path.c_str(),
+                                                     end - blength, end);
+                        }
+                        bcrc = 0x0;
+                        blength = 0;
+                    }
+                }
+            }
 
-            if (hasout)
+            for (auto &m : members)
             {
-                auto dirs = listDirs(rpath(outdir));
-                while (!dirs.empty())
+                auto &origin = members[m.origin].blocker;
+                bool legacy = !hasBlocks(origin) && isLegacy(header, origin);
+                m.ok = m.ok && (legacy ? legacyMatch(fd, origin.offset, origin.mixer, origin)
+                                       : members[m.origin].crc == m.blocker.crc);
+                if (!m.ok)
                 {
-                    auto dir = dirs.back();
-                    dirs.pop_back();
-                    CBSP_TREE _tr;
-                    _tr.push_back({.isFile = false,
-                                   .path = dir,
-                                   .children = tr});
-                    tr = _tr;
+                    ErrorMessage::setMessage("Member %s broken", m.path.c_str());
+                    result |= CBSP_ERR_AL_MODIFY | CBSP_ERR_BAD_CBSP;
+                    if (broken)
+                    {
+                        broken->push_back(m.path);
+                    }
                 }
             }
-            result = conTree(tr, hasout);
-            cbsp_assert(!tr.empty());
-            if (result != CBSP_ERR_SUCCESS)
+            return result;
+        }
+
+        // the blocker of a member by its path as printTree lists it, 0 if not found
+        inline uint64_t findMember(std::FILE *&fp, const char *rpath, CBSP_BLOCKER &blocker)
+        {
+            if (!rpath || getHeader(fp).count == 0)
             {
-                return result;
+                return 0;
+            }
+            auto tr = dirTree(fp);
+            cropTree(tr);
+            auto header = getHeader(fp);
+            uint64_t at = header.first;
+            blocker = getFirst(fp, header);
+            for (size_t i = 0; i < header.count && isCBSP(blocker); i++)
+            {
+                if (memberPath(tr, i) == rpath)
+                {
+                    return at;
+                }
+                at = blocker.next;
+                blocker = getCBSPBlocker(fp, blocker.next);
             }
+            return 0;
+        }
 
-            tr = old_tr;
-            cbsp_assert(!tr.empty());
+        // another name of an extracted file, false if the file system can not link them
+        inline bool genLink(DirCache &dirs, const char *filepath, const std::string &origin)
+        {
+            CBSP_TRACE_SPAN("link", filepath);
+            std::string name;
+            int dirfd = dirs.parent(filepath, name);
+            return dirfd != -1 && linkat(AT_FDCWD, origin.c_str(), dirfd, name.c_str(), 0) == 0;
+        }
 
+        // construct the directories of a cropped tree under outdir
+        inline int makeTree(const CBSP_TREE &tree, const char *outdir, DirCache &dirs)
+        {
+            bool hasout = outdir && !std::string(outdir).empty();
+            cbsp_assert(!tree.empty());
+
+            std::string base = hasout ? std::string(outdir) : std::string(".");
+            if (dirs.open(base) == -1)
+            {
+                return CBSP_ERR_NO_TARGET;
+            }
+            return conTree(tree, base, dirs);
+        }
+
+        /*
+         * extract the members of fp, the first one is member base of tree
+         * members are in the order dirTree inserted them
+         */
+        inline int genFiles(std::FILE *&fp, const CBSP_TREE &tree, const size_t &base,
+                            const char *outdir, DirCache &dirs, const bool &links, const int &verify = verifyLevel())
+        {
+            int result = CBSP_ERR_SUCCESS;
+            bool hasout = outdir && !std::string(outdir).empty();
+
+            // paths extracted for the content of a blocker, the origin or its first link
+            std::map<uint64_t, std::string> paths;
             auto header = getHeader(fp);
+            auto at = header.first;
             auto blocker = getFirst(fp, header);
-            auto count = header.count;
-            while (count-- > 0)
+            for (size_t i = 0; i < header.count; i++)
             {
                 if (!isCBSP(blocker))
                 {
                     return CBSP_ERR_BAD_CBSP;
                 }
-                auto filename = getFileName(fp, blocker);
-                auto filedir = getFileDir(fp, blocker);
-                auto rpath = matchTree(tr, (filedir + "/" + filename).c_str());
+                auto rpath = memberPath(tree, base + i);
                 if (hasout)
                 {
                     rpath = std::string(outdir) + "/" + rpath;
                 }
                 cbsp_assert(!rpath.empty());
 
-                result |= genFile(fp, rpath.c_str(), blocker);
+                uint64_t origin = isLink(blocker) ? blocker.link : at;
+                auto path = links ? paths.find(origin) : paths.end();
+                if (path == paths.end() || !genLink(dirs, rpath.c_str(), path->second))
+                {
+                    int ret = genFile(fp, dirs, rpath.c_str(), blocker, verify);
+                    if (links && ret == CBSP_ERR_SUCCESS && path == paths.end())
+                    {
+                        paths[origin] = rpath;
+                    }
+                    result |= ret;
+                }
+                at = blocker.next;
                 blocker = getCBSPBlocker(fp, blocker.next);
             }
 
             return result;
         }
 
-        inline int printTree(std::FILE *&fp)
+        /*
+         * extract every file of cbsp under outdir
+         * with links, the hard links of a file are linked to it again
+         * instead of written as copies
+         */
+        inline int extract(std::FILE *&fp, const char *outdir = nullptr, const bool &links = false,
+                           const int &verify = verifyLevel())
         {
             if (!fp)
             {
@@ -173,7 +646,7 @@ namespace cbsp
                 return CBSP_ERR_NO_CBSP;
             }
 
-            if (!crcMatch(fp))
+            if (!verifyMatch(fp, verify))
             {
                 return CBSP_ERR_BAD_CBSP;
             }
@@ -184,25 +657,50 @@ namespace cbsp
             }
 
             auto tr = dirTree(fp);
-            tr = cropTree(tr);
+            cropTree(tr);
+
+            DirCache dirs;
+            int result = makeTree(tr, outdir, dirs);
+            if (result != CBSP_ERR_SUCCESS)
+            {
+                return result;
+            }
             cbsp_assert(!tr.empty());
 
-            auto header = getHeader(fp);
-            auto blocker = getFirst(fp, header);
-            auto count = header.count;
-            while (count-- > 0)
+            return genFiles(fp, tr, 0, outdir, dirs, links, verify);
+        }
+
+        inline int printTree(std::FILE *&fp, const int &verify = verifyLevel())
+        {
+            if (!fp)
             {
-                if (!isCBSP(blocker))
-                {
-                    return CBSP_ERR_BAD_CBSP;
-                }
-                auto filename = getFileName(fp, blocker);
-                auto filedir = getFileDir(fp, blocker);
-                auto rpath = matchTree(tr, (filedir + "/" + filename).c_str());
+                return CBSP_ERR_NO_TARGET;
+            }
+
+            if (!isCBSP(fp))
+            {
+                return CBSP_ERR_NO_CBSP;
+            }
+
+            if (!verifyMatch(fp, verify))
+            {
+                return CBSP_ERR_BAD_CBSP;
+            }
+
+            if (getHeader(fp).count <= 0)
+            {
+                return CBSP_ERR_NO_CBSP;
+            }
+
+            auto tr = dirTree(fp);
+            cropTree(tr);
+            cbsp_assert(!tr.empty());
+
+            for (size_t i = 0; i < tr.leaves.size(); i++)
+            {
+                auto rpath = memberPath(tr, i);
                 cbsp_assert(!rpath.empty());
                 fprintf(stdout, "%s\n", rpath.c_str());
-
-                blocker = getCBSPBlocker(fp, blocker.next);
             }
 
             return CBSP_ERR_SUCCESS;
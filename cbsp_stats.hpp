@@ -0,0 +1,161 @@
+#ifndef _CBSP_STATS_H_
+#define _CBSP_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+/*
+ * counters and phase timers of cbsp
+ * they are relaxed atomics, the reader of a stream and the walker count from their threads
+ * build with CBSP_NO_STATS to compile them out, Stats is then always zero
+ */
+#ifndef CBSP_NO_STATS
+#define CBSP_STATS_ADD(counter, n) cbsp::stats::add(cbsp::stats::counter, (n))
+#define CBSP_STATS_TIMER_(phase, line) cbsp::stats::Timer cbsp_stats_timer_##line(cbsp::stats::phase)
+#define CBSP_STATS_TIMER__(phase, line) CBSP_STATS_TIMER_(phase, line)
+#define CBSP_STATS_TIMER(phase) CBSP_STATS_TIMER__(phase, __LINE__)
+#else
+#define CBSP_STATS_ADD(counter, n) void(0)
+#define CBSP_STATS_TIMER(phase) void(0)
+#endif
+
+namespace cbsp
+{
+    typedef struct _CBSP_STATS
+    {
+        // counters
+        uint64_t bytesRead = 0;
+        uint64_t bytesWritten = 0;
+        uint64_t seeks = 0;
+        // system calls made directly, stdio calls are not counted
+        uint64_t syscalls = 0;
+        uint64_t blockers = 0;
+        uint64_t bufferHits = 0;
+        uint64_t bufferMisses = 0;
+        uint64_t crcBytes = 0;
+
+        // nanoseconds in each phase
+        uint64_t walk = 0;
+        uint64_t read = 0;
+        uint64_t crc = 0;
+        uint64_t write = 0;
+        uint64_t header = 0;
+        uint64_t tree = 0;
+        uint64_t mkdir = 0;
+    } Stats;
+
+    namespace stats
+    {
+        enum Counter
+        {
+            BYTES_READ,
+            BYTES_WRITTEN,
+            SEEKS,
+            SYSCALLS,
+            BLOCKERS,
+            BUFFER_HITS,
+            BUFFER_MISSES,
+            CRC_BYTES,
+
+            WALK,
+            READ,
+            CRC,
+            WRITE,
+            HEADER,
+            TREE,
+            MKDIR,
+
+            COUNTERS,
+        };
+
+        inline std::atomic<uint64_t> *counters()
+        {
+            static std::atomic<uint64_t> values[COUNTERS] = {};
+            return values;
+        }
+
+        inline void add(Counter counter, uint64_t n)
+        {
+            counters()[counter].fetch_add(n, std::memory_order_relaxed);
+        }
+
+        inline uint64_t get(Counter counter)
+        {
+            return counters()[counter].load(std::memory_order_relaxed);
+        }
+
+        // adds the time of its scope to a phase
+        class Timer
+        {
+        public:
+            explicit Timer(Counter phase) : m_phase(phase), m_start(std::chrono::steady_clock::now()) {}
+            Timer(const Timer &) = delete;
+            Timer &operator=(const Timer &) = delete;
+            ~Timer()
+            {
+                auto elapsed = std::chrono::steady_clock::now() - m_start;
+                add(m_phase, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+            }
+
+        private:
+            Counter m_phase;
+            std::chrono::steady_clock::time_point m_start;
+        };
+    }
+
+    inline Stats getStats()
+    {
+        Stats s;
+#ifndef CBSP_NO_STATS
+        s.bytesRead = stats::get(stats::BYTES_READ);
+        s.bytesWritten = stats::get(stats::BYTES_WRITTEN);
+        s.seeks = stats::get(stats::SEEKS);
+        s.syscalls = stats::get(stats::SYSCALLS);
+        s.blockers = stats::get(stats::BLOCKERS);
+        s.bufferHits = stats::get(stats::BUFFER_HITS);
+        s.bufferMisses = stats::get(stats::BUFFER_MISSES);
+        s.crcBytes = stats::get(stats::CRC_BYTES);
+        s.walk = stats::get(stats::WALK);
+        s.read = stats::get(stats::READ);
+        s.crc = stats::get(stats::CRC);
+        s.write = stats::get(stats::WRITE);
+        s.header = stats::get(stats::HEADER);
+        s.tree = stats::get(stats::TREE);
+        s.mkdir = stats::get(stats::MKDIR);
+#endif
+        return s;
+    }
+
+    inline void resetStats()
+    {
+        for (int i = 0; i < stats::COUNTERS; i++)
+        {
+            stats::counters()[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    inline void print(const Stats &s, std::FILE *out = stderr)
+    {
+        fprintf(out, "******************STATS*******************\n");
+        fprintf(out, "bytes read    : %llu\n", (unsigned long long)s.bytesRead);
+        fprintf(out, "bytes written : %llu\n", (unsigned long long)s.bytesWritten);
+        fprintf(out, "seeks         : %llu\n", (unsigned long long)s.seeks);
+        fprintf(out, "syscalls      : %llu\n", (unsigned long long)s.syscalls);
+        fprintf(out, "blockers      : %llu\n", (unsigned long long)s.blockers);
+        fprintf(out, "buffer hits   : %llu\n", (unsigned long long)s.bufferHits);
+        fprintf(out, "buffer misses : %llu\n", (unsigned long long)s.bufferMisses);
+        fprintf(out, "crc bytes     : %llu\n", (unsigned long long)s.crcBytes);
+        fprintf(out, "walk time     : %.3f ms\n", s.walk / 1e6);
+        fprintf(out, "read time     : %.3f ms\n", s.read / 1e6);
+        fprintf(out, "crc time      : %.3f ms\n", s.crc / 1e6);
+        fprintf(out, "write time    : %.3f ms\n", s.write / 1e6);
+        fprintf(out, "header time   : %.3f ms\n", s.header / 1e6);
+        fprintf(out, "tree time     : %.3f ms\n", s.tree / 1e6);
+        fprintf(out, "mkdir time    : %.3f ms\n", s.mkdir / 1e6);
+        fprintf(out, "******************************************\n");
+    }
+}
+
+#endif
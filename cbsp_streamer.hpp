@@ -0,0 +1,780 @@
+#ifndef _CBSP_STREAMER_H_
+#define _CBSP_STREAMER_H_
+
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "cbsp_structor.hpp"
+#include "cbsp_error.hpp"
+#include "cbsp_buffer.hpp"
+#include "cbsp_file.hpp"
+#include "cbsp_utils.hpp"
+#include "cbsp_tree.hpp"
+#include "cbsp_crc.hpp"
+#include "cbsp_mixer.hpp"
+#include "cbsp_spliter.hpp"
+#include "cbsp_index.hpp"
+
+namespace cbsp
+{
+    /*
+     * forward-only source of a cbsp file
+     * a cbsp file written by combiner is in stream order:
+     * header | content | blocker | name | dir | content | blocker | ...
+     * a sparse file has its extent table after dir, a hard link has no content
+     */
+    class StreamSource
+    {
+    public:
+        virtual ~StreamSource() = default;
+        // read at most size bytes, return 0 at the end of stream
+        virtual size_t read(char *data, size_t size) = 0;
+    };
+
+    class IStreamSource : public StreamSource
+    {
+    public:
+        IStreamSource(std::istream &in) : m_in(in) {}
+
+        size_t read(char *data, size_t size) override
+        {
+            m_in.read(data, size);
+            return m_in.gcount();
+        }
+
+    private:
+        std::istream &m_in;
+    };
+
+    class FdStreamSource : public StreamSource
+    {
+    public:
+        FdStreamSource(int fd) : m_fd(fd) {}
+
+        size_t read(char *data, size_t size) override
+        {
+            ssize_t n = 0;
+            do
+            {
+                n = ::read(m_fd, data, size);
+                CBSP_STATS_ADD(SYSCALLS, 1);
+            } while (n < 0 && errno == EINTR);
+            CBSP_STATS_ADD(BYTES_READ, (n > 0) ? n : 0);
+            return (n > 0) ? n : 0;
+        }
+
+    private:
+        int m_fd;
+    };
+
+    namespace streamer
+    {
+        // bytes needed to recognize a blocker: magic, size, ..., offset, length
+        const size_t probe_size = offsetof(CBSP_BLOCKER, length) + sizeof(uint64_t);
+        // a larger size is not the one of a blocker
+        const size_t blocker_limit = 4096;
+
+        // the window holds a Buffer, it has the linkage of the Buffer
+        namespace
+        {
+            /*
+             * a bounded window over a forward-only source
+             * m_pos is the cbsp file offset of the first byte in the window
+             */
+            class StreamWindow
+            {
+            public:
+                StreamWindow(StreamSource &source, const uint64_t &size) : m_source(source),
+                                                                           m_data(size),
+                                                                           m_head(0),
+                                                                           m_tail(0),
+                                                                           m_pos(0),
+                                                                           m_eof(false)
+                {
+                }
+
+                char *data() const noexcept { return m_data.get() + m_head; }
+                size_t size() const noexcept { return m_tail - m_head; }
+                uint64_t pos() const noexcept { return m_pos; }
+                bool eof() const noexcept { return m_eof && size() == 0; }
+
+                // fill the window, return false if nothing more to read
+                bool fill() noexcept
+                {
+                    if (m_head > 0)
+                    {
+                        memmove(m_data.get(), data(), size());
+                        m_tail -= m_head;
+                        m_head = 0;
+                    }
+                    size_t before = m_tail;
+                    while (!m_eof && m_tail < m_data.size())
+                    {
+                        size_t n = m_source.read(m_data.get() + m_tail, m_data.size() - m_tail);
+                        if (n == 0)
+                        {
+                            m_eof = true;
+                            break;
+                        }
+                        m_tail += n;
+                    }
+                    return m_tail > before;
+                }
+
+                // make sure at least size bytes are in the window
+                bool need(const size_t &size) noexcept
+                {
+                    while (this->size() < size)
+                    {
+                        if (!fill())
+                            return false;
+                    }
+                    return true;
+                }
+
+                void consume(const size_t &size) noexcept
+                {
+                    cbsp_assert(size <= this->size());
+                    m_head += size;
+                    m_pos += size;
+                }
+
+                bool read(void *out, const size_t &size) noexcept
+                {
+                    if (!need(size))
+                        return false;
+                    memcpy(out, data(), size);
+                    consume(size);
+                    return true;
+                }
+
+                bool skip(uint64_t size) noexcept
+                {
+                    while (size > 0)
+                    {
+                        if (this->size() == 0 && !fill())
+                            return false;
+                        size_t n = std::min<uint64_t>(size, this->size());
+                        consume(n);
+                        size -= n;
+                    }
+                    return true;
+                }
+
+            private:
+                StreamSource &m_source;
+                Buffer m_data;
+                size_t m_head;
+                size_t m_tail;
+                uint64_t m_pos;
+                bool m_eof;
+            };
+        }
+
+        // the blocker at pos of a member which content starts at start
+        // an updated member may leave unused room before its blocker
+        // a hard link is right at start, its content is before
+        inline bool isBlocker(const char *data, const uint64_t &start, const uint64_t &pos)
+        {
+            CBSP_BLOCKER blocker;
+            memcpy(reinterpret_cast<char *>(&blocker), data, probe_size);
+            if (!isCBSP(blocker) || blocker.size < probe_size)
+            {
+                return false;
+            }
+            if (isLink(blocker))
+            {
+                return pos == start && blocker.offset + blocker.length <= start;
+            }
+            return blocker.offset == start && blocker.offset + blocker.length <= pos;
+        }
+
+        /*
+         * a candidate isBlocker took, checked against the name and dir after it
+         * a content may be a cbsp file itself, its blockers look right at a glance
+         * 1 if it is the blocker, 0 if it is not, -1 if its name and dir are not all in data yet
+         */
+        inline int checkBlocker(const char *data, const size_t &size, const uint64_t &pos)
+        {
+            uint32_t bsize = 0;
+            memcpy(&bsize, data + sizeof(uint32_t), sizeof(uint32_t));
+            if (bsize > blocker_limit)
+            {
+                return 0;
+            }
+            if (size < bsize)
+            {
+                return -1;
+            }
+            CBSP_BLOCKER blocker;
+            memset(reinterpret_cast<char *>(&blocker), 0, sizeof(CBSP_BLOCKER));
+            memcpy(reinterpret_cast<char *>(&blocker), data, std::min<size_t>(bsize, sizeof(CBSP_BLOCKER)));
+            // name and dir follow the blocker, the next blocker comes after them
+            if (blocker.fnameOffset != pos + bsize || blocker.fnameLength > PATH_MAX ||
+                blocker.fdirOffset != blocker.fnameOffset + blocker.fnameLength || blocker.fdirLength > PATH_MAX ||
+                (blocker.next != 0 && blocker.next < blocker.fdirOffset + blocker.fdirLength))
+            {
+                return 0;
+            }
+            if (size < bsize + blocker.fnameLength + blocker.fdirLength)
+            {
+                return -1;
+            }
+            std::string path(data + bsize + blocker.fnameLength, blocker.fdirLength);
+            path += "/";
+            path.append(data + bsize, blocker.fnameLength);
+            return (crc32(path.c_str(), path.size()) == blocker.pathDigest) ? 1 : 0;
+        }
+
+        // search a blocker in the window
+        // the bytes before the blocker are the member content
+        inline size_t findBlocker(const StreamWindow &window, const uint64_t &start, bool &found)
+        {
+            const char *data = window.data();
+            size_t size = window.size();
+            found = false;
+            if (size < probe_size)
+            {
+                return 0;
+            }
+
+            const char first = static_cast<char>(CBSP_MAGIC & 0xFF);
+            size_t last = size - probe_size;
+            for (size_t i = 0; i <= last; i++)
+            {
+                auto hit = static_cast<const char *>(memchr(data + i, first, last - i + 1));
+                if (!hit)
+                    break;
+                i = hit - data;
+                if (!isBlocker(hit, start, window.pos() + i))
+                {
+                    continue;
+                }
+                int checked = checkBlocker(hit, size - i, window.pos() + i);
+                if (checked < 0)
+                {
+                    // the window is filled up to the candidate first
+                    return i;
+                }
+                if (checked > 0)
+                {
+                    found = true;
+                    return i;
+                }
+            }
+            // the tail may be the beginning of a blocker
+            return last + 1;
+        }
+
+        // unmix and write, phase is the offset of data in the member content
+        inline int flush(std::FILE *file, char *data, const size_t &size, uint32_t &crc, const int &mix, const uint64_t &phase)
+        {
+            if (size == 0)
+                return CBSP_ERR_SUCCESS;
+            crc = mixCrc32(data, size, mix, phase, crc);
+            if (write(data, sizeof(char), size, file) != static_cast<int>(size))
+            {
+                return CBSP_ERR_NO_TARGET;
+            }
+            return CBSP_ERR_SUCCESS;
+        }
+
+        /*
+         * truncate the spooled member to length, and fix the mixing
+         * if its blocker uses another mixer than the header
+         */
+        inline int respool(std::FILE *file, const uint64_t &length, const int &from, const int &to, uint32_t &crc)
+        {
+            std::fflush(file);
+            int fd = fileno(file);
+            if (ftruncate(fd, length) != 0)
+            {
+                return CBSP_ERR_NO_TARGET;
+            }
+
+            crc = 0x0;
+            uint64_t chunk = chunkSize(fd, length);
+            Buffer buffer(chunk);
+            for (uint64_t phase = 0; phase < length;)
+            {
+                size_t n = std::min<uint64_t>(chunk, length - phase);
+                if (pread(fd, buffer.get(), n, phase) != static_cast<ssize_t>(n))
+                {
+                    return CBSP_ERR_NO_TARGET;
+                }
+                if (from != to)
+                {
+                    mixer(buffer.get(), n, from, phase);
+                    crc = mixCrc32(buffer.get(), n, to, phase, crc);
+                    if (pwrite(fd, buffer.get(), n, phase) != static_cast<ssize_t>(n))
+                    {
+                        return CBSP_ERR_NO_TARGET;
+                    }
+                }
+                else
+                {
+                    crc = crc32(buffer.get(), n, crc);
+                }
+                phase += n;
+            }
+            return CBSP_ERR_SUCCESS;
+        }
+
+        // zero a range of file, without allocating it if the file system can punch holes
+        inline bool punch(int fd, uint64_t offset, uint64_t length)
+        {
+            if (length == 0)
+                return true;
+#ifdef FALLOC_FL_PUNCH_HOLE
+            if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0)
+                return true;
+#endif
+            Buffer zeros(chunkSize(fd, length));
+            while (length > 0)
+            {
+                size_t n = std::min<uint64_t>(length, zeros.size());
+                if (pwrite(fd, zeros.get(), n, offset) != static_cast<ssize_t>(n))
+                    return false;
+                offset += n;
+                length -= n;
+            }
+            return true;
+        }
+
+        /*
+         * turn the spooled content of a sparse file into the file
+         * extents move to their offsets from the last one, an extent never moves backward,
+         * then what is left between them is punched out
+         */
+        inline int expand(std::FILE *file, const std::vector<CBSP_EXTENT> &extents, const uint64_t &size)
+        {
+            std::fflush(file);
+            int fd = fileno(file);
+            uint64_t stored = 0;
+            for (auto &extent : extents)
+            {
+                stored += extent.length;
+            }
+
+            Buffer buffer(chunkSize(fd, stored));
+            for (size_t i = extents.size(); i-- > 0;)
+            {
+                stored -= extents[i].length;
+                // the tail first, the source and the target may overlap
+                for (uint64_t left = extents[i].length; extents[i].offset != stored && left > 0;)
+                {
+                    size_t n = std::min<uint64_t>(left, buffer.size());
+                    left -= n;
+                    if (pread(fd, buffer.get(), n, stored + left) != static_cast<ssize_t>(n) ||
+                        pwrite(fd, buffer.get(), n, extents[i].offset + left) != static_cast<ssize_t>(n))
+                    {
+                        return CBSP_ERR_NO_TARGET;
+                    }
+                }
+            }
+
+            if (ftruncate(fd, size) != 0)
+            {
+                return CBSP_ERR_NO_TARGET;
+            }
+            uint64_t end = 0;
+            for (auto &extent : extents)
+            {
+                if (!punch(fd, end, extent.offset - end))
+                {
+                    return CBSP_ERR_NO_TARGET;
+                }
+                end = extent.offset + extent.length;
+            }
+            return CBSP_ERR_SUCCESS;
+        }
+
+        /*
+         * spool the next member to file, at is where its blocker is
+         * stop right after the blocker, its name and its dir
+         * the spool of a hard link is left empty
+         */
+        inline int nextMember(StreamWindow &window, std::FILE *file, CBSP_BLOCKER &blocker, uint64_t &at, std::string &path, const CBSP_HEADER &header)
+        {
+            CBSP_TRACE_SPAN("member");
+            uint64_t start = window.pos();
+            const int mix = header.mixer;
+            uint32_t crc = 0x0;
+            int result = CBSP_ERR_SUCCESS;
+            bool found = false;
+            while (true)
+            {
+                size_t n = findBlocker(window, start, found);
+                result = flush(file, window.data(), n, crc, mix, window.pos() - start);
+                if (result != CBSP_ERR_SUCCESS)
+                {
+                    return result;
+                }
+                window.consume(n);
+                if (found)
+                {
+                    break;
+                }
+                if (!window.fill())
+                {
+                    ErrorMessage::setMessage("Stream ends before blocker of member at %lu", start);
+                    return CBSP_ERR_BAD_CBSP;
+                }
+            }
+
+            // the blocker may be shorter (older) or longer (newer) than ours
+            at = window.pos();
+            uint32_t bsize = 0;
+            memset(reinterpret_cast<char *>(&blocker), 0, sizeof(CBSP_BLOCKER));
+            memcpy(&bsize, window.data() + sizeof(uint32_t), sizeof(uint32_t));
+            if (!window.read(&blocker, std::min<size_t>(bsize, sizeof(CBSP_BLOCKER))) ||
+                !window.skip(bsize - std::min<size_t>(bsize, sizeof(CBSP_BLOCKER))))
+            {
+                return CBSP_ERR_BAD_CBSP;
+            }
+
+            if (blocker.append > 0)
+            {
+                ErrorMessage::setMessage("Blocker at %lu has appended content, not in stream order", at);
+                return CBSP_ERR_BAD_CBSP;
+            }
+
+            // a hard link has no content to check, its origin was checked
+            bool link = isLink(blocker);
+
+            // drop the unused room, it is not covered by crc
+            if (!link && (start + blocker.length < at || static_cast<int>(blocker.mixer) != mix))
+            {
+                result = respool(file, blocker.length, mix, blocker.mixer, crc);
+                if (result != CBSP_ERR_SUCCESS)
+                {
+                    return result;
+                }
+            }
+
+            // a legacy crc covers a part of the last chunk only, it is checked in the spool
+            bool matched = isLegacy(header, blocker) ? std::fflush(file) == 0 && legacyMatch(fileno(file), 0, 0, blocker)
+                                                     : crc == blocker.crc;
+            if (!link && !matched)
+            {
+                ErrorMessage::setMessage("Blocker at %lu broken", start);
+                ErrorMessage::setMessage("Mismatch crc 0x%x 0x%x", crc, blocker.crc);
+                return CBSP_ERR_AL_MODIFY | CBSP_ERR_BAD_CBSP;
+            }
+
+            // name and dir follow the blocker, never go backward
+            auto readString = [&window](const uint64_t &offset, const uint64_t &length, std::string &out)
+            {
+                if (offset < window.pos() || !window.skip(offset - window.pos()))
+                {
+                    return false;
+                }
+                out.resize(length);
+                return window.read(&out[0], length);
+            };
+            std::string filename, filedir;
+            if (!readString(blocker.fnameOffset, blocker.fnameLength, filename) ||
+                !readString(blocker.fdirOffset, blocker.fdirLength, filedir))
+            {
+                ErrorMessage::setMessage("Blocker at %lu is not in stream order", start);
+                return CBSP_ERR_BAD_CBSP;
+            }
+            path = filedir + "/" + filename;
+
+            // the extent table follows dir, an updated file keeps the table of its sparse past
+            std::vector<CBSP_EXTENT> extents;
+            if (!link && (blocker.extentCount > 0 || isSparse(blocker)))
+            {
+                if (blocker.extentOffset < window.pos() || !window.skip(blocker.extentOffset - window.pos()))
+                {
+                    ErrorMessage::setMessage("Blocker at %lu is not in stream order", start);
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                uint64_t bytes = blocker.extentCount * sizeof(CBSP_EXTENT);
+                if (!isSparse(blocker))
+                {
+                    if (!window.skip(bytes))
+                    {
+                        return CBSP_ERR_BAD_CBSP;
+                    }
+                    bytes = 0;
+                }
+                // every extent holds a byte at least
+                else if (blocker.extentCount > blocker.fileSize)
+                {
+                    return CBSP_ERR_BAD_CBSP;
+                }
+
+                extents.resize(bytes / sizeof(CBSP_EXTENT));
+                auto table = reinterpret_cast<char *>(extents.data());
+                for (uint64_t done = 0; done < bytes;)
+                {
+                    if (window.size() == 0 && !window.fill())
+                    {
+                        return CBSP_ERR_BAD_CBSP;
+                    }
+                    size_t n = std::min<uint64_t>(bytes - done, window.size());
+                    window.read(table + done, n);
+                    done += n;
+                }
+                if (isSparse(blocker) && !checkExtents(blocker, extents))
+                {
+                    ErrorMessage::setMessage("Extents of %s broken", path.c_str());
+                    return CBSP_ERR_BAD_CBSP;
+                }
+            }
+
+            // the block table follows the extents, the whole content crc was checked already
+            if (!link && blocker.blockCount > 0)
+            {
+                if (blocker.blockOffset < window.pos() || !window.skip(blocker.blockOffset - window.pos()) ||
+                    !window.skip(blocker.blockCount * sizeof(uint32_t)))
+                {
+                    ErrorMessage::setMessage("Blocker at %lu is not in stream order", start);
+                    return CBSP_ERR_BAD_CBSP;
+                }
+            }
+
+            return (!link && isSparse(blocker)) ? expand(file, extents, blocker.fileSize) : CBSP_ERR_SUCCESS;
+        }
+
+        /*
+         * fill the spool of a hard link from the spool of its origin
+         * with links it is another name of the origin spool, they are moved as links
+         */
+        inline int spoolLink(const std::string &origin, const std::string &tmp, const bool &links)
+        {
+            CBSP_TRACE_SPAN("link", tmp);
+            if (links)
+            {
+                // tmp exists, link to a free name and move it over tmp
+                std::string name = tmp + ".link";
+                if (link(origin.c_str(), name.c_str()) == 0)
+                {
+                    if (rename(name.c_str(), tmp.c_str()) == 0)
+                    {
+                        return CBSP_ERR_SUCCESS;
+                    }
+                    unlink(name.c_str());
+                }
+            }
+
+            int in = open(origin.c_str(), O_RDONLY | O_CLOEXEC);
+            int out = open(tmp.c_str(), O_WRONLY | O_CLOEXEC);
+            struct stat sts;
+            bool ok = in >= 0 && out >= 0 && fstat(in, &sts) == 0 &&
+                      copyRange(in, 0, out, 0, sts.st_size);
+            if (in >= 0)
+                close(in);
+            if (out >= 0)
+                close(out);
+            return ok ? CBSP_ERR_SUCCESS : CBSP_ERR_NO_TARGET;
+        }
+
+        /*
+         * extract a cbsp file from a forward-only source
+         * every member is written to a spool file in outdir as it arrives,
+         * and moved to its place after the tree is known
+         * with links, the hard links of a file are linked to it again
+         */
+        inline int extract(StreamSource &source, const char *outdir = nullptr, const bool &links = false)
+        {
+            bool hasout = outdir && !std::string(outdir).empty();
+            std::string spool = hasout ? std::string(outdir) : std::string(".");
+            if (!makeDirs(spool.c_str()))
+            {
+                ErrorMessage::setMessage("Create %s failed", spool.c_str());
+                return CBSP_ERR_NO_TARGET;
+            }
+
+            StreamWindow window(source, chunkLimit() + sizeof(CBSP_BLOCKER));
+            CBSP_HEADER header;
+            uint32_t hsize = 0;
+            if (!window.need(2 * sizeof(uint32_t)))
+            {
+                return CBSP_ERR_NO_CBSP;
+            }
+            memcpy(&hsize, window.data() + sizeof(uint32_t), sizeof(uint32_t));
+            if (!window.read(&header, std::min<size_t>(hsize, sizeof(CBSP_HEADER))) ||
+                !window.skip(hsize - std::min<size_t>(hsize, sizeof(CBSP_HEADER))) ||
+                !isCBSP(header))
+            {
+                return CBSP_ERR_NO_CBSP;
+            }
+            if (header.count <= 0)
+            {
+                return CBSP_ERR_NO_CBSP;
+            }
+            if (!keyMatch(header))
+            {
+                return CBSP_ERR_BAD_KEY;
+            }
+
+            // spool files and their archived paths
+            std::vector<std::pair<std::string, std::string>> members;
+            // spool files by the offset of their blockers, the origins of hard links
+            std::map<uint64_t, std::string> spools;
+            // spool files of deleted members, a hard link may still need them
+            std::vector<std::string> deleted;
+            // mkstemp makes 0600 files, the members get the mode a new file would have
+            mode_t mask = umask(0);
+            umask(mask);
+            mode_t mode = 0666 & ~mask;
+            auto cleanup = [&members, &deleted]()
+            {
+                for (auto &m : members)
+                {
+                    unlink(m.first.c_str());
+                }
+                for (auto &tmp : deleted)
+                {
+                    unlink(tmp.c_str());
+                }
+            };
+
+            int result = CBSP_ERR_SUCCESS;
+            while (result == CBSP_ERR_SUCCESS)
+            {
+                if (window.size() == 0 && !window.fill())
+                {
+                    break;
+                }
+                // the index of the chain is the last thing in a cbsp file
+                if (window.need(sizeof(CBSP_INDEX)))
+                {
+                    CBSP_INDEX index;
+                    memcpy(reinterpret_cast<char *>(&index), window.data(), sizeof(CBSP_INDEX));
+                    if (isIndex(index, header))
+                    {
+                        break;
+                    }
+                }
+
+                std::string tmp = spool + "/.cbsp-stream-XXXXXX";
+                int fd = mkstemp(&tmp[0]);
+                std::FILE *file = (fd >= 0 && fchmod(fd, mode) == 0) ? fdopen(fd, "wb+") : nullptr;
+                if (!file)
+                {
+                    if (fd >= 0)
+                    {
+                        close(fd);
+                        unlink(tmp.c_str());
+                    }
+                    result = CBSP_ERR_NO_TARGET;
+                    break;
+                }
+
+                CBSP_BLOCKER blocker;
+                uint64_t at = 0;
+                std::string path;
+                result = nextMember(window, file, blocker, at, path, header);
+                std::fclose(file);
+                if (result == CBSP_ERR_SUCCESS && isLink(blocker))
+                {
+                    auto origin = spools.find(blocker.link);
+                    if (origin == spools.end())
+                    {
+                        ErrorMessage::setMessage("Origin of %s is not in stream", path.c_str());
+                        result = CBSP_ERR_BAD_CBSP;
+                    }
+                    else
+                    {
+                        result = spoolLink(origin->second, tmp, links);
+                    }
+                }
+                spools[at] = tmp;
+                // deleted files are still in stream
+                if (result == CBSP_ERR_SUCCESS && isDeleted(blocker))
+                {
+                    deleted.push_back(tmp);
+                    continue;
+                }
+                members.push_back({tmp, path});
+            }
+
+            if (result == CBSP_ERR_SUCCESS && members.size() != header.count)
+            {
+                ErrorMessage::setMessage("Expect %u members, got %lu", header.count, members.size());
+                result = CBSP_ERR_BAD_CBSP;
+            }
+            if (result != CBSP_ERR_SUCCESS)
+            {
+                cleanup();
+                return result;
+            }
+            for (auto &tmp : deleted)
+            {
+                unlink(tmp.c_str());
+            }
+            deleted.clear();
+
+            CBSP_TREE tr;
+            for (auto &m : members)
+            {
+                insertTree(tr, m.second);
+            }
+            cropTree(tr);
+            DirCache dirs;
+            result = spliter::makeTree(tr, outdir, dirs);
+            if (result != CBSP_ERR_SUCCESS)
+            {
+                cleanup();
+                return result;
+            }
+
+            for (size_t i = 0; i < members.size(); i++)
+            {
+                auto &m = members[i];
+                auto rpath = memberPath(tr, i);
+                if (hasout)
+                {
+                    rpath = std::string(outdir) + "/" + rpath;
+                }
+                cbsp_assert(!rpath.empty());
+
+                std::string name;
+                int dirfd = dirs.parent(rpath, name);
+                if (dirfd != -1 && faccessat(dirfd, name.c_str(), F_OK, 0) == 0)
+                {
+                    ErrorMessage::setMessage("%s already exists", rpath.c_str());
+                    unlink(m.first.c_str());
+                    result |= CBSP_ERR_AL_EXIST;
+                }
+                else if (dirfd == -1 || renameat(AT_FDCWD, m.first.c_str(), dirfd, name.c_str()) != 0)
+                {
+                    ErrorMessage::setMessage("Move %s failed", rpath.c_str());
+                    unlink(m.first.c_str());
+                    result |= CBSP_ERR_NO_TARGET;
+                }
+            }
+
+            return result;
+        }
+
+        inline int extract(std::istream &in, const char *outdir = nullptr, const bool &links = false)
+        {
+            IStreamSource source(in);
+            return extract(source, outdir, links);
+        }
+
+        inline int extract(int fd, const char *outdir = nullptr, const bool &links = false)
+        {
+            FdStreamSource source(fd);
+            return extract(source, outdir, links);
+        }
+    }
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <list>
 #include <string>
+#include <vector>
+#include <utility>
 
 #include <cstdint>
 #include <cstdio>
@@ -43,7 +45,7 @@ namespace cbsp
                 uint8_t day;
                 uint8_t mini;
             };
-            _version() : year(22), month(2), day(10), mini(0) {}
+            _version() : year(26), month(10), day(18), mini(0) {}
         } version;
 
         // combined content offset
@@ -58,8 +60,30 @@ namespace cbsp
         uint64_t first = 0;
         // last subfile
         uint64_t last = 0;
+
+        // total size of the blockers in the chain
+        // lets crc be updated without walking the whole chain
+        uint64_t blockers = 0;
+
+        // a striped archive is a set of volumes, each one a cbsp file
+        // this is volume of volumes, 0 of 0 if not striped
+        uint32_t volume = 0;
+        uint32_t volumes = 0;
+
+        // counts the writes of the header, an archive that keeps it is unchanged
+        uint64_t generation = 0;
+
+        // a check value of the xor key, 0 if there is none
+        uint32_t keyCheck = 0;
     } CBSP_HEADER;
 
+    // year|month|day|mini as one number, a later version is a larger one
+    inline uint32_t versionOf(const _CBSP_HEADER &header)
+    {
+        return static_cast<uint32_t>(header.version.year) << 24 | static_cast<uint32_t>(header.version.month) << 16 |
+               static_cast<uint32_t>(header.version.day) << 8 | header.version.mini;
+    }
+
     inline void print(const _CBSP_HEADER &header)
     {
         printf("*****************HEADER*******************\n");
@@ -74,9 +98,27 @@ namespace cbsp
         printf("count  : %u\n", header.count);
         printf("first  : %lu\n", header.first);
         printf("last   : %lu\n", header.last);
+        printf("blockers: %lu\n", header.blockers);
+        printf("volume : %u of %u\n", header.volume, header.volumes);
+        printf("generation: %lu\n", header.generation);
+        printf("key check: 0x%x\n", header.keyCheck);
         printf("******************************************\n");
     }
 
+    // blocker type flags
+    // the blocker is deleted and unlinked from the chain
+    const uint32_t CBSP_TYPE_DELETED = 0x1;
+    // the content is the data extents of a sparse file, the holes are not stored
+    const uint32_t CBSP_TYPE_SPARSE = 0x2;
+    // another path of an archived file, the content is the one of the blocker at link
+    const uint32_t CBSP_TYPE_LINK = 0x4;
+    // the content has a crc for each block, the table follows the extents
+    const uint32_t CBSP_TYPE_BLOCKS = 0x8;
+    // the crc is the one of the first releases, copied from an archive of that time
+    const uint32_t CBSP_TYPE_LEGACY = 0x10;
+    // a file with more links, link blockers may share the content, it is never overwritten in place
+    const uint32_t CBSP_TYPE_SHARED = 0x20;
+
     /*
      * this structure is the header of every sub-file in cbsp file
      */
@@ -105,6 +147,27 @@ namespace cbsp
         // appendency content
         // if update file, the content length may longer than the formar
         uint64_t append = 0;
+
+        // extents of a sparse file, the table follows the file dir
+        uint64_t extentOffset = 0;
+        uint64_t extentCount = 0;
+        // crc of the table
+        uint32_t extentCrc = 0;
+        // the size of a sparse file with its holes
+        uint64_t fileSize = 0;
+
+        // the blocker which content a hard link shares
+        uint64_t link = 0;
+
+        // the volume of a striped archive holding the file
+        uint32_t volume = 0;
+
+        // crc of every blockSize bytes of the content, the last block may be shorter
+        uint64_t blockSize = 0;
+        uint64_t blockOffset = 0;
+        uint64_t blockCount = 0;
+        // crc of the table
+        uint32_t blockCrc = 0;
     } CBSP_BLOCKER;
 
     inline void print(const _CBSP_BLOCKER &blocker)
@@ -123,9 +186,22 @@ namespace cbsp
         printf("fdirLength : %lu\n", blocker.fdirLength);
         printf("next       : %lu\n", blocker.next);
         printf("append     : %lu\n", blocker.append);
+        printf("extents    : %lu at %lu\n", blocker.extentCount, blocker.extentOffset);
+        printf("fileSize   : %lu\n", blocker.fileSize);
+        printf("link       : %lu\n", blocker.link);
+        printf("volume     : %u\n", blocker.volume);
+        printf("blocks     : %lu of %lu at %lu\n", blocker.blockCount, blocker.blockSize, blocker.blockOffset);
         printf("******************************************\n");
     }
 
+    // data of a sparse file, the content stores the extents back to back
+    typedef struct _CBSP_EXTENT
+    {
+        // offset in the restored file
+        uint64_t offset = 0;
+        uint64_t length = 0;
+    } CBSP_EXTENT;
+
     typedef struct _CBSP_BLOCKER_APPEND
     {
         __F_CBSP__
@@ -148,13 +224,79 @@ namespace cbsp
         printf("******************************************\n");
     }
 
-    struct _CBSP_TREE
+    /*
+     * a column-wise copy of the blocker chain, the last thing in a cbsp file
+     * region: CBSP_INDEX | digests | blockers | offsets | lengths | sizes | CBSP_INDEX_TAIL
+     * a column holds one value per member in chain order, the columns are 8 aligned
+     * and placed from the region start, so the region can be mapped as it is
+     */
+    typedef struct _CBSP_INDEX
+    {
+        __F_CBSP__
+        // the header crc and count it was built for, it is stale once they change
+        uint32_t headerCrc = 0;
+        uint32_t count = 0;
+        // crc of the columns
+        uint32_t crc = 0;
+        uint32_t reserved = 0;
+        // column offsets from the region start
+        // uint32_t path digests
+        uint64_t digests = 0;
+        // uint64_t blocker offsets, the names and everything else are read from there
+        uint64_t blockers = 0;
+        // uint64_t content offsets
+        uint64_t offsets = 0;
+        // uint64_t stored lengths, appends included
+        uint64_t lengths = 0;
+        // uint64_t file sizes, the holes of a sparse file included
+        uint64_t sizes = 0;
+        // the whole region, the tail included
+        uint64_t length = 0;
+    } CBSP_INDEX;
+
+    // the end of the file, where the index region starts
+    typedef struct _CBSP_INDEX_TAIL
+    {
+        __F_CBSP__
+        uint64_t offset = 0;
+    } CBSP_INDEX_TAIL;
+
+    // node 0 is the root, 0 is also "no node" for child, next and last
+    struct _CBSP_TREE_NODE
     {
+        uint32_t name = 0;   // interned name
+        uint32_t parent = 0; // parent node
+        uint32_t child = 0;  // first child
+        uint32_t last = 0;   // last child
+        uint32_t next = 0;   // next sibling
+        uint32_t depth = 0;  // components from the root
         bool isFile = false;
-        std::string path = "";
-        std::list<_CBSP_TREE> children;
     };
-    using CBSP_TREE = std::list<_CBSP_TREE>;
+
+    /*
+     * a flat trie of archived paths
+     * nodes live in one vector, names are stored once in one pool,
+     * children are found by hashing (parent, name) with open addressing
+     */
+    struct _CBSP_TREE
+    {
+        _CBSP_TREE() : nodes(1) {}
+
+        bool empty() const noexcept { return nodes.size() <= 1; }
+
+        std::vector<_CBSP_TREE_NODE> nodes;
+        // names back to back, and (offset, length) of each name
+        std::string pool;
+        std::vector<std::pair<uint32_t, uint32_t>> names;
+        // hash slots of names and of children, 0 is empty
+        std::vector<uint32_t> nameSlots;
+        std::vector<uint32_t> childSlots;
+        // the leaf node of each member, in insertion order
+        std::vector<uint32_t> leaves;
+        // the node which children are the cropped tree
+        uint32_t crop = 0;
+    };
+    using CBSP_TREE = _CBSP_TREE;
 }
 
 #endif
\ No newline at end of file
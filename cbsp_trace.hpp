@@ -0,0 +1,246 @@
+#ifndef _CBSP_TRACE_H_
+#define _CBSP_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include "cbsp_error.hpp"
+
+/*
+ * spans of archive operations, saved as chrome trace events
+ * open the saved file in chrome://tracing or ui.perfetto.dev
+ *
+ * a thread records into its own ring without locks, the oldest spans are overwritten
+ * a ring is registered under a lock the first time its thread records
+ * save after the traced work is done, a ring is not read while it is written
+ *
+ * build with CBSP_NO_TRACE to compile the spans out
+ */
+#ifndef CBSP_NO_TRACE
+#define CBSP_TRACE_SPAN_(line, ...) cbsp::trace::Span cbsp_trace_span_##line(__VA_ARGS__)
+#define CBSP_TRACE_SPAN__(line, ...) CBSP_TRACE_SPAN_(line, __VA_ARGS__)
+#define CBSP_TRACE_SPAN(...) CBSP_TRACE_SPAN__(__LINE__, __VA_ARGS__)
+#else
+#define CBSP_TRACE_SPAN(...) void(0)
+#endif
+
+namespace cbsp
+{
+    namespace trace
+    {
+        const size_t ring_size = 64 * 1024;
+        // the tail of a path is kept, it names the file
+        const size_t detail_size = 56;
+
+        typedef struct _CBSP_TRACE_EVENT
+        {
+            // a string literal
+            const char *name;
+            // nanoseconds since start
+            uint64_t start;
+            uint64_t duration;
+            char detail[detail_size];
+        } Event;
+
+        // written by its thread only
+        class Ring
+        {
+        public:
+            explicit Ring(uint32_t tid) : m_tid(tid), m_events(new Event[ring_size]) {}
+
+            void push(const Event &event) noexcept
+            {
+                uint64_t head = m_head.load(std::memory_order_relaxed);
+                m_events[head % ring_size] = event;
+                m_head.store(head + 1, std::memory_order_release);
+            }
+
+            // the recorded events, oldest first
+            std::vector<Event> events() const
+            {
+                uint64_t head = m_head.load(std::memory_order_acquire);
+                uint64_t count = std::min<uint64_t>(head, ring_size);
+                std::vector<Event> out;
+                out.reserve(count);
+                for (uint64_t i = head - count; i < head; i++)
+                {
+                    out.push_back(m_events[i % ring_size]);
+                }
+                return out;
+            }
+
+            void clear() noexcept { m_head.store(0, std::memory_order_release); }
+            uint32_t tid() const noexcept { return m_tid; }
+
+        private:
+            uint32_t m_tid;
+            std::unique_ptr<Event[]> m_events;
+            std::atomic<uint64_t> m_head{0};
+        };
+
+        struct Registry
+        {
+            std::mutex mutex;
+            // rings outlive their threads, the reader of a stream exits before save
+            std::vector<std::shared_ptr<Ring>> rings;
+            std::atomic<bool> enabled{false};
+            std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+        };
+
+        inline Registry &registry()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        inline Ring &ring()
+        {
+            thread_local std::shared_ptr<Ring> ring = []
+            {
+                auto &r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                r.rings.push_back(std::make_shared<Ring>(r.rings.size() + 1));
+                return r.rings.back();
+            }();
+            return *ring;
+        }
+
+        inline bool enabled()
+        {
+            return registry().enabled.load(std::memory_order_relaxed);
+        }
+
+        inline uint64_t now()
+        {
+            auto elapsed = std::chrono::steady_clock::now() - registry().origin;
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        }
+
+        // drop what was recorded and record from now on
+        inline void start()
+        {
+            auto &r = registry();
+            {
+                std::lock_guard<std::mutex> lock(r.mutex);
+                for (auto &ring : r.rings)
+                {
+                    ring->clear();
+                }
+                r.origin = std::chrono::steady_clock::now();
+            }
+            r.enabled.store(true, std::memory_order_relaxed);
+        }
+
+        inline void stop()
+        {
+            registry().enabled.store(false, std::memory_order_relaxed);
+        }
+
+        // a span from its construction to the end of its scope
+        class Span
+        {
+        public:
+            Span(const char *name, const char *detail = nullptr) noexcept
+            {
+                if (!enabled())
+                {
+                    return;
+                }
+                m_event.name = name;
+                m_event.detail[0] = '\0';
+                if (detail)
+                {
+                    size_t length = strlen(detail);
+                    size_t skip = (length >= detail_size) ? length - detail_size + 1 : 0;
+                    memcpy(m_event.detail, detail + skip, length - skip + 1);
+                }
+                m_event.start = now();
+            }
+            Span(const char *name, const std::string &detail) noexcept : Span(name, detail.c_str()) {}
+            Span(const Span &) = delete;
+            Span &operator=(const Span &) = delete;
+            ~Span()
+            {
+                if (m_event.name)
+                {
+                    m_event.duration = now() - m_event.start;
+                    ring().push(m_event);
+                }
+            }
+
+        private:
+            Event m_event{nullptr, 0, 0, {0}};
+        };
+
+        inline void escape(std::FILE *out, const char *str)
+        {
+            for (; *str; str++)
+            {
+                unsigned char c = *str;
+                if (c == '"' || c == '\\')
+                    fprintf(out, "\\%c", c);
+                else if (c < 0x20)
+                    fprintf(out, "\\u%04x", c);
+                else
+                    fputc(c, out);
+            }
+        }
+
+        // stop recording and save trace_event json to path
+        inline int save(const char *path)
+        {
+            stop();
+            if (!path)
+            {
+                return CBSP_ERR_BAD_PATH;
+            }
+            std::FILE *out = std::fopen(path, "w");
+            if (!out)
+            {
+                ErrorMessage::setMessage("Create %s failed", path);
+                return CBSP_ERR_CREATE_FAILED;
+            }
+
+            auto &r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            int pid = getpid();
+            bool first = true;
+            fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+            for (auto &ring : r.rings)
+            {
+                fprintf(out, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %u, \"args\": {\"name\": \"cbsp %u\"}}",
+                        first ? "" : ",", pid, ring->tid(), ring->tid());
+                first = false;
+                for (auto &event : ring->events())
+                {
+                    fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"cbsp\", \"ph\": \"X\", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+                            event.name, pid, ring->tid(), event.start / 1e3, event.duration / 1e3);
+                    if (event.detail[0])
+                    {
+                        fprintf(out, ", \"args\": {\"file\": \"");
+                        escape(out, event.detail);
+                        fprintf(out, "\"}");
+                    }
+                    fprintf(out, "}");
+                }
+            }
+            fprintf(out, "\n]}\n");
+
+            bool ok = std::fflush(out) == 0;
+            ok = (std::fclose(out) == 0) && ok;
+            return ok ? CBSP_ERR_SUCCESS : CBSP_ERR_CREATE_FAILED;
+        }
+    }
+}
+
+#endif
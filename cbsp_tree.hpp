@@ -6,18 +6,25 @@
 #include <string>
 #include <stack>
 #include <list>
+#include <vector>
 #include <map>
+#include <unordered_map>
+#include <algorithm>
 
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <cerrno>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/param.h>
 
 #include "cbsp_structor.hpp"
 #include "cbsp_buffer.hpp"
 #include "cbsp_utils.hpp"
+#include "cbsp_walker.hpp"
 
 namespace cbsp
 {
@@ -47,85 +54,59 @@ namespace cbsp
         return is_dir;
     }
 
-    inline std::list<std::string> getDirFiles(const char *path)
+    inline bool makeDirs(const char *path)
     {
         if (!path)
         {
-            return std::list<std::string>{};
+            return false;
         }
 
-        // it is a file, return the only file
-        if (isFile(path))
+        // create every missing component, like mkdir -p
+        std::string dpath = path;
+        for (std::string::size_type pos = dpath.find('/', 1);
+             pos != std::string::npos;
+             pos = dpath.find('/', pos + 1))
         {
-            return std::list<std::string>{path};
+            std::string part = dpath.substr(0, pos);
+            if (!isDir(part.c_str()) && mkdir(part.c_str(), 0755) != 0 && errno != EEXIST)
+            {
+                return false;
+            }
         }
-
-        // if not a file and not a directory
-        if (!isDir(path))
+        if (!isDir(dpath.c_str()) && mkdir(dpath.c_str(), 0755) != 0 && errno != EEXIST)
         {
-            return std::list<std::string>{};
+            return false;
         }
+        return isDir(dpath.c_str());
+    }
 
-        DIR *dir = opendir(path);
-        // open directory failed
-        if (!dir)
-        {
-            return std::list<std::string>{};
-        }
+    // all files under path, sorted, threads > 1 scans in parallel
+    inline std::vector<std::string> getDirFiles(const char *path, const size_t &threads = 0)
+    {
+        return walker::walk(path, threads);
+    }
 
-        std::string spath = [&path]
-        {
-            std::string tpath = path;
-            while (tpath.back() == '/')
-            {
-                tpath.pop_back();
-            }
-            return tpath + "/";
-        }();
-        struct dirent *ptr;
-        std::list<std::string> filenames;
-        while ((ptr = readdir(dir)) != 0)
+    // names are short, read them into the string itself, not a pooled buffer
+    inline std::string getString(std::FILE *&fp, const uint64_t &offset, const uint64_t &length)
+    {
+        std::string str(length, '\0');
+        if (length > 0)
         {
-            if (strcmp(ptr->d_name, ".") != 0 && strcmp(ptr->d_name, "..") != 0)
-            {
-                std::string cand = spath + ptr->d_name;
-                if (isDir(cand.c_str()))
-                {
-                    auto subfiles = getDirFiles(cand.c_str());
-                    if (!subfiles.empty())
-                    {
-                        filenames.sort();
-                        subfiles.sort();
-                        filenames.merge(subfiles);
-                    }
-                }
-                else if (isFile(cand.c_str()))
-                {
-                    filenames.push_back(cand);
-                }
-            }
+            read(fp, &str[0], offset, length);
         }
-        closedir(dir);
-
-        return filenames;
+        // a name ends at its first nul
+        str.resize(strlen(str.c_str()));
+        return str;
     }
 
     inline std::string getFileName(std::FILE *&fp, const CBSP_BLOCKER &blocker)
     {
-        Buffer filename(blocker.fnameLength + 1);
-        memset(filename.get(), 0, blocker.fnameLength + 1);
-        read(fp, filename.get(), blocker.fnameOffset, blocker.fnameLength);
-
-        return std::string(filename.get());
+        return getString(fp, blocker.fnameOffset, blocker.fnameLength);
     }
 
     inline std::string getFileDir(std::FILE *&fp, const CBSP_BLOCKER &blocker)
     {
-        Buffer filedir(blocker.fdirLength + 1);
-        memset(filedir.get(), 0, blocker.fdirLength + 1);
-        read(fp, filedir.get(), blocker.fdirOffset, blocker.fdirLength);
-
-        return std::string(filedir.get());
+        return getString(fp, blocker.fdirOffset, blocker.fdirLength);
     }
 
     inline std::string fileName(const char *filepath)
@@ -172,202 +153,455 @@ namespace cbsp
         return dlist;
     }
 
-    inline std::pair<int, std::string> matchTreeRe(const CBSP_TREE &tree, std::stack<std::string> tstack, std::stack<std::string> dstack)
+    inline uint64_t treeHash(const char *data, const size_t &length)
     {
-        std::pair<int, std::string> result{0, ""};
-        if (tree.empty())
+        // fnv-1a
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < length; i++)
         {
-            while (!tstack.empty() && !dstack.empty())
+            hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    inline uint64_t treeHash(const uint32_t &parent, const uint32_t &name)
+    {
+        uint64_t key = (static_cast<uint64_t>(parent) << 32) | name;
+        key *= 0x9E3779B97F4A7C15ull;
+        return key ^ (key >> 29);
+    }
+
+    // rebuild the slots at load 1/2
+    template <typename Hash>
+    inline void treeRehash(std::vector<uint32_t> &slots, const uint32_t &count, Hash &&hash)
+    {
+        if (2 * (count + 1) <= slots.size())
+        {
+            return;
+        }
+        std::vector<uint32_t> grown(std::max<size_t>(64, 2 * slots.size()), 0);
+        size_t mask = grown.size() - 1;
+        for (auto slot : slots)
+        {
+            if (!slot)
+                continue;
+            size_t i = hash(slot) & mask;
+            while (grown[i])
+                i = (i + 1) & mask;
+            grown[i] = slot;
+        }
+        slots.swap(grown);
+    }
+
+    inline bool nameEqual(const CBSP_TREE &tree, const uint32_t &id, const char *name, const size_t &length)
+    {
+        auto &n = tree.names[id];
+        return n.second == length && memcmp(tree.pool.data() + n.first, name, length) == 0;
+    }
+
+    // the id of a name, add it if not found and add is set, or UINT32_MAX
+    inline uint32_t internName(CBSP_TREE &tree, const char *name, const size_t &length, const bool &add)
+    {
+        if (add)
+        {
+            treeRehash(tree.nameSlots, tree.names.size(), [&tree](uint32_t slot)
+                       { auto &n = tree.names[slot - 1];
+                         return treeHash(tree.pool.data() + n.first, n.second); });
+        }
+        if (tree.nameSlots.empty())
+        {
+            return UINT32_MAX;
+        }
+        size_t mask = tree.nameSlots.size() - 1;
+        size_t i = treeHash(name, length) & mask;
+        for (; tree.nameSlots[i]; i = (i + 1) & mask)
+        {
+            if (nameEqual(tree, tree.nameSlots[i] - 1, name, length))
             {
-                if (tstack.top() == dstack.top())
-                {
-                    result.first++;
-                    result.second = dstack.top() + "/" + result.second;
-                    tstack.pop();
-                    dstack.pop();
-                }
-                else
-                {
-                    result.first = 0;
-                    result.second = "";
-                    break;
-                }
+                return tree.nameSlots[i] - 1;
             }
-            return result;
         }
+        if (!add)
+        {
+            return UINT32_MAX;
+        }
+        uint32_t id = static_cast<uint32_t>(tree.names.size());
+        tree.names.push_back({static_cast<uint32_t>(tree.pool.size()), static_cast<uint32_t>(length)});
+        tree.pool.append(name, length);
+        tree.nameSlots[i] = id + 1;
+        return id;
+    }
 
-        for (auto &tr : tree)
+    // the child of parent named name, 0 if not found
+    inline uint32_t findChild(const CBSP_TREE &tree, const uint32_t &parent, const uint32_t &name)
+    {
+        if (tree.childSlots.empty())
         {
-            tstack.push(tr.path);
-            auto _result = matchTreeRe(tr.children, tstack, dstack);
-            tstack.pop();
-            if (result.first < _result.first)
-                result = _result;
+            return 0;
         }
-        return result;
+        size_t mask = tree.childSlots.size() - 1;
+        for (size_t i = treeHash(parent, name) & mask; tree.childSlots[i]; i = (i + 1) & mask)
+        {
+            auto &n = tree.nodes[tree.childSlots[i]];
+            if (n.parent == parent && n.name == name)
+            {
+                return tree.childSlots[i];
+            }
+        }
+        return 0;
     }
 
-    inline std::string matchTree(const CBSP_TREE &tree, const char *dir)
+    inline uint32_t addChild(CBSP_TREE &tree, const uint32_t &parent, const char *name, const size_t &length, const bool &isFile)
+    {
+        uint32_t id = internName(tree, name, length, true);
+        uint32_t found = findChild(tree, parent, id);
+        if (found)
+        {
+            return found;
+        }
+
+        uint32_t index = static_cast<uint32_t>(tree.nodes.size());
+        _CBSP_TREE_NODE node;
+        node.name = id;
+        node.parent = parent;
+        node.depth = tree.nodes[parent].depth + 1;
+        node.isFile = isFile;
+        tree.nodes.push_back(node);
+        auto &pnode = tree.nodes[parent];
+        if (pnode.last)
+            tree.nodes[pnode.last].next = index;
+        else
+            pnode.child = index;
+        pnode.last = index;
+
+        treeRehash(tree.childSlots, index, [&tree](uint32_t slot)
+                   { return treeHash(tree.nodes[slot].parent, tree.nodes[slot].name); });
+        size_t mask = tree.childSlots.size() - 1;
+        size_t i = treeHash(parent, id) & mask;
+        while (tree.childSlots[i])
+            i = (i + 1) & mask;
+        tree.childSlots[i] = index;
+        return index;
+    }
+
+    inline std::string nodeName(const CBSP_TREE &tree, const uint32_t &node)
+    {
+        auto &n = tree.names[tree.nodes[node].name];
+        return tree.pool.substr(n.first, n.second);
+    }
+
+    // the path of node relative to the node at depth
+    inline std::string nodePath(const CBSP_TREE &tree, uint32_t node, const uint32_t &depth)
     {
-        auto dlist = listDirs(dir);
-        std::stack<std::string> dstack;
-        for (auto &d : dlist)
+        uint32_t parts[256];
+        size_t count = 0;
+        std::vector<uint32_t> deep;
+        for (; node && tree.nodes[node].depth > depth; node = tree.nodes[node].parent)
         {
-            dstack.push(d);
+            if (count < 256)
+                parts[count++] = node;
+            else
+                deep.push_back(node);
         }
+
         std::string path;
-        std::tie(std::ignore, path) = matchTreeRe(tree, std::stack<std::string>(), dstack);
-        cbsp_assert(!path.empty());
+        auto append = [&tree, &path](const uint32_t &n)
+        {
+            auto &name = tree.names[tree.nodes[n].name];
+            if (!path.empty())
+                path += '/';
+            path.append(tree.pool, name.first, name.second);
+        };
+        for (size_t i = deep.size(); i-- > 0;)
+            append(deep[i]);
+        for (size_t i = count; i-- > 0;)
+            append(parts[i]);
+        return path;
+    }
 
-        return path.substr(0, path.size() - 1);
+    // the output path of the index-th inserted member, relative to the cropped tree
+    inline std::string memberPath(const CBSP_TREE &tree, const size_t &index)
+    {
+        cbsp_assert(index < tree.leaves.size());
+        return nodePath(tree, tree.leaves[index], tree.nodes[tree.crop].depth);
     }
 
-    inline void printTreeRe(const CBSP_TREE &tree, std::list<std::string> &path)
+    // the path of dir relative to the cropped tree
+    inline std::string matchTree(const CBSP_TREE &tree, const char *dir)
     {
-        if (tree.empty())
+        uint32_t skip = tree.nodes[tree.crop].depth;
+        std::string path;
+        for (auto &d : listDirs(dir))
         {
-            for (auto &p : path)
+            if (skip > 0)
             {
-                printf("/%s", p.c_str());
+                skip--;
+                continue;
             }
-            printf("\n");
-            return;
+            path += path.empty() ? d : "/" + d;
         }
+        cbsp_assert(!path.empty());
 
-        for (auto &tr : tree)
-        {
-            path.push_back(tr.isFile ? tr.path + "*" : tr.path);
-            printTreeRe(tr.children, path);
-            path.pop_back();
-        }
+        return path;
     }
 
     inline void printTree(const CBSP_TREE &tree)
     {
         cbsp_assert(!tree.empty());
-        std::list<std::string> path;
-        printTreeRe(tree, path);
+        // depth first, leaves are printed with their path
+        std::vector<uint32_t> stack;
+        for (uint32_t c = tree.nodes[tree.crop].child; c; c = tree.nodes[c].next)
+        {
+            stack.push_back(c);
+        }
+        std::reverse(stack.begin(), stack.end());
+        auto depth = tree.nodes[tree.crop].depth;
+        while (!stack.empty())
+        {
+            auto node = stack.back();
+            stack.pop_back();
+            auto &n = tree.nodes[node];
+            if (!n.child)
+            {
+                std::string line;
+                for (uint32_t p = node; p && tree.nodes[p].depth > depth; p = tree.nodes[p].parent)
+                {
+                    line = "/" + nodeName(tree, p) + (tree.nodes[p].isFile ? "*" : "") + line;
+                }
+                printf("%s\n", line.c_str());
+                continue;
+            }
+            size_t top = stack.size();
+            for (uint32_t c = n.child; c; c = tree.nodes[c].next)
+            {
+                stack.push_back(c);
+            }
+            std::reverse(stack.begin() + top, stack.end());
+        }
 
         return;
     }
 
-    inline CBSP_TREE cropTree(CBSP_TREE &tree)
+    // drop the common parent nodes
+    inline CBSP_TREE &cropTree(CBSP_TREE &tree)
     {
         cbsp_assert(!tree.empty());
-        // the nearlest common parrent node
-        if (tree.size() > 1)
-            return tree;
-
-        // the leaf node
-        if (tree.size() == 1 &&
-            tree.front().children.empty())
+        uint32_t node = 0;
+        while (true)
         {
-            return tree;
+            auto &n = tree.nodes[node];
+            // the nearlest common parrent node, or the leaf node
+            if (n.child != n.last || tree.nodes[n.child].child == 0)
+            {
+                break;
+            }
+            node = n.child;
         }
+        tree.crop = node;
 
-        return cropTree(tree.front().children);
+        return tree;
     }
 
-    inline int conTreeRe(const CBSP_TREE &tree, std::string path)
+    const size_t dir_cache_size = 256;
+
+    /*
+     * open directory handles, created on demand with mkdirat
+     * a directory is opened relative to its parent, paths are resolved once
+     * the least recently used handles are closed beyond capacity
+     */
+    class DirCache
     {
-        if (!tree.empty())
+    public:
+        DirCache(const size_t &capacity = dir_cache_size) : m_capacity(std::max<size_t>(capacity, 2)) {}
+        DirCache(const DirCache &) = delete;
+        DirCache &operator=(const DirCache &) = delete;
+        ~DirCache()
         {
-            // if not exists, or a directory, it's not a file
-            if (isFile(path.c_str()))
+            for (auto &dir : m_lru)
             {
-                ErrorMessage::setMessage("Target %s is not a directory", path.c_str());
-                return CBSP_ERR_AL_EXIST;
+                close(dir.second);
             }
-            system(std::string("mkdir -p " + path).c_str());
         }
-        int result = CBSP_ERR_SUCCESS;
-        for (auto &tr : tree)
+
+        // "a//b/./c/" -> "a/b/c", "/" stays for root, "" is the current directory
+        static std::string normalize(const std::string &path)
         {
-            result = conTreeRe(tr.children, path + "/" + tr.path);
-            if (result != CBSP_ERR_SUCCESS)
+            std::string out = (!path.empty() && path[0] == '/') ? "/" : "";
+            std::string::size_type pos = 0;
+            while (pos < path.size())
             {
-                return result;
+                auto end = path.find('/', pos);
+                if (end == std::string::npos)
+                    end = path.size();
+                auto part = path.substr(pos, end - pos);
+                pos = end + 1;
+                if (part.empty() || part == ".")
+                    continue;
+                if (!out.empty() && out.back() != '/')
+                    out += "/";
+                out += part;
             }
+            return out;
         }
-        return CBSP_ERR_SUCCESS;
-    }
-    inline int conTree(const CBSP_TREE &tree, const bool &root = false)
-    {
-        int result = CBSP_ERR_SUCCESS;
-        std::string path(root ? "/" : ".");
-        for (auto &tr : tree)
+
+        // the handle of directory path, create it if missing, -1 if failed
+        int open(const std::string &path)
         {
-            if (!tr.isFile)
+            return openNormal(normalize(path));
+        }
+
+        // the handle of the parent directory of path, and the last name
+        int parent(const std::string &path, std::string &name)
+        {
+            auto npath = normalize(path);
+            auto pos = npath.find_last_of('/');
+            if (pos == std::string::npos)
             {
-                result = conTreeRe(tr.children, path + "/" + tr.path);
-                if (result != CBSP_ERR_SUCCESS)
+                name = npath;
+                return AT_FDCWD;
+            }
+            name = npath.substr(pos + 1);
+            return openNormal(pos == 0 ? "/" : npath.substr(0, pos));
+        }
+
+    private:
+        int openNormal(const std::string &path)
+        {
+            if (path.empty())
+            {
+                return AT_FDCWD;
+            }
+            auto it = m_dirs.find(path);
+            if (it != m_dirs.end())
+            {
+                m_lru.splice(m_lru.begin(), m_lru, it->second);
+                return it->second->second;
+            }
+
+            int fd = -1;
+            if (path == "/")
+            {
+                fd = ::open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            }
+            else
+            {
+                auto pos = path.find_last_of('/');
+                int pfd = (pos == std::string::npos) ? AT_FDCWD : openNormal(pos == 0 ? "/" : path.substr(0, pos));
+                if (pfd == -1)
+                {
+                    return -1;
+                }
+                const char *name = path.c_str() + ((pos == std::string::npos) ? 0 : pos + 1);
+                CBSP_STATS_TIMER(MKDIR);
+                CBSP_TRACE_SPAN("mkdir", path);
+                CBSP_STATS_ADD(SYSCALLS, 2);
+                if (mkdirat(pfd, name, 0755) != 0 && errno != EEXIST)
                 {
-                    return result;
+                    ErrorMessage::setMessage("Create %s failed", path.c_str());
+                    return -1;
                 }
+                fd = openat(pfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            }
+            if (fd < 0)
+            {
+                ErrorMessage::setMessage("Target %s is not a directory", path.c_str());
+                return -1;
+            }
+
+            m_lru.push_front({path, fd});
+            m_dirs[path] = m_lru.begin();
+            while (m_lru.size() > m_capacity)
+            {
+                close(m_lru.back().second);
+                m_dirs.erase(m_lru.back().first);
+                m_lru.pop_back();
+            }
+            return fd;
+        }
+
+        size_t m_capacity;
+        std::list<std::pair<std::string, int>> m_lru;
+        std::unordered_map<std::string, std::list<std::pair<std::string, int>>::iterator> m_dirs;
+    };
+
+    // create the directories of the cropped tree under base
+    inline int conTree(const CBSP_TREE &tree, const std::string &base, DirCache &dirs)
+    {
+        auto depth = tree.nodes[tree.crop].depth;
+        for (uint32_t node = 1; node < tree.nodes.size(); node++)
+        {
+            auto &n = tree.nodes[node];
+            if (n.child && n.depth > depth && dirs.open(base + "/" + nodePath(tree, node, depth)) == -1)
+            {
+                return CBSP_ERR_AL_EXIST;
             }
         }
         return CBSP_ERR_SUCCESS;
     }
 
-    inline CBSP_TREE dirTree(std::FILE *&fp)
+    inline uint32_t insertTree(CBSP_TREE &tree, const std::list<std::string> &dlist)
     {
-        if (!isCBSP(fp))
-            return CBSP_TREE();
+        uint32_t node = 0;
+        size_t i = dlist.size();
+        for (auto &dl : dlist)
+        {
+            node = addChild(tree, node, dl.c_str(), dl.size(), --i == 0);
+        }
+        tree.leaves.push_back(node);
+        return node;
+    }
 
+    // insert a/b/c without splitting it into strings
+    inline uint32_t insertTree(CBSP_TREE &tree, const std::string &path)
+    {
+        uint32_t node = 0;
+        std::string::size_type pos = 0;
+        while (pos < path.size())
+        {
+            auto end = path.find('/', pos);
+            if (end == std::string::npos)
+                end = path.size();
+            if (end > pos)
+            {
+                node = addChild(tree, node, path.data() + pos, end - pos, end == path.size());
+            }
+            pos = end + 1;
+        }
+        tree.leaves.push_back(node);
+        return node;
+    }
+
+    // insert the members of fp after the ones already in tree
+    inline CBSP_TREE &dirTree(std::FILE *&fp, CBSP_TREE &tree)
+    {
+        CBSP_STATS_TIMER(TREE);
+        CBSP_TRACE_SPAN("tree");
         auto header = getHeader(fp);
         auto blocker = getFirst(fp, header);
 
-        CBSP_TREE tree;
-
-        // if call dirTree, it must be a cbsp file
-        cbsp_assert(header.count > 0);
         while (header.count > 0)
         {
             header.count--;
 
-            auto filedir = getFileDir(fp, blocker);
-            auto dlist = listDirs(filedir.c_str());
-            dlist.push_back(getFileName(fp, blocker));
-            cbsp_assert(!dlist.empty());
-
-            auto ptree = &tree;
-            size_t i = dlist.size();
-            for (auto &dl : dlist)
-            {
-                bool isFile = (--i == 0);
-                if (ptree->empty())
-                {
-                    ptree->push_back({.isFile = isFile,
-                                      .path = dl,
-                                      .children = {}});
-                    ptree = &(ptree->front().children);
-                    continue;
-                }
-                else
-                {
-                    bool newpath = true;
-                    for (auto &tr : *ptree)
-                    {
-                        if (tr.path == dl)
-                        {
-                            ptree = &(tr.children);
-                            newpath = false;
-                            break;
-                        }
-                    }
-                    if (newpath)
-                    {
-                        ptree->push_back({.isFile = isFile,
-                                          .path = dl,
-                                          .children = {}});
-                        ptree = &(ptree->back().children);
-                    }
-                }
-            }
+            insertTree(tree, getFileDir(fp, blocker) + "/" + getFileName(fp, blocker));
 
             blocker = getCBSPBlocker(fp, blocker.next);
         }
 
+        return tree;
+    }
+
+    inline CBSP_TREE dirTree(std::FILE *&fp)
+    {
+        if (!isCBSP(fp))
+            return CBSP_TREE();
+
+        CBSP_TREE tree;
+
+        // if call dirTree, it must be a cbsp file
+        cbsp_assert(getHeader(fp).count > 0);
+        dirTree(fp, tree);
+
         cbsp_assert(!tree.empty());
         return tree;
     }
@@ -3,6 +3,9 @@
 
 #include <fstream>
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
@@ -16,6 +19,8 @@
 
 #include "cbsp_error.hpp"
 #include "cbsp_structor.hpp"
+#include "cbsp_stats.hpp"
+#include "cbsp_trace.hpp"
 
 #ifdef DEBUG
 #include <cassert>
@@ -34,17 +39,23 @@
 namespace cbsp
 {
     const uint64_t CBSP_MAGIC = 0x4BF2D1;
+    // the index region, its first byte is not the one of a blocker
+    const uint64_t CBSP_INDEX_MAGIC = 0x4BF2D3;
 
     template <typename T>
     inline T read(std::FILE *&fp, uint64_t offset, uint32_t size)
     {
-        T out;
-        memset(&out, 0, sizeof(T));
+        // the fields not read keep their defaults
+        T out{};
 
+        // a newer cbsp may write a larger structure
+        size = std::min<uint32_t>(size, sizeof(T));
         uint64_t _offset = std::ftell(fp);
         std::fseek(fp, offset, SEEK_SET);
         std::fread(reinterpret_cast<char *>(&out), sizeof(char), size, fp);
         std::fseek(fp, _offset, SEEK_SET);
+        CBSP_STATS_ADD(BYTES_READ, size);
+        CBSP_STATS_ADD(SEEKS, 2);
 
         return out;
     }
@@ -55,13 +66,17 @@ namespace cbsp
         std::fseek(fp, offset, SEEK_SET);
         std::fread(reinterpret_cast<char *>(out), sizeof(char), size, fp);
         std::fseek(fp, _offset, SEEK_SET);
+        CBSP_STATS_ADD(BYTES_READ, size);
+        CBSP_STATS_ADD(SEEKS, 2);
 
         return out;
     }
 
     inline int write(const void *data, size_t size, size_t n, FILE *fp)
     {
+        CBSP_STATS_TIMER(WRITE);
         auto ok = std::fwrite(data, size, n, fp);
+        CBSP_STATS_ADD(BYTES_WRITTEN, ok * size);
         // #ifdef _WIN32_WINNT
         //         int fd = _fileno(fp);
         //         _commit(fd);
@@ -80,6 +95,7 @@ namespace cbsp
         std::fseek(fp, offset, SEEK_SET);
         auto ok = write(reinterpret_cast<char *>(&data), sizeof(char), size, fp);
         std::fseek(fp, _offset, SEEK_SET);
+        CBSP_STATS_ADD(SEEKS, 2);
 
         return ok;
     }
@@ -91,6 +107,7 @@ namespace cbsp
         std::fseek(fp, offset, SEEK_SET);
         auto ok = write(reinterpret_cast<char *>(data), sizeof(char), size, fp);
         std::fseek(fp, _offset, SEEK_SET);
+        CBSP_STATS_ADD(SEEKS, 2);
 
         return ok;
     }
@@ -158,9 +175,76 @@ namespace cbsp
             return CBSP_BLOCKER();
 
         CBSP_BLOCKER blocker = read<CBSP_BLOCKER>(fp, offset, size);
+        CBSP_STATS_ADD(BLOCKERS, 1);
         return blocker;
     }
 
+    inline bool isCBSP(const CBSP_BLOCKER_APPEND &append)
+    {
+        return append.magic == CBSP_MAGIC;
+    }
+
+    inline CBSP_BLOCKER_APPEND getCBSPAppend(std::FILE *&fp, uint64_t offset)
+    {
+        // header is not an append as defined
+        if (offset <= 0)
+            return CBSP_BLOCKER_APPEND();
+
+        uint32_t size = getCBSPSize(fp, offset);
+        // return empty append if failed
+        if (size <= 0)
+            return CBSP_BLOCKER_APPEND();
+
+        CBSP_BLOCKER_APPEND append = read<CBSP_BLOCKER_APPEND>(fp, offset, size);
+        return append;
+    }
+
+    /*
+     * a piece of member content
+     * the first one is described by the blocker, the others by the appends
+     */
+    typedef struct _CBSP_SEGMENT
+    {
+        uint64_t offset = 0;
+        uint64_t length = 0;
+    } CBSP_SEGMENT;
+
+    inline std::vector<CBSP_SEGMENT> getSegments(std::FILE *&fp, const CBSP_BLOCKER &blocker)
+    {
+        std::vector<CBSP_SEGMENT> segments;
+        if (blocker.length > 0)
+        {
+            segments.push_back({blocker.offset, blocker.length});
+        }
+
+        for (auto offset = blocker.append; offset > 0;)
+        {
+            auto append = getCBSPAppend(fp, offset);
+            // broken append chain
+            if (!isCBSP(append))
+            {
+                break;
+            }
+            if (append.length > 0)
+            {
+                segments.push_back({append.offset, append.length});
+            }
+            offset = append.next;
+        }
+
+        return segments;
+    }
+
+    inline uint64_t getLength(std::FILE *&fp, const CBSP_BLOCKER &blocker)
+    {
+        uint64_t length = 0;
+        for (auto &segment : getSegments(fp, blocker))
+        {
+            length += segment.length;
+        }
+        return length;
+    }
+
     inline CBSP_HEADER getHeader(std::FILE *&fp)
     {
         uint32_t size = getCBSPSize(fp, 0);
@@ -172,6 +256,38 @@ namespace cbsp
         return header;
     }
 
+    // an older header has no room for the blockers size
+    inline bool hasBlockers(const CBSP_HEADER &header)
+    {
+        return header.size >= offsetof(CBSP_HEADER, blockers) + sizeof(header.blockers);
+    }
+
+    inline bool isDeleted(const CBSP_BLOCKER &blocker)
+    {
+        return blocker.type & CBSP_TYPE_DELETED;
+    }
+
+    inline bool isSparse(const CBSP_BLOCKER &blocker)
+    {
+        return blocker.type & CBSP_TYPE_SPARSE;
+    }
+
+    inline bool hasBlocks(const CBSP_BLOCKER &blocker)
+    {
+        return blocker.type & CBSP_TYPE_BLOCKS;
+    }
+
+    inline bool isLink(const CBSP_BLOCKER &blocker)
+    {
+        return blocker.type & CBSP_TYPE_LINK;
+    }
+
+    // the content is also the one of another blocker
+    inline bool isShared(const CBSP_BLOCKER &blocker)
+    {
+        return blocker.type & (CBSP_TYPE_LINK | CBSP_TYPE_SHARED);
+    }
+
     inline bool hasFirst(const CBSP_HEADER &header)
     {
         return header.first != 0;
@@ -239,6 +355,7 @@ namespace cbsp
     inline int setHeader(std::FILE *&fp, CBSP_HEADER &header)
     {
         header.magic = CBSP_MAGIC;
+        header.generation++;
         return write(fp, header, 0, header.size);
     }
 
@@ -0,0 +1,314 @@
+#ifndef _CBSP_VOLUME_H_
+#define _CBSP_VOLUME_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <cstdint>
+#include <cstdio>
+#include <sys/stat.h>
+
+#include "cbsp_structor.hpp"
+#include "cbsp_error.hpp"
+#include "cbsp_file.hpp"
+#include "cbsp_utils.hpp"
+#include "cbsp_tree.hpp"
+#include "cbsp_crc.hpp"
+#include "cbsp_combiner.hpp"
+#include "cbsp_spliter.hpp"
+
+/*
+ * striped archives
+ * target.000, target.001, ... are the volumes of target, each one is a cbsp file of its own
+ * files are spread over the volumes by size, and every volume is written and read on its own thread,
+ * volumes on different disks are driven at once
+ */
+namespace cbsp
+{
+    namespace volume
+    {
+        inline std::string volumePath(const char *target, const uint32_t &volume)
+        {
+            char suffix[16];
+            snprintf(suffix, sizeof(suffix), ".%03u", volume);
+            return std::string(target) + suffix;
+        }
+
+        // the volumes of target, 0 if it is not striped
+        inline uint32_t getVolumes(const char *target)
+        {
+            if (!target)
+            {
+                return 0;
+            }
+            CBSPFile fp;
+            if (fp.open(volumePath(target, 0).c_str()) != CBSP_ERR_SUCCESS || !isCBSP(&fp))
+            {
+                return 0;
+            }
+            auto header = getHeader(&fp);
+            return (header.volume == 0) ? header.volumes : 0;
+        }
+
+        /*
+         * spread files over the volumes, the largest first to the least filled volume
+         * filled starts with what the volumes already hold
+         * the hard links of a file go to its volume, they share its content there
+         * every volume keeps the files in their given order
+         */
+        inline std::vector<std::vector<std::string>> distribute(const std::vector<std::string> &files, std::vector<uint64_t> filled)
+        {
+            struct File
+            {
+                size_t index;
+                // the bytes stored, a sparse file stores its data only
+                uint64_t size;
+                std::pair<uint64_t, uint64_t> inode;
+                bool linked;
+            };
+            std::vector<File> sized;
+            sized.reserve(files.size());
+            for (size_t i = 0; i < files.size(); i++)
+            {
+                struct stat sts;
+                if (stat(files[i].c_str(), &sts) != 0)
+                {
+                    sized.push_back({i, 0, {0, 0}, false});
+                    continue;
+                }
+                uint64_t size = std::min<uint64_t>(sts.st_size, static_cast<uint64_t>(sts.st_blocks) * 512);
+                sized.push_back({i, size, {sts.st_dev, sts.st_ino}, S_ISREG(sts.st_mode) && sts.st_nlink > 1});
+            }
+            std::stable_sort(sized.begin(), sized.end(), [](const File &a, const File &b)
+                             { return a.size > b.size; });
+
+            std::map<std::pair<uint64_t, uint64_t>, size_t> inodes;
+            std::vector<std::vector<size_t>> plan(filled.size());
+            for (auto &file : sized)
+            {
+                auto inode = file.linked ? inodes.find(file.inode) : inodes.end();
+                size_t volume = 0;
+                if (inode != inodes.end())
+                {
+                    volume = inode->second;
+                }
+                else
+                {
+                    volume = std::min_element(filled.begin(), filled.end()) - filled.begin();
+                    filled[volume] += file.size;
+                    if (file.linked)
+                    {
+                        inodes[file.inode] = volume;
+                    }
+                }
+                plan[volume].push_back(file.index);
+            }
+
+            std::vector<std::vector<std::string>> out(plan.size());
+            for (size_t v = 0; v < plan.size(); v++)
+            {
+                std::sort(plan[v].begin(), plan[v].end());
+                for (auto &index : plan[v])
+                {
+                    out[v].push_back(files[index]);
+                }
+            }
+            return out;
+        }
+
+        /*
+         * add files to the volumes of target
+         * a new target gets volumes volumes, an existing one keeps its count
+         */
+        inline int combine(const char *target, const std::vector<std::string> &files, uint32_t volumes, const int &mixer = 0)
+        {
+            if (!target)
+            {
+                return CBSP_ERR_BAD_PATH;
+            }
+            if (files.empty())
+            {
+                return CBSP_ERR_NO_SOURCE;
+            }
+            uint32_t existing = getVolumes(target);
+            volumes = (existing > 0) ? existing : std::max<uint32_t>(volumes, 1);
+
+            // CBSPFile is not movable
+            std::vector<std::unique_ptr<CBSPFile>> fps;
+            std::vector<uint64_t> filled;
+            for (uint32_t v = 0; v < volumes; v++)
+            {
+                auto path = volumePath(target, v);
+                fps.emplace_back(new CBSPFile());
+                int ret = fps.back()->create(path.c_str(), mixer);
+                if (ret != CBSP_ERR_SUCCESS)
+                {
+                    return ret;
+                }
+                std::FILE *&fp = &*fps.back();
+                auto header = getHeader(fp);
+                if (header.count == 0)
+                {
+                    header.volume = v;
+                    header.volumes = volumes;
+                    setHeader(fp, header);
+                }
+                else if (header.volume != v || header.volumes != volumes)
+                {
+                    ErrorMessage::setMessage("%s is not volume %u of %u", path.c_str(), v, volumes);
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                filled.push_back(fileLenght(fp));
+            }
+
+            auto plan = distribute(files, filled);
+            std::vector<int> results(volumes, CBSP_ERR_SUCCESS);
+            std::vector<std::thread> workers;
+            for (uint32_t v = 0; v < volumes; v++)
+            {
+                workers.emplace_back([&fps, &plan, &results, v]()
+                                     {
+                                         combiner::CBSP_LINKS links;
+                                         for (auto &file : plan[v])
+                                         {
+                                             results[v] |= combiner::add(&*fps[v], file.c_str(), &links);
+                                         } });
+            }
+
+            int result = CBSP_ERR_SUCCESS;
+            for (uint32_t v = 0; v < volumes; v++)
+            {
+                workers[v].join();
+                result |= results[v];
+            }
+            return result;
+        }
+
+        /*
+         * extract every volume of target under outdir
+         * the tree is built from all the volumes, then each volume is extracted on its own thread
+         */
+        /*
+         * open every volume of target and build one tree of all their members
+         * bases is the first member of each volume in the tree
+         */
+        inline int openVolumes(const char *target, std::vector<std::unique_ptr<CBSPFile>> &fps,
+                               std::vector<size_t> &bases, CBSP_TREE &tr, const int &verify)
+        {
+            if (!target)
+            {
+                return CBSP_ERR_NO_TARGET;
+            }
+            uint32_t volumes = getVolumes(target);
+            if (volumes == 0)
+            {
+                return CBSP_ERR_NO_CBSP;
+            }
+
+            for (uint32_t v = 0; v < volumes; v++)
+            {
+                auto path = volumePath(target, v);
+                fps.emplace_back(new CBSPFile());
+                int ret = fps.back()->open(path.c_str());
+                if (ret != CBSP_ERR_SUCCESS)
+                {
+                    ErrorMessage::setMessage("Open volume %s failed", path.c_str());
+                    return ret;
+                }
+                std::FILE *&fp = &*fps.back();
+                if (!isCBSP(fp))
+                {
+                    return CBSP_ERR_NO_CBSP;
+                }
+                auto header = getHeader(fp);
+                if (header.volume != v || header.volumes != volumes)
+                {
+                    ErrorMessage::setMessage("%s is not volume %u of %u", path.c_str(), v, volumes);
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                if (!verifyMatch(fp, verify))
+                {
+                    return CBSP_ERR_BAD_CBSP;
+                }
+                bases.push_back(tr.leaves.size());
+                dirTree(fp, tr);
+            }
+            if (tr.empty())
+            {
+                return CBSP_ERR_NO_CBSP;
+            }
+            cropTree(tr);
+            return CBSP_ERR_SUCCESS;
+        }
+
+        // print the members of all volumes, as they are extracted
+        inline int printTree(const char *target, const int &verify = verifyLevel())
+        {
+            std::vector<std::unique_ptr<CBSPFile>> fps;
+            std::vector<size_t> bases;
+            CBSP_TREE tr;
+            int ret = openVolumes(target, fps, bases, tr, verify);
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                return ret;
+            }
+            for (size_t i = 0; i < tr.leaves.size(); i++)
+            {
+                auto rpath = memberPath(tr, i);
+                cbsp_assert(!rpath.empty());
+                fprintf(stdout, "%s\n", rpath.c_str());
+            }
+            return CBSP_ERR_SUCCESS;
+        }
+
+        inline int extract(const char *target, const char *outdir = nullptr, const bool &links = false,
+                           const int &verify = verifyLevel())
+        {
+            std::vector<std::unique_ptr<CBSPFile>> fps;
+            // the first member of each volume in the tree
+            std::vector<size_t> bases;
+            CBSP_TREE tr;
+            int ret = openVolumes(target, fps, bases, tr, verify);
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                return ret;
+            }
+            uint32_t volumes = fps.size();
+
+            {
+                DirCache dirs;
+                ret = spliter::makeTree(tr, outdir, dirs);
+                if (ret != CBSP_ERR_SUCCESS)
+                {
+                    return ret;
+                }
+            }
+
+            std::vector<int> results(volumes, CBSP_ERR_SUCCESS);
+            std::vector<std::thread> workers;
+            for (uint32_t v = 0; v < volumes; v++)
+            {
+                workers.emplace_back([&fps, &tr, &bases, &results, &outdir, &links, &verify, v]()
+                                     {
+                                         // directory handles are not shared between threads
+                                         DirCache dirs;
+                                         results[v] = spliter::genFiles(&*fps[v], tr, bases[v], outdir, dirs, links, verify); });
+            }
+
+            int result = CBSP_ERR_SUCCESS;
+            for (uint32_t v = 0; v < volumes; v++)
+            {
+                workers[v].join();
+                result |= results[v];
+            }
+            return result;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef _CBSP_WALKER_H_
+#define _CBSP_WALKER_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "cbsp_buffer.hpp"
+#include "cbsp_stats.hpp"
+#include "cbsp_trace.hpp"
+
+namespace cbsp
+{
+    namespace walker
+    {
+        const size_t dents_size = 64 * 1024;
+
+        // the entry types a walker cares about
+        enum class EntryType
+        {
+            NONE,
+            FILE,
+            DIR,
+        };
+
+        // d_type if the filesystem reports it, or fstatat like stat(2), which follows links
+        inline EntryType entryType(int dirfd, const char *name, unsigned char type)
+        {
+            switch (type)
+            {
+            case DT_DIR:
+                return EntryType::DIR;
+            case DT_REG:
+            case DT_FIFO:
+            case DT_CHR:
+            case DT_BLK:
+            case DT_SOCK:
+                return EntryType::FILE;
+            default:
+                break;
+            }
+
+            struct stat sts;
+            CBSP_STATS_ADD(SYSCALLS, 1);
+            if (fstatat(dirfd, name, &sts, 0) != 0)
+            {
+                return EntryType::NONE;
+            }
+            return S_ISDIR(sts.st_mode) ? EntryType::DIR : EntryType::FILE;
+        }
+
+        inline bool isDots(const char *name)
+        {
+            return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+        }
+
+        /*
+         * read the entries of an opened directory
+         * files are appended with prefix, directories go to onDir(dirfd, name)
+         */
+        template <typename OnDir>
+        inline void scanDir(int dirfd, const std::string &prefix, std::vector<std::string> &files, OnDir &&onDir)
+        {
+#ifdef __linux__
+            struct Dirent64
+            {
+                uint64_t d_ino;
+                int64_t d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                char d_name[];
+            };
+
+            Buffer dents(dents_size);
+            while (true)
+            {
+                long n = syscall(SYS_getdents64, dirfd, dents.get(), dents.size());
+                CBSP_STATS_ADD(SYSCALLS, 1);
+                if (n <= 0)
+                {
+                    break;
+                }
+                for (long pos = 0; pos < n;)
+                {
+                    auto entry = reinterpret_cast<Dirent64 *>(dents.get() + pos);
+                    pos += entry->d_reclen;
+                    if (isDots(entry->d_name))
+                    {
+                        continue;
+                    }
+                    auto type = entryType(dirfd, entry->d_name, entry->d_type);
+                    if (type == EntryType::DIR)
+                    {
+                        onDir(dirfd, entry->d_name);
+                    }
+                    else if (type == EntryType::FILE)
+                    {
+                        files.push_back(prefix + entry->d_name);
+                    }
+                }
+            }
+#else
+            // fdopendir owns the fd
+            DIR *dir = fdopendir(dup(dirfd));
+            if (!dir)
+            {
+                return;
+            }
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != nullptr)
+            {
+                if (isDots(entry->d_name))
+                {
+                    continue;
+                }
+                auto type = entryType(dirfd, entry->d_name, entry->d_type);
+                if (type == EntryType::DIR)
+                {
+                    onDir(dirfd, entry->d_name);
+                }
+                else if (type == EntryType::FILE)
+                {
+                    files.push_back(prefix + entry->d_name);
+                }
+            }
+            closedir(dir);
+#endif
+        }
+
+        inline int openDir(int dirfd, const char *name)
+        {
+            CBSP_STATS_ADD(SYSCALLS, 1);
+            return openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+
+        // depth first, one fd per level
+        inline void walkSerial(int dirfd, const std::string &prefix, std::vector<std::string> &files)
+        {
+            scanDir(dirfd, prefix, files, [&files, &prefix](int fd, const char *name)
+                    {
+                        int subfd = openDir(fd, name);
+                        if (subfd < 0)
+                        {
+                            return;
+                        }
+                        walkSerial(subfd, prefix + name + "/", files);
+                        close(subfd);
+                    });
+        }
+
+        /*
+         * walk subdirectories on threads
+         * a directory is a task, workers push the subdirectories they meet
+         */
+        inline void walkParallel(int dirfd, const std::string &prefix, std::vector<std::string> &files, size_t threads)
+        {
+            // open a directory when its task runs, at its parent fd
+            // the subdirectories of a directory share its fd, closed by the last of them
+            struct Task
+            {
+                std::string prefix;
+                std::shared_ptr<int> parent;
+                std::string name;
+            };
+
+            std::mutex mutex;
+            std::condition_variable cond;
+            std::deque<Task> tasks;
+            size_t pending = 1;
+            tasks.push_back({prefix, nullptr, ""});
+
+            std::vector<std::vector<std::string>> results(threads);
+            auto worker = [&](size_t id)
+            {
+                auto &found = results[id];
+                while (true)
+                {
+                    Task task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cond.wait(lock, [&]
+                                  { return !tasks.empty() || pending == 0; });
+                        if (tasks.empty())
+                        {
+                            return;
+                        }
+                        task = std::move(tasks.front());
+                        tasks.pop_front();
+                    }
+
+                    std::vector<Task> subdirs;
+                    CBSP_TRACE_SPAN("scan", task.prefix);
+                    int fd = task.parent ? openDir(*task.parent, task.name.c_str()) : dup(dirfd);
+                    task.parent.reset();
+                    if (fd >= 0)
+                    {
+                        std::shared_ptr<int> shared(new int(fd), [](int *fd)
+                                                    { close(*fd); delete fd; });
+                        scanDir(fd, task.prefix, found, [&subdirs, &task, &shared](int, const char *name)
+                                { subdirs.push_back({task.prefix + name + "/", shared, name}); });
+                    }
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    pending += subdirs.size();
+                    pending--;
+                    for (auto &subdir : subdirs)
+                    {
+                        tasks.push_back(std::move(subdir));
+                    }
+                    cond.notify_all();
+                }
+            };
+
+            std::vector<std::thread> pool;
+            for (size_t i = 0; i < threads; i++)
+            {
+                pool.emplace_back(worker, i);
+            }
+            for (auto &thread : pool)
+            {
+                thread.join();
+            }
+
+            for (auto &found : results)
+            {
+                files.insert(files.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+            }
+        }
+
+        /*
+         * all files under path, sorted
+         * threads > 1 walks subdirectories on a thread pool
+         */
+        inline std::vector<std::string> walk(const char *path, size_t threads = 0)
+        {
+            std::vector<std::string> files;
+            if (!path)
+            {
+                return files;
+            }
+            CBSP_STATS_TIMER(WALK);
+            CBSP_TRACE_SPAN("walk", path);
+
+            int fd = openDir(AT_FDCWD, path);
+            if (fd < 0)
+            {
+                // it is a file, return the only file
+                struct stat sts;
+                if (stat(path, &sts) == 0 && !S_ISDIR(sts.st_mode))
+                {
+                    files.push_back(path);
+                }
+                return files;
+            }
+
+            std::string prefix = path;
+            while (!prefix.empty() && prefix.back() == '/')
+            {
+                prefix.pop_back();
+            }
+            prefix += "/";
+
+            if (threads > 1)
+            {
+                walkParallel(fd, prefix, files, threads);
+            }
+            else
+            {
+                walkSerial(fd, prefix, files);
+            }
+            close(fd);
+
+            std::sort(files.begin(), files.end());
+            return files;
+        }
+    }
+}
+
+#endif
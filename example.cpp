@@ -1,18 +1,26 @@
 #include <list>
+#include <vector>
 #include <fstream>
 #include <cstdio>
 #include <cstring>
 
 #include "cbsp_combiner.hpp"
 #include "cbsp_spliter.hpp"
+#include "cbsp_streamer.hpp"
+#include "cbsp_volume.hpp"
+#include "cbsp_index.hpp"
+#include "cbsp_archive.hpp"
 #include "cbsp_error.hpp"
 #include "cbsp_file.hpp"
 #include "cbsp_tree.hpp"
+#include "cbsp_stats.hpp"
+#include "cbsp_trace.hpp"
 
 namespace cbsp
 {
     template <typename T>
-    inline int combine(const char *target, const T &clist)
+    inline int combine(const char *target, const T &clist, const bool &update = false, const int &mixer = 0, const size_t &jobs = 0,
+                       const uint32_t &volumes = 0)
     {
         if (clist.empty())
         {
@@ -21,17 +29,49 @@ namespace cbsp
         }
 
         int ret = CBSP_ERR_SUCCESS;
+        // a striped archive gets all the files at once, to spread them over its volumes
+        if (volumes > 1 || volume::getVolumes(target) > 0)
+        {
+            if (update)
+            {
+                ErrorMessage::setMessage("Update %s failed, a striped archive is only added to", target);
+                printError(CBSP_ERR_NO_CBSP);
+                return CBSP_ERR_NO_CBSP;
+            }
+            std::vector<std::string> files;
+            for (auto &source : clist)
+            {
+                if (isDir(source))
+                {
+                    auto found = getDirFiles(source, jobs);
+                    files.insert(files.end(), found.begin(), found.end());
+                }
+                else
+                {
+                    files.push_back(source);
+                }
+            }
+            ret = volume::combine(target, files, volumes, mixer);
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                printError(ret);
+            }
+            return ret;
+        }
+
         CBSPFile fp;
-        ret = fp.create(target);
+        ret = fp.create(target, mixer);
         if (ret != CBSP_ERR_SUCCESS)
         {
             printError(ret);
             return ret;
         }
 
-        auto add = [&fp](const char *source)
+        // a file met again through another hard link shares the content of the first one
+        combiner::CBSP_LINKS links;
+        auto add = [&fp, &update, &links](const char *source)
         {
-            int ret = combiner::add(&fp, source);
+            int ret = update ? combiner::update(&fp, source, &links) : combiner::add(&fp, source, &links);
             if (ret != CBSP_ERR_SUCCESS)
             {
                 printError(ret);
@@ -43,7 +83,7 @@ namespace cbsp
         {
             if (isDir(source))
             {
-                auto files = getDirFiles(source);
+                auto files = getDirFiles(source, jobs);
                 for (auto &file : files)
                 {
                     ret |= add(file.c_str());
@@ -56,9 +96,85 @@ namespace cbsp
         }
         return ret;
     }
-    inline int split(const char *target, const char *outdir = nullptr)
+    template <typename T>
+    inline int update(const char *target, const T &clist)
+    {
+        return combine(target, clist, true);
+    }
+    template <typename T>
+    inline int erase(const char *target, const T &clist)
     {
         int ret = CBSP_ERR_SUCCESS;
+        // erase from an existing cbsp only, never create one
+        std::FILE *file = std::fopen(target, "rb+");
+        if (!file)
+        {
+            printError(CBSP_ERR_NO_TARGET);
+            return CBSP_ERR_NO_TARGET;
+        }
+        CBSPFile fp;
+        ret = fp.open(file);
+        if (ret != CBSP_ERR_SUCCESS)
+        {
+            printError(ret);
+            return ret;
+        }
+
+        for (auto &source : clist)
+        {
+            int _ret = combiner::erase(&fp, source);
+            if (_ret != CBSP_ERR_SUCCESS)
+            {
+                printError(_ret);
+            }
+            ret |= _ret;
+        }
+        return ret;
+    }
+    template <typename T>
+    inline int merge(const char *target, const T &slist)
+    {
+        std::vector<std::string> sources(slist.begin(), slist.end());
+        int ret = combiner::merge(target, sources);
+        if (ret != CBSP_ERR_SUCCESS)
+        {
+            printError(ret);
+        }
+        return ret;
+    }
+    inline int compact(const char *target)
+    {
+        int ret = combiner::compact(target);
+        if (ret != CBSP_ERR_SUCCESS)
+        {
+            printError(ret);
+        }
+        return ret;
+    }
+    inline int split(const char *target, const char *outdir = nullptr, const bool &links = false)
+    {
+        int ret = CBSP_ERR_SUCCESS;
+        if (volume::getVolumes(target) > 0)
+        {
+            ret = volume::extract(target, outdir, links);
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                printError(ret);
+            }
+            return ret;
+        }
+
+        // read cbsp from stdin
+        if (strcmp(target, "-") == 0)
+        {
+            ret = streamer::extract(STDIN_FILENO, outdir, links);
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                printError(ret);
+            }
+            return ret;
+        }
+
         CBSPFile fp;
         ret = fp.open(target);
         if (ret != CBSP_ERR_SUCCESS)
@@ -67,7 +183,7 @@ namespace cbsp
             return ret;
         }
 
-        ret = spliter::extract(&fp, outdir);
+        ret = spliter::extract(&fp, outdir, links);
         if (ret != CBSP_ERR_SUCCESS)
         {
             printError(ret);
@@ -75,9 +191,150 @@ namespace cbsp
 
         return ret;
     }
+    // build the index of target, then print its total size and largest members from it
+    inline int makeIndex(const char *target, const size_t &largest)
+    {
+        // index an existing cbsp only, never create one
+        std::FILE *file = target ? std::fopen(target, "rb+") : nullptr;
+        if (!file)
+        {
+            printError(CBSP_ERR_NO_TARGET);
+            return CBSP_ERR_NO_TARGET;
+        }
+        CBSPFile fp;
+        int ret = fp.open(file);
+        if (ret == CBSP_ERR_SUCCESS && !isCBSP(&fp))
+        {
+            ret = CBSP_ERR_NO_CBSP;
+        }
+        if (ret == CBSP_ERR_SUCCESS)
+        {
+            ret = buildIndex(&fp);
+        }
+        CBSPIndex index;
+        if (ret == CBSP_ERR_SUCCESS && !index.open(&fp))
+        {
+            ret = CBSP_ERR_BAD_CBSP;
+        }
+        if (ret != CBSP_ERR_SUCCESS)
+        {
+            printError(ret);
+            return ret;
+        }
+
+        fprintf(stdout, "members : %lu\n", index.size());
+        fprintf(stdout, "size    : %lu\n", index.totalSize());
+        for (auto &i : index.largest(largest))
+        {
+            auto blocker = getCBSPBlocker(&fp, index.blockers()[i]);
+            fprintf(stdout, "%12lu %s/%s\n", index.sizes()[i], getFileDir(&fp, blocker).c_str(), getFileName(&fp, blocker).c_str());
+        }
+        return CBSP_ERR_SUCCESS;
+    }
+
+    // check target with threads, every volume of a striped one, and list the broken members
+    inline int test(const char *target, const size_t &threads)
+    {
+        if (!target)
+        {
+            printError(CBSP_ERR_NO_TARGET);
+            return CBSP_ERR_NO_TARGET;
+        }
+        int result = CBSP_ERR_SUCCESS;
+        uint32_t volumes = volume::getVolumes(target);
+        for (uint32_t v = 0; v < std::max<uint32_t>(volumes, 1); v++)
+        {
+            std::string path = (volumes > 0) ? volume::volumePath(target, v) : std::string(target);
+            std::vector<std::string> broken;
+            CBSPFile fp;
+            int ret = fp.open(path.c_str());
+            if (ret == CBSP_ERR_SUCCESS)
+            {
+                ret = spliter::test(&fp, (threads > 0) ? threads : verify_threads, &broken);
+            }
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                ErrorMessage::setMessage("Test %s failed", path.c_str());
+                printError(ret);
+            }
+            for (auto &member : broken)
+            {
+                fprintf(stdout, "BROKEN %s\n", member.c_str());
+            }
+            result |= ret;
+        }
+        if (result == CBSP_ERR_SUCCESS)
+        {
+            fprintf(stdout, "%s OK\n", target);
+        }
+        return result;
+    }
+
+    // write length bytes of a member from offset to stdout, to its end if length is 0
+    inline int readRange(const char *target, const char *rpath, uint64_t offset, uint64_t length)
+    {
+        Archive archive;
+        int ret = archive.open(target);
+        if (ret != CBSP_ERR_SUCCESS)
+        {
+            printError(ret);
+            return ret;
+        }
+
+        auto member = archive.find(rpath);
+        if (!member)
+        {
+            ErrorMessage::setMessage("%s not found", rpath);
+            printError(CBSP_ERR_NO_EXIST);
+            return CBSP_ERR_NO_EXIST;
+        }
+
+        // a chunk at a time, a large range is not held at once
+        Buffer buffer(chunkLimit());
+        uint64_t left = (length > 0) ? length : UINT64_MAX;
+        while (left > 0)
+        {
+            uint64_t n = std::min<uint64_t>(left, buffer.size());
+            ret = archive.read(*member, offset, n, buffer.get());
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                printError(ret);
+                return ret;
+            }
+            if (n == 0 || std::fwrite(buffer.get(), 1, n, stdout) != n)
+            {
+                break;
+            }
+            offset += n;
+            left -= n;
+        }
+        return CBSP_ERR_SUCCESS;
+    }
     inline int print(const char *target)
     {
         int ret = CBSP_ERR_SUCCESS;
+        // a striped archive, the header of every volume and the members of all
+        uint32_t volumes = volume::getVolumes(target);
+        if (volumes > 0)
+        {
+            for (uint32_t v = 0; v < volumes; v++)
+            {
+                CBSPFile fp;
+                fp.open(volume::volumePath(target, v).c_str());
+                ret = spliter::printHeader(&fp);
+                if (ret != CBSP_ERR_SUCCESS)
+                {
+                    printError(ret);
+                }
+            }
+            ret = volume::printTree(target);
+            if (ret != CBSP_ERR_SUCCESS)
+            {
+                printError(ret);
+            }
+            return ret;
+        }
+
         CBSPFile fp;
         ret = fp.open(target);
         if (ret != CBSP_ERR_SUCCESS)
@@ -106,12 +363,135 @@ namespace cbsp
     }
 }
 
+// N[KMG] in bytes
+static uint64_t parseSize(const char *arg)
+{
+    char *unit = nullptr;
+    uint64_t size = strtoull(arg, &unit, 10);
+    switch (unit ? *unit : '\0')
+    {
+    case 'G':
+    case 'g':
+        size <<= 10;
+        // fall through
+    case 'M':
+    case 'm':
+        size <<= 10;
+        // fall through
+    case 'K':
+    case 'k':
+        size <<= 10;
+        break;
+    default:
+        break;
+    }
+    return size;
+}
+
 int main(int argc, char **argv)
 {
+    // options may be anywhere, the rest are positional
+    // --mixer=linear|xor  mix the content of a new cbsp
+    // --key=N             the key of xor mixer
+    // -j N                scan directories, or test an archive, with N threads
+    // --memory=N[KMG]     memory budget for the chunks of one file
+    // --stats             print the counters and phase times to stderr
+    // --trace=FILE        save the spans of the run as chrome trace events
+    // --links             extract hard links as links, not as copies
+    // --volumes=N         stripe a new cbsp over N volume files, target.000 ...
+    // --block=N[KMG]      crc every N bytes of a large file, 0 for the whole file only
+    // --verify=none|meta|full  what is checked before an archive is read, full by default
+    int mixer = 0;
+    uint32_t volumes = 0;
+    bool links = false;
+    size_t jobs = 0;
+    bool stats = false;
+    const char *trace = nullptr;
+    std::vector<char *> args;
+    for (int i = 0; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--mixer=", 8) == 0)
+        {
+            const char *name = argv[i] + 8;
+            if (strcmp(name, "xor") == 0)
+                mixer = cbsp::CBSP_MIX_XOR;
+            else if (strcmp(name, "linear") == 0)
+                mixer = cbsp::CBSP_MIX_LINEAR;
+        }
+        else if (strncmp(argv[i], "--key=", 6) == 0)
+        {
+            cbsp::mixKey() = strtoull(argv[i] + 6, nullptr, 0);
+        }
+        else if (strncmp(argv[i], "--memory=", 9) == 0)
+        {
+            cbsp::chunkBudget() = parseSize(argv[i] + 9);
+        }
+        else if (strncmp(argv[i], "--verify=", 9) == 0)
+        {
+            const char *name = argv[i] + 9;
+            if (strcmp(name, "none") == 0)
+                cbsp::verifyLevel() = cbsp::CBSP_VERIFY_NONE;
+            else if (strcmp(name, "meta") == 0)
+                cbsp::verifyLevel() = cbsp::CBSP_VERIFY_META;
+            else if (strcmp(name, "full") == 0)
+                cbsp::verifyLevel() = cbsp::CBSP_VERIFY_FULL;
+        }
+        else if (strncmp(argv[i], "--block=", 8) == 0)
+        {
+            cbsp::crcBlockSize() = parseSize(argv[i] + 8);
+        }
+        else if (strncmp(argv[i], "--trace=", 8) == 0)
+        {
+            trace = argv[i] + 8;
+            cbsp::trace::start();
+        }
+        else if (strncmp(argv[i], "--volumes=", 10) == 0)
+        {
+            volumes = strtoul(argv[i] + 10, nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--links") == 0)
+        {
+            links = true;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            stats = true;
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            jobs = strtoul(argv[++i], nullptr, 10);
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+    // argv ends with nullptr, as the one main was given
+    args.push_back(nullptr);
+    argc = args.size() - 1;
+    argv = args.data();
+
     if (argc < 2)
         return 1;
+    // every command reads its target first
+    if (argc < 3)
+    {
+        cbsp::printError(cbsp::CBSP_ERR_NO_TARGET);
+        return 1;
+    }
+
+    auto combine = [&argc, &argv, &mixer, &jobs, &volumes](int start)
+    {
+        char *target = argv[start];
+        std::list<const char *> sources;
+        for (int i = start + 1; i < argc; i++)
+        {
+            sources.push_back(argv[i]);
+        }
+        cbsp::combine(target, sources, false, mixer, jobs, volumes);
+    };
 
-    auto combine = [&argc, &argv](int start)
+    auto update = [&argc, &argv](int start)
     {
         char *target = argv[start];
         std::list<const char *> sources;
@@ -119,13 +499,60 @@ int main(int argc, char **argv)
         {
             sources.push_back(argv[i]);
         }
-        cbsp::combine(target, sources);
+        cbsp::update(target, sources);
+    };
+
+    auto erase = [&argc, &argv](int start)
+    {
+        char *target = argv[start];
+        std::list<const char *> sources;
+        for (int i = start + 1; i < argc; i++)
+        {
+            sources.push_back(argv[i]);
+        }
+        cbsp::erase(target, sources);
+    };
+
+    auto merge = [&argc, &argv](int start)
+    {
+        char *target = argv[start];
+        std::list<const char *> sources;
+        for (int i = start + 1; i < argc; i++)
+        {
+            sources.push_back(argv[i]);
+        }
+        cbsp::merge(target, sources);
+    };
+
+    auto compact = [&argv](int start)
+    {
+        char *target = argv[start];
+        cbsp::compact(target);
     };
 
-    auto split = [&argc, &argv](int start)
+    auto split = [&argc, &argv, &links](int start)
     {
         char *target = argv[start];
-        cbsp::split(target, (argc > 3) ? argv[3] : "");
+        cbsp::split(target, (argc > 3) ? argv[3] : "", links);
+    };
+
+    auto range = [&argc, &argv](int start)
+    {
+        if (argc < start + 2)
+            return;
+        uint64_t offset = (argc > start + 2) ? parseSize(argv[start + 2]) : 0;
+        uint64_t length = (argc > start + 3) ? parseSize(argv[start + 3]) : 0;
+        cbsp::readRange(argv[start], argv[start + 1], offset, length);
+    };
+
+    auto index = [&argc, &argv](int start)
+    {
+        cbsp::makeIndex(argv[start], (argc > start + 1) ? strtoul(argv[start + 1], nullptr, 10) : 10);
+    };
+
+    auto test = [&argv, &jobs](int start)
+    {
+        cbsp::test(argv[start], jobs);
     };
 
     auto print = [&argc, &argv](int start)
@@ -138,14 +565,51 @@ int main(int argc, char **argv)
     {
         combine(2);
     }
+    else if (strcmp(argv[1], "-u") == 0)
+    {
+        update(2);
+    }
+    else if (strcmp(argv[1], "-d") == 0)
+    {
+        erase(2);
+    }
+    else if (strcmp(argv[1], "-m") == 0)
+    {
+        merge(2);
+    }
+    else if (strcmp(argv[1], "-k") == 0)
+    {
+        compact(2);
+    }
     else if (strcmp(argv[1], "-s") == 0)
     {
         split(2);
     }
+    else if (strcmp(argv[1], "-x") == 0)
+    {
+        index(2);
+    }
+    else if (strcmp(argv[1], "-t") == 0)
+    {
+        test(2);
+    }
+    else if (strcmp(argv[1], "-r") == 0)
+    {
+        range(2);
+    }
     else if (strcmp(argv[1], "-p") == 0)
     {
         print(2);
     }
 
+    if (stats)
+    {
+        cbsp::print(cbsp::getStats());
+    }
+    if (trace && cbsp::trace::save(trace) != cbsp::CBSP_ERR_SUCCESS)
+    {
+        cbsp::printError(cbsp::CBSP_ERR_CREATE_FAILED);
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "cbsp_combiner.hpp"
+#include "cbsp_archive.hpp"
+
+TEST(ArchiveTest, READ)
+{
+    char dir[] = "/tmp/cbsp_archive_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string target = std::string(dir) + "/data.cbsp";
+    std::vector<std::string> files = {std::string(dir) + "/a", std::string(dir) + "/b"};
+    std::vector<std::string> data;
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        data.emplace_back(200000 + f * 1000, '\0');
+        for (size_t i = 0; i < data[f].size(); i++)
+        {
+            data[f][i] = static_cast<char>(i * (31 + f) + i / 7);
+        }
+        std::ofstream(files[f], std::ios::binary) << data[f];
+    }
+
+    auto block = cbsp::crcBlockSize();
+    cbsp::crcBlockSize() = 64 * 1024;
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str(), cbsp::CBSP_MIX_XOR), cbsp::CBSP_ERR_SUCCESS);
+        for (auto &file : files)
+        {
+            ASSERT_EQ(cbsp::combiner::add(&fp, file.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        }
+    }
+    cbsp::crcBlockSize() = block;
+
+    cbsp::Archive archive;
+    ASSERT_EQ(archive.open(target.c_str(), cbsp::CBSP_VERIFY_FULL), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(archive.list(), (std::vector<std::string>{"a", "b"}));
+    ASSERT_EQ(archive.find("none"), nullptr);
+    ASSERT_NE(archive.find("b"), nullptr);
+
+    // one handle, read from several threads
+    std::vector<int> failed(4, 0);
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < failed.size(); t++)
+    {
+        readers.emplace_back([&, t]()
+                             {
+                                 std::string out(5000, '\0');
+                                 for (uint64_t offset = t * 997; offset < 200000; offset += 4999)
+                                 {
+                                     size_t f = (offset / 4999) % 2;
+                                     uint64_t length = out.size();
+                                     if (archive.read(f ? "b" : "a", offset, length, &out[0]) != cbsp::CBSP_ERR_SUCCESS ||
+                                         out.substr(0, length) != data[f].substr(offset, length))
+                                     {
+                                         failed[t]++;
+                                     }
+                                 } });
+    }
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+    ASSERT_EQ(failed, std::vector<int>(failed.size(), 0));
+
+    std::string out = std::string(dir) + "/out";
+    ASSERT_EQ(archive.extract("b", out.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(archive.extract("b", out.c_str()), cbsp::CBSP_ERR_AL_EXIST);
+    std::stringstream extracted;
+    extracted << std::ifstream(out, std::ios::binary).rdbuf();
+    ASSERT_EQ(extracted.str(), data[1]);
+    archive.close();
+
+    // a broken block fails the reads under it only
+    {
+        std::fstream file(target, std::ios::binary | std::ios::in | std::ios::out);
+        cbsp::CBSPFile fp(target.c_str());
+        file.seekp(cbsp::getFirst(&fp).offset + 70000);
+        file.put('\xff');
+    }
+    ASSERT_EQ(archive.open(target.c_str(), cbsp::CBSP_VERIFY_FULL), cbsp::CBSP_ERR_SUCCESS);
+    std::string range(100, '\0');
+    uint64_t length = range.size();
+    ASSERT_EQ(archive.read("a", 1000, length, &range[0]), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_NE(archive.read("a", 69000, length, &range[0]), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(length, 0u);
+    length = range.size();
+    ASSERT_EQ(archive.read("b", 70000, length, &range[0]), cbsp::CBSP_ERR_SUCCESS);
+
+    unlink(out.c_str());
+    unlink(target.c_str());
+    for (auto &file : files)
+    {
+        unlink(file.c_str());
+    }
+    rmdir(dir);
+}
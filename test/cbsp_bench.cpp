@@ -0,0 +1,384 @@
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include <ftw.h>
+#include <cstdlib>
+
+#include "cbsp_buffer.hpp"
+#include "cbsp_crc.hpp"
+#include "cbsp_mixer.hpp"
+#include "cbsp_file.hpp"
+#include "cbsp_tree.hpp"
+#include "cbsp_combiner.hpp"
+#include "cbsp_index.hpp"
+#include "cbsp_spliter.hpp"
+#include "cbsp_archive.hpp"
+
+/*
+ * micro benchmarks of the hot paths
+ * the files they need are made once under a temporary directory
+ */
+namespace
+{
+    std::string sample(size_t size)
+    {
+        std::string data(size, '\0');
+        for (size_t i = 0; i < size; i++)
+        {
+            data[i] = static_cast<char>(i * 131 + i / 7);
+        }
+        return data;
+    }
+
+    void writeFile(const std::string &path, const std::string &content)
+    {
+        std::FILE *file = std::fopen(path.c_str(), "wb");
+        std::fwrite(content.data(), 1, content.size(), file);
+        std::fclose(file);
+    }
+
+    class Workspace
+    {
+    public:
+        static Workspace &get()
+        {
+            static Workspace workspace;
+            return workspace;
+        }
+
+        // a file of 64 MiB
+        const std::string &bigFile()
+        {
+            if (m_big.empty())
+            {
+                m_big = m_root + "/big";
+                writeFile(m_big, sample(64 << 20));
+            }
+            return m_big;
+        }
+
+        // 32 dirs of 64 files
+        const std::string &tree()
+        {
+            if (m_tree.empty())
+            {
+                m_tree = m_root + "/tree";
+                for (int d = 0; d < 32; d++)
+                {
+                    std::string dir = m_tree + "/d" + std::to_string(d) + "/sub";
+                    cbsp::makeDirs(dir.c_str());
+                    for (int f = 0; f < 64; f++)
+                    {
+                        writeFile(dir + "/f" + std::to_string(f), sample(64));
+                    }
+                }
+            }
+            return m_tree;
+        }
+
+        // an archive of the tree
+        const std::string &archive()
+        {
+            if (m_archive.empty())
+            {
+                m_archive = m_root + "/tree.cb";
+                cbsp::CBSPFile fp;
+                fp.create(m_archive.c_str());
+                for (auto &file : cbsp::getDirFiles(tree().c_str()))
+                {
+                    cbsp::combiner::add(&fp, file.c_str());
+                }
+            }
+            return m_archive;
+        }
+
+    private:
+        Workspace()
+        {
+            char root[] = "/tmp/cbsp-bench-XXXXXX";
+            m_root = mkdtemp(root);
+        }
+        ~Workspace()
+        {
+            nftw(
+                m_root.c_str(), [](const char *path, const struct stat *, int, struct FTW *)
+                { return remove(path); },
+                16, FTW_DEPTH | FTW_PHYS);
+        }
+
+        std::string m_root;
+        std::string m_big;
+        std::string m_tree;
+        std::string m_archive;
+    };
+}
+
+static void BM_Crc32(benchmark::State &state)
+{
+    auto data = sample(state.range(0));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(cbsp::crc32(data.data(), data.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Crc32)->RangeMultiplier(16)->Range(64, 16 << 20);
+
+static void BM_Mixer(benchmark::State &state)
+{
+    auto data = sample(state.range(1));
+    for (auto _ : state)
+    {
+        cbsp::mixer(&data[0], data.size(), state.range(0), 3);
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_Mixer)->ArgsProduct({{cbsp::CBSP_MIX_LINEAR, cbsp::CBSP_MIX_XOR}, {4 << 10, 1 << 20, 16 << 20}});
+
+static void BM_MixCrc32(benchmark::State &state)
+{
+    auto data = sample(state.range(0));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(cbsp::crc32Mix(&data[0], data.size(), cbsp::CBSP_MIX_XOR, 0));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MixCrc32)->Arg(1 << 20)->Arg(16 << 20);
+
+static void BM_BufferAcquire(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        cbsp::Buffer buffer(state.range(0));
+        benchmark::DoNotOptimize(buffer.get());
+    }
+}
+BENCHMARK(BM_BufferAcquire)->Arg(256)->Arg(64 << 10)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_ChunkFile(benchmark::State &state)
+{
+    auto path = Workspace::get().bigFile();
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    for (auto _ : state)
+    {
+        uint64_t total = 0;
+        std::rewind(file);
+        cbsp::ChunkFile chunkfile(file, state.range(0));
+        for (auto &chunk = chunkfile.begin(); chunk != chunkfile.end(); ++chunk)
+        {
+            total += (*chunk).size();
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    std::fclose(file);
+    state.SetBytesProcessed(state.iterations() * (64 << 20));
+}
+BENCHMARK(BM_ChunkFile)->Arg(1 << 20)->Arg(cbsp::batch_size)->UseRealTime();
+
+static void BM_ChunkStream(benchmark::State &state)
+{
+    auto path = Workspace::get().bigFile();
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    for (auto _ : state)
+    {
+        uint32_t crc = 0;
+        cbsp::ChunkStream stream(file, 0, 64 << 20, state.range(0));
+        char *data = nullptr;
+        uint64_t size = 0;
+        while (stream.next(data, size))
+        {
+            crc = cbsp::crc32(data, size, crc);
+        }
+        benchmark::DoNotOptimize(crc);
+    }
+    std::fclose(file);
+    state.SetBytesProcessed(state.iterations() * (64 << 20));
+}
+BENCHMARK(BM_ChunkStream)->Arg(1 << 20)->Arg(cbsp::batch_size)->UseRealTime();
+
+static void BM_BlockerWalk(benchmark::State &state)
+{
+    cbsp::CBSPFile fp(Workspace::get().archive().c_str());
+    for (auto _ : state)
+    {
+        auto header = cbsp::getHeader(&fp);
+        auto offset = header.first;
+        for (uint32_t i = 0; i < header.count; i++)
+        {
+            offset = cbsp::getCBSPBlocker(&fp, offset).next;
+        }
+        benchmark::DoNotOptimize(offset);
+    }
+}
+BENCHMARK(BM_BlockerWalk);
+
+static void BM_BlockerFind(benchmark::State &state)
+{
+    auto last = cbsp::getDirFiles(Workspace::get().tree().c_str()).back();
+    cbsp::CBSPFile fp(Workspace::get().archive().c_str());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(cbsp::combiner::find(&fp, last.c_str()));
+    }
+}
+BENCHMARK(BM_BlockerFind);
+
+// a copy of the archive with an index
+static const std::string &indexedArchive()
+{
+    static std::string indexed = []
+    {
+        std::string path = Workspace::get().archive() + ".index";
+        {
+            std::ifstream in(Workspace::get().archive(), std::ios::binary);
+            std::ofstream out(path, std::ios::binary);
+            out << in.rdbuf();
+        }
+        cbsp::CBSPFile fp;
+        fp.create(path.c_str());
+        cbsp::buildIndex(&fp);
+        return path;
+    }();
+    return indexed;
+}
+
+static void BM_IndexFind(benchmark::State &state)
+{
+    auto last = cbsp::getDirFiles(Workspace::get().tree().c_str()).back();
+    cbsp::CBSPFile fp(indexedArchive().c_str());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(cbsp::combiner::find(&fp, last.c_str()));
+    }
+}
+BENCHMARK(BM_IndexFind);
+
+// the stored bytes of all members, from the blockers and from the index
+static void BM_TotalWalk(benchmark::State &state)
+{
+    cbsp::CBSPFile fp(Workspace::get().archive().c_str());
+    for (auto _ : state)
+    {
+        uint64_t total = 0;
+        auto header = cbsp::getHeader(&fp);
+        auto blocker = cbsp::getFirst(&fp, header);
+        for (uint32_t i = 0; i < header.count; i++, blocker = cbsp::getCBSPBlocker(&fp, blocker.next))
+        {
+            total += blocker.length;
+        }
+        benchmark::DoNotOptimize(total);
+    }
+}
+BENCHMARK(BM_TotalWalk);
+
+static void BM_TotalIndex(benchmark::State &state)
+{
+    cbsp::CBSPFile fp(indexedArchive().c_str());
+    cbsp::CBSPIndex index;
+    index.open(&fp);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(index.totalSize());
+    }
+}
+BENCHMARK(BM_TotalIndex);
+
+// a 4 KiB read of a member, looked up and read through the file, then through an opened archive
+static void BM_ReadMember(benchmark::State &state)
+{
+    cbsp::CBSPFile fp(Workspace::get().archive().c_str());
+    std::string out(4096, '\0');
+    for (auto _ : state)
+    {
+        cbsp::CBSP_BLOCKER blocker;
+        cbsp::spliter::findMember(&fp, "d0/sub/f0", blocker);
+        uint64_t length = out.size();
+        cbsp::spliter::readRange(&fp, blocker, 0, length, &out[0]);
+        benchmark::DoNotOptimize(length);
+    }
+}
+BENCHMARK(BM_ReadMember);
+
+static void BM_ArchiveRead(benchmark::State &state)
+{
+    // opened once, the threads share it
+    static cbsp::Archive archive;
+    static int opened = archive.open(Workspace::get().archive().c_str());
+    benchmark::DoNotOptimize(opened);
+    std::string out(4096, '\0');
+    for (auto _ : state)
+    {
+        uint64_t length = out.size();
+        archive.read("d0/sub/f0", 0, length, &out[0]);
+        benchmark::DoNotOptimize(length);
+    }
+}
+BENCHMARK(BM_ArchiveRead)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_InsertTree(benchmark::State &state)
+{
+    std::vector<std::string> paths;
+    for (int64_t i = 0; i < state.range(0); i++)
+    {
+        paths.push_back("/home/src/d" + std::to_string(i % 1000) + "/e" + std::to_string(i % 37) + "/f" + std::to_string(i));
+    }
+    for (auto _ : state)
+    {
+        cbsp::CBSP_TREE tree;
+        for (auto &path : paths)
+        {
+            cbsp::insertTree(tree, path);
+        }
+        cbsp::cropTree(tree);
+        benchmark::DoNotOptimize(tree.crop);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_InsertTree)->Arg(1 << 10)->Arg(1 << 17)->Unit(benchmark::kMillisecond);
+
+static void BM_MatchTree(benchmark::State &state)
+{
+    cbsp::CBSP_TREE tree;
+    std::vector<std::string> paths;
+    for (int i = 0; i < (1 << 14); i++)
+    {
+        paths.push_back("/home/src/d" + std::to_string(i % 100) + "/f" + std::to_string(i));
+        cbsp::insertTree(tree, paths.back());
+    }
+    cbsp::cropTree(tree);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(cbsp::matchTree(tree, paths[i++ % paths.size()].c_str()));
+    }
+}
+BENCHMARK(BM_MatchTree);
+
+static void BM_DirTree(benchmark::State &state)
+{
+    cbsp::CBSPFile fp(Workspace::get().archive().c_str());
+    for (auto _ : state)
+    {
+        auto tree = cbsp::dirTree(&fp);
+        cbsp::cropTree(tree);
+        benchmark::DoNotOptimize(tree.crop);
+    }
+}
+BENCHMARK(BM_DirTree)->Unit(benchmark::kMillisecond);
+
+static void BM_GetDirFiles(benchmark::State &state)
+{
+    auto root = Workspace::get().tree();
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(cbsp::getDirFiles(root.c_str(), state.range(0)).size());
+    }
+}
+BENCHMARK(BM_GetDirFiles)->Arg(0)->Arg(4)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
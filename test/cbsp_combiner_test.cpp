@@ -0,0 +1,245 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "cbsp_combiner.hpp"
+#include "cbsp_spliter.hpp"
+
+namespace
+{
+    std::string readAll(const std::string &path)
+    {
+        std::stringstream out;
+        out << std::ifstream(path, std::ios::binary).rdbuf();
+        return out.str();
+    }
+
+    std::string makeData(const size_t &size, const size_t &seed)
+    {
+        std::string data(size, '\0');
+        for (size_t i = 0; i < size; i++)
+        {
+            data[i] = static_cast<char>(i * (17 + seed) + i / 13);
+        }
+        return data;
+    }
+
+    // the header crc and every member crc match, and the members extract to outdir
+    void checkArchive(const std::string &target, const std::string &outdir)
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.open(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_TRUE(cbsp::crcMatch(&fp));
+        ASSERT_EQ(cbsp::spliter::test(&fp), cbsp::CBSP_ERR_SUCCESS);
+        std::system((std::string("rm -rf ") + outdir).c_str());
+        ASSERT_EQ(cbsp::spliter::extract(&fp, outdir.c_str(), false, cbsp::CBSP_VERIFY_FULL), cbsp::CBSP_ERR_SUCCESS);
+    }
+}
+
+TEST(CombinerTest, UPDATE)
+{
+    char dir[] = "/tmp/cbsp_combiner_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string in = std::string(dir) + "/in";
+    std::string out = std::string(dir) + "/out";
+    std::string target = std::string(dir) + "/data.cbsp";
+    ASSERT_TRUE(cbsp::makeDirs(in.c_str()));
+    std::ofstream(in + "/a", std::ios::binary) << makeData(100000, 1);
+    std::ofstream(in + "/b", std::ios::binary) << makeData(3000, 2);
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str(), cbsp::CBSP_MIX_XOR), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, (in + "/a").c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, (in + "/b").c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+
+    // shrink in place, grow past the room into an append segment,
+    // then a size across both segments, and the shorter one again
+    for (size_t size : {40000, 250000, 120000, 10})
+    {
+        SCOPED_TRACE(size);
+        std::ofstream(in + "/a", std::ios::binary | std::ios::trunc) << makeData(size, size);
+        {
+            cbsp::CBSPFile fp;
+            ASSERT_EQ(fp.create(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+            ASSERT_EQ(cbsp::combiner::update(&fp, (in + "/a").c_str()), cbsp::CBSP_ERR_SUCCESS);
+            // the header crc is patched, not taken again
+            ASSERT_EQ(cbsp::getHeader(&fp).crc, cbsp::crcBlocker(&fp, cbsp::getHeader(&fp)));
+
+            cbsp::CBSP_BLOCKER blocker;
+            ASSERT_NE(cbsp::spliter::findMember(&fp, "a", blocker), 0u);
+            ASSERT_EQ(cbsp::getLength(&fp, blocker), size);
+            ASSERT_EQ(cbsp::crcBlocker(&fp, blocker), blocker.crc);
+            if (size == 120000)
+            {
+                // the content spans the room before the blocker and the appended one
+                ASSERT_GT(blocker.append, 0u);
+                ASSERT_EQ(cbsp::getSegments(&fp, blocker).size(), 2u);
+            }
+        }
+        checkArchive(target, out);
+        ASSERT_EQ(readAll(out + "/a"), readAll(in + "/a"));
+        ASSERT_EQ(readAll(out + "/b"), readAll(in + "/b"));
+    }
+
+    // a member not in the archive yet is added
+    std::ofstream(in + "/c", std::ios::binary) << makeData(500, 3);
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::update(&fp, (in + "/c").c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+    checkArchive(target, out);
+    ASSERT_EQ(readAll(out + "/c"), readAll(in + "/c"));
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
+
+TEST(CombinerTest, ERASE)
+{
+    char dir[] = "/tmp/cbsp_combiner_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string in = std::string(dir) + "/in";
+    std::string out = std::string(dir) + "/out";
+    std::string target = std::string(dir) + "/data.cbsp";
+    ASSERT_TRUE(cbsp::makeDirs(in.c_str()));
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str(), cbsp::CBSP_MIX_XOR), cbsp::CBSP_ERR_SUCCESS);
+        for (auto name : {"a", "b", "c"})
+        {
+            std::ofstream(in + "/" + name, std::ios::binary) << makeData(50000, *name);
+            ASSERT_EQ(cbsp::combiner::add(&fp, (in + "/" + name).c_str()), cbsp::CBSP_ERR_SUCCESS);
+        }
+    }
+
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::erase(&fp, (in + "/b").c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_TRUE(cbsp::crcMatch(&fp));
+        ASSERT_EQ(cbsp::getHeader(&fp).count, 2u);
+        // erased already, and never there
+        ASSERT_NE(cbsp::combiner::erase(&fp, (in + "/b").c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_NE(cbsp::combiner::erase(&fp, (in + "/none").c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_TRUE(cbsp::crcMatch(&fp));
+        // a source gone from disk is found by its path as written
+        ASSERT_EQ(unlink((in + "/c").c_str()), 0);
+        ASSERT_EQ(cbsp::combiner::erase(&fp, (in + "//none/.././c").c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::getHeader(&fp).count, 1u);
+    }
+    checkArchive(target, out);
+    ASSERT_EQ(readAll(out + "/a"), readAll(in + "/a"));
+    ASSERT_NE(access((out + "/b").c_str(), F_OK), 0);
+    ASSERT_NE(access((out + "/c").c_str(), F_OK), 0);
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
+
+TEST(CombinerTest, COMPACT)
+{
+    char dir[] = "/tmp/cbsp_combiner_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string in = std::string(dir) + "/in";
+    std::string out = std::string(dir) + "/out";
+    std::string target = std::string(dir) + "/data.cbsp";
+    ASSERT_TRUE(cbsp::makeDirs(in.c_str()));
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str(), cbsp::CBSP_MIX_XOR), cbsp::CBSP_ERR_SUCCESS);
+        for (auto name : {"a", "b", "c"})
+        {
+            std::ofstream(in + "/" + name, std::ios::binary) << makeData(60000, *name);
+            ASSERT_EQ(cbsp::combiner::add(&fp, (in + "/" + name).c_str()), cbsp::CBSP_ERR_SUCCESS);
+        }
+        ASSERT_EQ(cbsp::combiner::erase(&fp, (in + "/a").c_str()), cbsp::CBSP_ERR_SUCCESS);
+        // an append segment is joined again by compact
+        std::ofstream(in + "/c", std::ios::binary | std::ios::trunc) << makeData(90000, 4);
+        ASSERT_EQ(cbsp::combiner::update(&fp, (in + "/c").c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+    uint64_t before = readAll(target).size();
+
+    ASSERT_EQ(cbsp::combiner::compact(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_LT(readAll(target).size(), before);
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.open(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::getHeader(&fp).count, 2u);
+        cbsp::CBSP_BLOCKER blocker;
+        ASSERT_NE(cbsp::spliter::findMember(&fp, "c", blocker), 0u);
+        ASSERT_EQ(cbsp::getSegments(&fp, blocker).size(), 1u);
+    }
+    checkArchive(target, out);
+    ASSERT_EQ(readAll(out + "/b"), readAll(in + "/b"));
+    ASSERT_EQ(readAll(out + "/c"), readAll(in + "/c"));
+    ASSERT_NE(access((out + "/a").c_str(), F_OK), 0);
+
+    // a compact archive compacts to itself
+    std::string compacted = readAll(target);
+    ASSERT_EQ(cbsp::combiner::compact(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(readAll(target).size(), compacted.size());
+    checkArchive(target, out);
+    ASSERT_EQ(readAll(out + "/c"), readAll(in + "/c"));
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
+
+TEST(CombinerTest, MERGE)
+{
+    char dir[] = "/tmp/cbsp_combiner_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string in = std::string(dir) + "/in";
+    std::string out = std::string(dir) + "/out";
+    ASSERT_TRUE(cbsp::makeDirs(in.c_str()));
+    auto make = [&in](const std::string &target, const std::vector<std::string> &names, const int &mixer)
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str(), mixer), cbsp::CBSP_ERR_SUCCESS);
+        for (auto &name : names)
+        {
+            ASSERT_EQ(cbsp::combiner::add(&fp, (in + "/" + name).c_str()), cbsp::CBSP_ERR_SUCCESS);
+        }
+    };
+
+    std::string a = std::string(dir) + "/a.cbsp";
+    std::string b = std::string(dir) + "/b.cbsp";
+    std::ofstream(in + "/x", std::ios::binary) << makeData(30000, 1);
+    std::ofstream(in + "/y", std::ios::binary) << makeData(20000, 2);
+    make(a, {"x", "y"}, cbsp::CBSP_MIX_XOR);
+    std::string y = readAll(in + "/y");
+    // the same path with another content
+    std::ofstream(in + "/y", std::ios::binary | std::ios::trunc) << makeData(25000, 3);
+    std::ofstream(in + "/z", std::ios::binary) << makeData(40000, 4);
+    make(b, {"y", "z"}, 0);
+
+    // the y of b is skipped, the rest is merged
+    std::string m = std::string(dir) + "/m.cbsp";
+    int ret = cbsp::combiner::merge(m.c_str(), {a, b});
+    ASSERT_NE(ret & cbsp::CBSP_ERR_AL_EXIST, 0);
+    ASSERT_EQ(ret & ~cbsp::CBSP_ERR_AL_EXIST, cbsp::CBSP_ERR_SUCCESS);
+    checkArchive(m, out);
+    ASSERT_EQ(readAll(out + "/x"), readAll(in + "/x"));
+    ASSERT_EQ(readAll(out + "/y"), y);
+    ASSERT_EQ(readAll(out + "/z"), readAll(in + "/z"));
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.open(m.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::getHeader(&fp).count, 3u);
+        ASSERT_EQ(cbsp::getHeader(&fp).mixer, cbsp::CBSP_MIX_XOR);
+    }
+
+    // a target is not merged into itself, nor is a missing source
+    uint64_t size = readAll(m).size();
+    ASSERT_NE(cbsp::combiner::merge(m.c_str(), {m}) & cbsp::CBSP_ERR_BAD_PATH, 0);
+    ASSERT_NE(cbsp::combiner::merge(m.c_str(), {std::string(dir) + "/none.cbsp"}), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(readAll(m).size(), size);
+    checkArchive(m, out);
+    ASSERT_EQ(readAll(out + "/y"), y);
+
+    // everything of b is in m already
+    ASSERT_EQ(cbsp::combiner::merge(m.c_str(), {b}), cbsp::CBSP_ERR_AL_EXIST);
+    ASSERT_EQ(readAll(m).size(), size);
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
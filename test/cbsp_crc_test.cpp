@@ -12,4 +12,90 @@ TEST(CRCTest, RECAL)
     crc = cbsp::crc32("789", 3, crc);
     ASSERT_NE(crc, 0);
     ASSERT_EQ(crc, cbsp::crc32((str + "789").c_str(), str.size() + 3));
-}
\ No newline at end of file
+}
+TEST(CRCTest, COMBINE)
+{
+    std::string a{"123456"}, b{"789abcdefg"};
+    uint32_t crcA = cbsp::crc32(a.c_str(), a.size());
+    uint32_t crcB = cbsp::crc32(b.c_str(), b.size());
+    ASSERT_EQ(cbsp::crc32Combine(crcA, crcB, b.size()), cbsp::crc32((a + b).c_str(), a.size() + b.size()));
+    ASSERT_EQ(cbsp::crc32Combine(crcA, 0x0, 0), crcA);
+    ASSERT_EQ(cbsp::crc32Combine(0x0, crcB, b.size()), crcB);
+}
+
+TEST(CRCTest, PATCH)
+{
+    std::string before{"head-0123-tail-data"};
+    std::string after{"head-4567-tail-data"};
+    uint32_t crc = cbsp::crc32(before.c_str(), before.size());
+    // "0123" -> "4567", followed by 10 bytes
+    crc = cbsp::crc32Patch(crc, before.c_str() + 5, after.c_str() + 5, 4, 10);
+    ASSERT_EQ(crc, cbsp::crc32(after.c_str(), after.size()));
+}
+
+TEST(CRCTest, MIX)
+{
+    std::string source(5000, '\0');
+    for (size_t i = 0; i < source.size(); i++)
+    {
+        source[i] = static_cast<char>(i * 13 + 5);
+    }
+    uint32_t expect = cbsp::crc32(source.c_str(), source.size());
+
+    for (int type : {0, cbsp::CBSP_MIX_LINEAR, cbsp::CBSP_MIX_XOR})
+    {
+        // crc the source and mix it, in two pieces
+        std::string data = source;
+        uint32_t crc = cbsp::crc32Mix(&data[0], 1234, type, 0);
+        crc = cbsp::crc32Mix(&data[1234], data.size() - 1234, type, 1234, crc);
+        ASSERT_EQ(crc, expect);
+
+        std::string mixed = source;
+        cbsp::mixer(&mixed[0], mixed.size(), type);
+        ASSERT_EQ(data, mixed);
+
+        // unmix and crc
+        crc = cbsp::mixCrc32(&data[0], 77, type, 0);
+        crc = cbsp::mixCrc32(&data[77], data.size() - 77, type, 77, crc);
+        ASSERT_EQ(crc, expect);
+        ASSERT_EQ(data, source);
+    }
+}
+
+TEST(CRCTest, BLOCKS)
+{
+    std::string data(10000, '\0');
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<char>(i * 7 + 3);
+    }
+    // the last block is short
+    const uint64_t block = 4096;
+    std::vector<uint32_t> blocks;
+    for (uint64_t offset = 0; offset < data.size(); offset += block)
+    {
+        blocks.push_back(cbsp::crc32(data.c_str() + offset, std::min<uint64_t>(block, data.size() - offset)));
+    }
+    ASSERT_EQ(blocks.size(), 3);
+    ASSERT_EQ(cbsp::crcBlocks(blocks, block, data.size()), cbsp::crc32(data.c_str(), data.size()));
+    ASSERT_EQ(cbsp::crcBlocks({}, block, 0), 0);
+}
+
+TEST(CRCTest, STATS)
+{
+    std::string data(4096, 'x');
+    cbsp::resetStats();
+    cbsp::crc32(data.c_str(), 1000);
+    cbsp::crc32Mix(&data[0], data.size(), cbsp::CBSP_MIX_XOR, 0);
+    // no mixer falls back to crc32, counted once
+    cbsp::crc32Mix(&data[0], 96, 0, 0);
+
+    auto stats = cbsp::getStats();
+#ifndef CBSP_NO_STATS
+    ASSERT_EQ(stats.crcBytes, 1000 + data.size() + 96);
+#else
+    ASSERT_EQ(stats.crcBytes, 0);
+#endif
+    cbsp::resetStats();
+    ASSERT_EQ(cbsp::getStats().crcBytes, 0);
+}
@@ -0,0 +1,582 @@
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "cbsp_combiner.hpp"
+#include "cbsp_spliter.hpp"
+#include "cbsp_file.hpp"
+#include "cbsp_tree.hpp"
+
+/*
+ * end to end benchmark of cbsp against tar
+ * a deterministic dataset is generated from a seed and shape parameters,
+ * then combine, list, extract-all and extract-one are timed for both tools
+ *
+ * every operation runs in a child process, so that its peak rss and
+ * read/write syscalls (from /proc/<pid>/io) are its own
+ * the result is a json document on stdout
+ *
+ * cbsp_e2e [--files=N] [--size=N] [--dist=fixed|uniform|exp] [--depth=N]
+ *          [--dup=R] [--seed=N] [--runs=N] [--sample=N] [--work=DIR] [--tar=PATH]
+ */
+namespace
+{
+    struct Options
+    {
+        uint64_t files = 1000;
+        uint64_t size = 16 * 1024;
+        std::string dist = "exp";
+        uint64_t depth = 3;
+        double dup = 0.0;
+        uint64_t seed = 1;
+        uint64_t runs = 3;
+        uint64_t sample = 100;
+        std::string work;
+        std::string tar = "tar";
+    };
+
+    // splitmix64, the same sequence on every platform
+    class Random
+    {
+    public:
+        explicit Random(uint64_t seed) : m_state(seed) {}
+
+        uint64_t next()
+        {
+            uint64_t z = (m_state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+        // in [0, 1)
+        double real() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    private:
+        uint64_t m_state;
+    };
+
+    struct Member
+    {
+        std::string path;
+        uint64_t size;
+        uint64_t seed;
+    };
+
+    struct Dataset
+    {
+        std::string root;
+        std::vector<Member> members;
+        uint64_t bytes = 0;
+    };
+
+    struct Measure
+    {
+        double seconds = 0;
+        uint64_t syscr = 0;
+        uint64_t syscw = 0;
+        long rss = 0;
+        std::vector<double> latencies;
+        bool ok = false;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    double since(const Clock::time_point &start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // a directory of depth levels, 8 ways on each level
+    std::string memberDir(uint64_t index, uint64_t depth)
+    {
+        std::string dir;
+        for (uint64_t level = 0; level < depth; level++)
+        {
+            dir += "/d" + std::to_string(level) + "_" + std::to_string(index % 8);
+            index /= 8;
+        }
+        return dir;
+    }
+
+    uint64_t memberSize(Random &random, const Options &options)
+    {
+        if (options.dist == "fixed")
+        {
+            return options.size;
+        }
+        if (options.dist == "uniform")
+        {
+            return random.next() % (2 * options.size + 1);
+        }
+        // exponential, many small files and a long tail
+        return static_cast<uint64_t>(-std::log(1.0 - random.real()) * options.size);
+    }
+
+    bool writeMember(const std::string &path, uint64_t size, uint64_t seed)
+    {
+        std::FILE *file = std::fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            return false;
+        }
+        Random random(seed);
+        std::vector<uint64_t> words(8192);
+        while (size > 0)
+        {
+            for (auto &word : words)
+            {
+                word = random.next();
+            }
+            uint64_t bytes = std::min<uint64_t>(size, words.size() * sizeof(uint64_t));
+            std::fwrite(words.data(), 1, bytes, file);
+            size -= bytes;
+        }
+        std::fclose(file);
+        return true;
+    }
+
+    // a duplicated member copies the size and content of an earlier one
+    bool generate(const Options &options, Dataset &dataset)
+    {
+        Random random(options.seed);
+        uint64_t dirs = std::max<uint64_t>(1, options.files / 32);
+        for (uint64_t i = 0; i < options.files; i++)
+        {
+            Member member;
+            member.path = dataset.root + memberDir(random.next() % dirs, options.depth) + "/f" + std::to_string(i);
+            if (i > 0 && random.real() < options.dup)
+            {
+                auto &source = dataset.members[random.next() % i];
+                member.size = source.size;
+                member.seed = source.seed;
+            }
+            else
+            {
+                member.size = memberSize(random, options);
+                member.seed = random.next();
+            }
+
+            if (!cbsp::makeDirs(cbsp::fileDir(member.path.c_str()).c_str()) ||
+                !writeMember(member.path, member.size, member.seed))
+            {
+                fprintf(stderr, "can not write %s\n", member.path.c_str());
+                return false;
+            }
+            dataset.bytes += member.size;
+            dataset.members.push_back(member);
+        }
+        return true;
+    }
+
+    void readIO(pid_t pid, Measure &measure)
+    {
+        std::string path = "/proc/" + std::to_string(pid) + "/io";
+        std::FILE *file = std::fopen(path.c_str(), "r");
+        if (!file)
+        {
+            return;
+        }
+        char line[128];
+        while (std::fgets(line, sizeof(line), file))
+        {
+            unsigned long long value = 0;
+            if (sscanf(line, "syscr: %llu", &value) == 1)
+                measure.syscr = value;
+            else if (sscanf(line, "syscw: %llu", &value) == 1)
+                measure.syscw = value;
+        }
+        std::fclose(file);
+    }
+
+    /*
+     * run body in a child, its stdout goes to /dev/null
+     * body returns the latencies of the members it handled, they come back on a pipe
+     */
+    Measure measure(const std::function<bool(std::vector<double> &)> &body)
+    {
+        Measure result;
+        int fds[2];
+        if (pipe(fds) != 0)
+        {
+            return result;
+        }
+
+        // the child must not repeat what stdout has buffered
+        fflush(stdout);
+        auto start = Clock::now();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            std::vector<double> latencies;
+            bool ok = body(latencies);
+            for (auto latency : latencies)
+            {
+                if (write(fds[1], &latency, sizeof(latency)) != sizeof(latency))
+                    break;
+            }
+            _exit(ok ? 0 : 1);
+        }
+        close(fds[1]);
+        if (pid < 0)
+        {
+            close(fds[0]);
+            return result;
+        }
+
+        double latency;
+        while (read(fds[0], &latency, sizeof(latency)) == sizeof(latency))
+        {
+            result.latencies.push_back(latency);
+        }
+        close(fds[0]);
+
+        // keep the child a zombie until its io is read
+        siginfo_t info;
+        waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+        result.seconds = since(start);
+        readIO(pid, result);
+
+        int status = 0;
+        struct rusage usage;
+        wait4(pid, &status, 0, &usage);
+        result.rss = usage.ru_maxrss;
+        result.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        return result;
+    }
+
+    // run a command in the child, it replaces the child
+    bool command(const std::vector<std::string> &args)
+    {
+        std::vector<char *> argv;
+        for (auto &arg : args)
+        {
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        _exit(127);
+        return false;
+    }
+
+    // per member latency of a command run for each member, the rest summed up
+    Measure each(const std::vector<std::vector<std::string>> &commands)
+    {
+        Measure total;
+        total.ok = true;
+        for (auto &args : commands)
+        {
+            auto one = measure([&args](std::vector<double> &)
+                               { return command(args); });
+            total.seconds += one.seconds;
+            total.syscr += one.syscr;
+            total.syscw += one.syscw;
+            total.rss = std::max(total.rss, one.rss);
+            total.latencies.push_back(one.seconds);
+            total.ok = total.ok && one.ok;
+        }
+        return total;
+    }
+
+    // the fastest of runs
+    Measure best(uint64_t runs, const std::function<void()> &prepare, const std::function<Measure()> &run)
+    {
+        Measure result;
+        for (uint64_t i = 0; i < runs; i++)
+        {
+            prepare();
+            auto current = run();
+            if (i == 0 || (current.ok && current.seconds < result.seconds))
+            {
+                result = std::move(current);
+            }
+        }
+        return result;
+    }
+
+    void removeAll(const std::string &path)
+    {
+        nftw(
+            path.c_str(), [](const char *path, const struct stat *, int, struct FTW *)
+            { return remove(path); },
+            16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    void renew(const std::string &path)
+    {
+        removeAll(path);
+        mkdir(path.c_str(), 0777);
+    }
+
+    double percentile(std::vector<double> values, double p)
+    {
+        std::sort(values.begin(), values.end());
+        size_t index = static_cast<size_t>(std::ceil(p * values.size()));
+        return values[index > 0 ? index - 1 : 0];
+    }
+
+    uint64_t fileSize(const std::string &path)
+    {
+        struct stat sts;
+        return stat(path.c_str(), &sts) == 0 ? sts.st_size : 0;
+    }
+
+    void report(const char *tool, const char *op, const Measure &measure, uint64_t bytes, uint64_t members, bool &first)
+    {
+        printf("%s\n    {\"tool\": \"%s\", \"op\": \"%s\", \"ok\": %s, \"seconds\": %.6f, ",
+               first ? "" : ",", tool, op, measure.ok ? "true" : "false", measure.seconds);
+        printf("\"bytes_per_second\": %.0f, \"members_per_second\": %.1f, ",
+               bytes / measure.seconds, members / measure.seconds);
+        if (measure.latencies.empty())
+        {
+            printf("\"latency_us\": null, ");
+        }
+        else
+        {
+            printf("\"latency_us\": {\"p50\": %.1f, \"p99\": %.1f}, ",
+                   percentile(measure.latencies, 0.5) * 1e6, percentile(measure.latencies, 0.99) * 1e6);
+        }
+        printf("\"read_syscalls\": %llu, \"write_syscalls\": %llu, \"peak_rss_kb\": %ld}",
+               (unsigned long long)measure.syscr, (unsigned long long)measure.syscw, measure.rss);
+        first = false;
+    }
+
+    bool parse(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const char *arg = argv[i];
+            const char *value = strchr(arg, '=');
+            if (strncmp(arg, "--", 2) != 0 || !value)
+            {
+                fprintf(stderr, "unknown option %s\n", arg);
+                return false;
+            }
+            std::string name(arg + 2, value++);
+            if (name == "files")
+                options.files = strtoull(value, nullptr, 10);
+            else if (name == "size")
+                options.size = strtoull(value, nullptr, 10);
+            else if (name == "dist")
+                options.dist = value;
+            else if (name == "depth")
+                options.depth = strtoull(value, nullptr, 10);
+            else if (name == "dup")
+                options.dup = strtod(value, nullptr);
+            else if (name == "seed")
+                options.seed = strtoull(value, nullptr, 0);
+            else if (name == "runs")
+                options.runs = std::max<uint64_t>(1, strtoull(value, nullptr, 10));
+            else if (name == "sample")
+                options.sample = strtoull(value, nullptr, 10);
+            else if (name == "work")
+                options.work = value;
+            else if (name == "tar")
+                options.tar = value;
+            else
+            {
+                fprintf(stderr, "unknown option %s\n", arg);
+                return false;
+            }
+        }
+        return options.dist == "fixed" || options.dist == "uniform" || options.dist == "exp";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        return 1;
+    }
+
+    bool owned = options.work.empty();
+    if (owned)
+    {
+        char work[] = "/tmp/cbsp-e2e-XXXXXX";
+        if (!mkdtemp(work))
+        {
+            return 1;
+        }
+        options.work = work;
+    }
+    char real[PATH_MAX];
+    if (!realpath(options.work.c_str(), real))
+    {
+        return 1;
+    }
+    options.work = real;
+
+    Dataset dataset;
+    dataset.root = options.work + "/data";
+    renew(dataset.root);
+    if (!generate(options, dataset))
+    {
+        return 1;
+    }
+
+    const std::string cb = options.work + "/data.cb";
+    const std::string tarfile = options.work + "/data.tar";
+    const std::string out = options.work + "/out";
+
+    // the members of extract-one, spread over the dataset
+    std::vector<size_t> picks;
+    uint64_t sample = std::min<uint64_t>(options.sample, dataset.members.size());
+    for (uint64_t i = 0; i < sample; i++)
+    {
+        picks.push_back(i * dataset.members.size() / sample);
+    }
+
+    auto noop = [] {};
+    auto clean = [&out]
+    { renew(out); };
+    auto members = dataset.members.size();
+    auto relative = [&options](const std::string &path)
+    { return path.substr(options.work.size() + 1); };
+
+    cbsp::CBSP_HEADER header;
+    printf("{\n  \"version\": \"%u.%u.%u.%u\",\n", header.version.year, header.version.month, header.version.day, header.version.mini);
+    printf("  \"dataset\": {\"files\": %llu, \"bytes\": %llu, \"size\": %llu, \"dist\": \"%s\", \"depth\": %llu, \"dup\": %.3f, \"seed\": %llu},\n",
+           (unsigned long long)members, (unsigned long long)dataset.bytes, (unsigned long long)options.size,
+           options.dist.c_str(), (unsigned long long)options.depth, options.dup, (unsigned long long)options.seed);
+    printf("  \"results\": [");
+    bool first = true;
+
+    // combine
+    auto combine = best(
+        options.runs, [&cb]
+        { remove(cb.c_str()); },
+        [&]
+        {
+            return measure([&](std::vector<double> &latencies)
+                           {
+                               cbsp::CBSPFile fp;
+                               if (fp.create(cb.c_str()) != cbsp::CBSP_ERR_SUCCESS)
+                                   return false;
+                               int ret = cbsp::CBSP_ERR_SUCCESS;
+                               for (auto &file : cbsp::getDirFiles(dataset.root.c_str()))
+                               {
+                                   auto start = Clock::now();
+                                   ret |= cbsp::combiner::add(&fp, file.c_str());
+                                   latencies.push_back(since(start));
+                               }
+                               return ret == cbsp::CBSP_ERR_SUCCESS; });
+        });
+    report("cbsp", "combine", combine, dataset.bytes, members, first);
+
+    auto tarCombine = best(
+        options.runs, [&tarfile]
+        { remove(tarfile.c_str()); },
+        [&]
+        {
+            return measure([&](std::vector<double> &)
+                           { return command({options.tar, "-cf", tarfile, "-C", options.work, "data"}); });
+        });
+    report("tar", "combine", tarCombine, dataset.bytes, members, first);
+
+    // list
+    auto list = best(options.runs, noop, [&]
+                     { return measure([&](std::vector<double> &)
+                                      {
+                                          cbsp::CBSPFile fp(cb.c_str());
+                                          return cbsp::spliter::printTree(&fp) == cbsp::CBSP_ERR_SUCCESS; }); });
+    report("cbsp", "list", list, fileSize(cb), members, first);
+
+    auto tarList = best(options.runs, noop, [&]
+                        { return measure([&](std::vector<double> &)
+                                         { return command({options.tar, "-tf", tarfile}); }); });
+    report("tar", "list", tarList, fileSize(tarfile), members, first);
+
+    // extract-all, the loop of spliter::extract with each member timed
+    auto extract = best(options.runs, clean, [&]
+                        { return measure([&](std::vector<double> &latencies)
+                                         {
+                                             cbsp::CBSPFile fp(cb.c_str());
+                                             if (!fp)
+                                                 return false;
+                                             auto tr = cbsp::dirTree(&fp);
+                                             cbsp::cropTree(tr);
+                                             cbsp::DirCache dirs;
+                                             if (cbsp::spliter::makeTree(tr, out.c_str(), dirs) != cbsp::CBSP_ERR_SUCCESS)
+                                                 return false;
+                                             int ret = cbsp::CBSP_ERR_SUCCESS;
+                                             auto header = cbsp::getHeader(&fp);
+                                             auto blocker = cbsp::getFirst(&fp, header);
+                                             for (size_t i = 0; i < header.count; i++)
+                                             {
+                                                 auto start = Clock::now();
+                                                 auto rpath = out + "/" + cbsp::memberPath(tr, i);
+                                                 ret |= cbsp::spliter::genFile(&fp, dirs, rpath.c_str(), blocker);
+                                                 latencies.push_back(since(start));
+                                                 blocker = cbsp::getCBSPBlocker(&fp, blocker.next);
+                                             }
+                                             return ret == cbsp::CBSP_ERR_SUCCESS; }); });
+    report("cbsp", "extract-all", extract, dataset.bytes, members, first);
+
+    auto tarExtract = best(options.runs, clean, [&]
+                           { return measure([&](std::vector<double> &)
+                                            { return command({options.tar, "-xf", tarfile, "-C", out}); }); });
+    report("tar", "extract-all", tarExtract, dataset.bytes, members, first);
+
+    // extract-one, each pick from a fresh open of the archive
+    uint64_t pickBytes = 0;
+    for (auto pick : picks)
+    {
+        pickBytes += dataset.members[pick].size;
+    }
+    auto one = best(options.runs, clean, [&]
+                    { return measure([&](std::vector<double> &latencies)
+                                     {
+                                         int ret = cbsp::CBSP_ERR_SUCCESS;
+                                         cbsp::DirCache dirs;
+                                         for (size_t i = 0; i < picks.size(); i++)
+                                         {
+                                             auto start = Clock::now();
+                                             cbsp::CBSPFile fp(cb.c_str());
+                                             auto offset = cbsp::combiner::find(&fp, dataset.members[picks[i]].path.c_str());
+                                             if (offset == 0)
+                                                 return false;
+                                             auto rpath = out + "/" + std::to_string(i);
+                                             ret |= cbsp::spliter::genFile(&fp, dirs, rpath.c_str(), cbsp::getCBSPBlocker(&fp, offset));
+                                             latencies.push_back(since(start));
+                                         }
+                                         return ret == cbsp::CBSP_ERR_SUCCESS; }); });
+    report("cbsp", "extract-one", one, pickBytes, picks.size(), first);
+
+    std::vector<std::vector<std::string>> tarOne;
+    for (auto pick : picks)
+    {
+        tarOne.push_back({options.tar, "-xf", tarfile, "-C", out, relative(dataset.members[pick].path)});
+    }
+    auto tarPick = best(options.runs, clean, [&]
+                        { return each(tarOne); });
+    report("tar", "extract-one", tarPick, pickBytes, picks.size(), first);
+
+    printf("\n  ]\n}\n");
+
+    if (owned)
+    {
+        removeAll(options.work);
+    }
+    else
+    {
+        removeAll(out);
+    }
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "cbsp_file.hpp"
+
+static std::FILE *sampleFile(size_t size, std::string &content)
+{
+    content.resize(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        content[i] = static_cast<char>(i * 7 + i / 251);
+    }
+    std::FILE *file = std::tmpfile();
+    std::fwrite(content.data(), 1, size, file);
+    std::fflush(file);
+    std::rewind(file);
+    return file;
+}
+
+TEST(ChunkStreamTest, PIPELINE)
+{
+    std::string content;
+    std::FILE *file = sampleFile(100000, content);
+
+    // a range over many chunks, read ahead by the reader thread
+    std::string out;
+    {
+        cbsp::ChunkStream stream(file, 123, 99000, 1000, 3);
+        char *data = nullptr;
+        uint64_t size = 0;
+        while (stream.next(data, size))
+        {
+            out.append(data, size);
+        }
+        ASSERT_TRUE(stream.good());
+    }
+    ASSERT_EQ(out, content.substr(123, 99000));
+
+    // the rest of the file, in one chunk
+    std::fseek(file, 99990, SEEK_SET);
+    out.clear();
+    {
+        cbsp::ChunkStream stream(file);
+        char *data = nullptr;
+        uint64_t size = 0;
+        while (stream.next(data, size))
+        {
+            out.append(data, size);
+        }
+    }
+    ASSERT_EQ(out, content.substr(99990));
+    std::fclose(file);
+}
+
+TEST(ChunkStreamTest, ABANDON)
+{
+    std::string content;
+    std::FILE *file = sampleFile(50000, content);
+    {
+        // stop early, the reader is waiting on a full ring
+        cbsp::ChunkStream stream(file, 0, 50000, 100, 2);
+        char *data = nullptr;
+        uint64_t size = 0;
+        ASSERT_TRUE(stream.next(data, size));
+        ASSERT_EQ(std::string(data, size), content.substr(0, 100));
+    }
+    std::fclose(file);
+}
+
+TEST(ChunkFileTest, EXTENTS)
+{
+    std::FILE *file = std::tmpfile();
+    int fd = fileno(file);
+    std::string data(4096, 'x');
+    ASSERT_EQ(ftruncate(fd, 4 << 20), 0);
+    ASSERT_EQ(pwrite(fd, data.data(), data.size(), 0), 4096);
+    ASSERT_EQ(pwrite(fd, data.data(), data.size(), 1 << 20), 4096);
+
+    std::vector<cbsp::CBSP_EXTENT> extents;
+    // a file system may not report holes, the file is dense then
+    if (cbsp::dataExtents(fd, 4 << 20, extents))
+    {
+        ASSERT_EQ(extents.size(), 2u);
+        ASSERT_EQ(extents[0].offset, 0u);
+        ASSERT_GE(extents[0].length, 4096u);
+        ASSERT_LE(extents[1].offset, 1u << 20);
+        ASSERT_GE(extents[1].offset + extents[1].length, (1u << 20) + 4096);
+        ASSERT_LT(extents[1].offset + extents[1].length, 4u << 20);
+    }
+    else
+    {
+        ASSERT_TRUE(extents.empty());
+    }
+
+    // no hole at all
+    std::FILE *dense = std::tmpfile();
+    std::fwrite(data.data(), 1, data.size(), dense);
+    std::fflush(dense);
+    ASSERT_FALSE(cbsp::dataExtents(fileno(dense), data.size(), extents));
+    ASSERT_TRUE(extents.empty());
+
+    std::fclose(dense);
+    std::fclose(file);
+}
+
+TEST(ChunkFileTest, BUDGET)
+{
+    uint64_t budget = cbsp::chunkBudget();
+    // the ring and its consumer fit the budget
+    ASSERT_EQ(cbsp::chunkLimit(), cbsp::batch_size);
+    cbsp::chunkBudget() = 1 << 20;
+    ASSERT_EQ(cbsp::chunkLimit(), 256u << 10);
+    ASSERT_LE(cbsp::chunkLimit() * (cbsp::stream_depth + 1), cbsp::chunkBudget());
+    // whole blocks, never below one block or 64K
+    ASSERT_EQ(cbsp::chunkLimit(96 << 10), 192u << 10);
+    ASSERT_EQ(cbsp::chunkLimit(2 << 20), 2u << 20);
+    cbsp::chunkBudget() = 1000;
+    ASSERT_EQ(cbsp::chunkLimit(), 64u << 10);
+
+    // no larger than needed, rounded up to a block
+    cbsp::chunkBudget() = 1 << 20;
+    ASSERT_EQ(cbsp::chunkSize(-1, 1), 4096u);
+    ASSERT_EQ(cbsp::chunkSize(-1, 5000), 8192u);
+    ASSERT_EQ(cbsp::chunkSize(-1, 1ull << 40), cbsp::chunkLimit());
+    std::string content;
+    std::FILE *file = sampleFile(1 << 20, content);
+    uint64_t size = cbsp::chunkSize(file, 1ull << 40);
+    ASSERT_LE(size * (cbsp::stream_depth + 1), cbsp::chunkBudget());
+    ASSERT_EQ(size % cbsp::chunkSize(file, 1), 0u);
+
+    // a stream reads chunks of that size
+    {
+        cbsp::ChunkStream stream(file, 0, content.size());
+        char *data = nullptr;
+        uint64_t length = 0;
+        std::string read;
+        while (stream.next(data, length))
+        {
+            ASSERT_LE(length, size);
+            read.append(data, length);
+        }
+        ASSERT_TRUE(stream.good());
+        ASSERT_EQ(read, content);
+    }
+    std::fclose(file);
+    cbsp::chunkBudget() = budget;
+}
+
+// a xor archive opened with another key fails before any content is read
+TEST(CBSPFileTest, KEY)
+{
+    char path[] = "/tmp/cbsp_file_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    uint64_t key = cbsp::mixKey();
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(path, cbsp::CBSP_MIX_XOR), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_NE(cbsp::getHeader(&fp).keyCheck, 0u);
+    }
+    cbsp::CBSPFile fp;
+    ASSERT_EQ(fp.open(path), cbsp::CBSP_ERR_SUCCESS);
+    cbsp::mixKey() = key + 1;
+    ASSERT_EQ(fp.open(path), cbsp::CBSP_ERR_BAD_KEY);
+    ASSERT_EQ(fp.create(path), cbsp::CBSP_ERR_BAD_KEY);
+    cbsp::mixKey() = key;
+    unlink(path);
+}
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "cbsp_combiner.hpp"
+#include "cbsp_index.hpp"
+
+TEST(IndexTest, BUILD)
+{
+    char dir[] = "/tmp/cbsp_index_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string target = std::string(dir) + "/index.cbsp";
+    std::vector<std::string> files;
+    for (auto size : {300, 100, 500, 200})
+    {
+        files.push_back(std::string(dir) + "/f" + std::to_string(size));
+        std::ofstream(files.back(), std::ios::binary) << std::string(size, 'x');
+    }
+
+    cbsp::CBSPFile fp;
+    ASSERT_EQ(fp.create(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    for (auto &file : files)
+    {
+        ASSERT_EQ(cbsp::combiner::add(&fp, file.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+    auto chained = cbsp::combiner::find(&fp, files[2].c_str());
+    uint64_t length = cbsp::fileLenght(&fp);
+
+    cbsp::CBSPIndex index;
+    ASSERT_FALSE(index.open(&fp));
+    ASSERT_EQ(cbsp::buildIndex(&fp), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_TRUE(index.open(&fp));
+    ASSERT_EQ(index.size(), 4u);
+    ASSERT_EQ(index.totalSize(), 1100u);
+    ASSERT_EQ(index.largest(2), (std::vector<size_t>{2, 0}));
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(index.offsets()) % sizeof(uint64_t), 0u);
+    ASSERT_EQ(index.find(cbsp::crc32(files[2].c_str(), files[2].size())), std::vector<size_t>{2});
+
+    // the lookup goes through the index and finds the same blocker
+    uint64_t prev = 0;
+    ASSERT_EQ(cbsp::combiner::find(&fp, files[2].c_str(), &prev), chained);
+    ASSERT_EQ(prev, index.blockers()[1]);
+    index.close();
+
+    // a write drops it, the content goes where it was
+    std::string more = std::string(dir) + "/more";
+    std::ofstream(more, std::ios::binary) << "more";
+    ASSERT_EQ(cbsp::combiner::add(&fp, more.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_FALSE(index.open(&fp));
+    ASSERT_EQ(cbsp::getCBSPBlocker(&fp, cbsp::getHeader(&fp).last).offset, length);
+    files.push_back(more);
+
+    unlink(target.c_str());
+    for (auto &file : files)
+    {
+        unlink(file.c_str());
+    }
+    rmdir(dir);
+}
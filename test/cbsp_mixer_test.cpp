@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <thread>
+
+#include "cbsp_mixer.hpp"
+
+static std::vector<uint8_t> sample(size_t size)
+{
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        data[i] = static_cast<uint8_t>(i * 131 + 7);
+    }
+    return data;
+}
+
+TEST(MixerTest, KERNELS)
+{
+    uint8_t pattern[cbsp::mix_pad_size];
+    for (size_t i = 0; i < cbsp::mix_pad_size; i++)
+    {
+        pattern[i] = static_cast<uint8_t>(i * 37 + 1);
+    }
+    auto expect = sample(1000);
+    cbsp::mixScalar(expect.data(), expect.size(), pattern);
+
+    std::vector<cbsp::MixKernel> kernels{cbsp::mixKernel()};
+#ifdef CBSP_MIX_X86
+    kernels.push_back(cbsp::mixSSE2);
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(cbsp::mixAVX2);
+    if (__builtin_cpu_supports("avx512f"))
+        kernels.push_back(cbsp::mixAVX512);
+#endif
+    for (auto kernel : kernels)
+    {
+        // unaligned start and a tail
+        auto data = sample(1000);
+        kernel(data.data(), 1, pattern);
+        kernel(data.data() + 1, data.size() - 1, pattern);
+        auto check = sample(1000);
+        cbsp::mixScalar(check.data(), 1, pattern);
+        cbsp::mixScalar(check.data() + 1, check.size() - 1, pattern);
+        ASSERT_EQ(data, check);
+
+        data = sample(1000);
+        kernel(data.data(), data.size(), pattern);
+        ASSERT_EQ(data, expect);
+    }
+}
+
+TEST(MixerTest, PHASE)
+{
+    for (int type : {cbsp::CBSP_MIX_LINEAR, cbsp::CBSP_MIX_XOR})
+    {
+        auto whole = sample(777);
+        cbsp::mixer(whole.data(), whole.size(), type, 0);
+        ASSERT_NE(whole, sample(777));
+
+        // mixing in pieces equals mixing at once
+        auto piece = sample(777);
+        cbsp::mixer(piece.data(), 100, type, 0);
+        cbsp::mixer(piece.data() + 100, 333, type, 100);
+        cbsp::mixer(piece.data() + 433, 344, type, 433);
+        ASSERT_EQ(whole, piece);
+
+        // mixing twice restores the content
+        cbsp::mixer(whole.data(), whole.size(), type, 0);
+        ASSERT_EQ(whole, sample(777));
+    }
+}
+
+TEST(MixerTest, KEY)
+{
+    uint64_t key = cbsp::mixKey();
+    auto a = sample(128);
+    cbsp::mixer(a.data(), a.size(), cbsp::CBSP_MIX_XOR);
+    cbsp::mixKey() = key + 1;
+    auto b = sample(128);
+    cbsp::mixer(b.data(), b.size(), cbsp::CBSP_MIX_XOR);
+    cbsp::mixKey() = key;
+    ASSERT_NE(a, b);
+}
+
+// threads mixing at once with a new key, each may be the first to build its pad
+TEST(MixerTest, THREADS)
+{
+    uint64_t key = cbsp::mixKey();
+    cbsp::mixKey() = key + 7;
+    std::vector<std::vector<uint8_t>> mixed(8, sample(4096));
+    std::vector<std::thread> mixers;
+    for (auto &data : mixed)
+    {
+        mixers.emplace_back([&data]()
+                            { cbsp::mixer(data.data(), data.size(), cbsp::CBSP_MIX_XOR, 5); });
+    }
+    for (auto &mixer : mixers)
+    {
+        mixer.join();
+    }
+    auto expect = sample(4096);
+    cbsp::mixer(expect.data(), expect.size(), cbsp::CBSP_MIX_XOR, 5);
+    cbsp::mixKey() = key;
+    ASSERT_NE(expect, sample(4096));
+    ASSERT_EQ(mixed, std::vector<std::vector<uint8_t>>(mixed.size(), expect));
+}
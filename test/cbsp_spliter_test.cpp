@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "cbsp_combiner.hpp"
+#include "cbsp_spliter.hpp"
+
+TEST(SpliterTest, READRANGE)
+{
+    char dir[] = "/tmp/cbsp_spliter_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string source = std::string(dir) + "/data";
+    std::string target = std::string(dir) + "/data.cbsp";
+
+    std::string data(300000, '\0');
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<char>(i * 31 + i / 7);
+    }
+    std::ofstream(source, std::ios::binary) << data;
+
+    // small blocks, the range checks a few of them
+    auto block = cbsp::crcBlockSize();
+    cbsp::crcBlockSize() = 64 * 1024;
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str(), cbsp::CBSP_MIX_XOR), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, source.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+    cbsp::crcBlockSize() = block;
+
+    cbsp::CBSPFile fp;
+    ASSERT_EQ(fp.open(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    cbsp::CBSP_BLOCKER blocker;
+    ASSERT_NE(cbsp::spliter::findMember(&fp, "data", blocker), 0u);
+    ASSERT_TRUE(cbsp::hasBlocks(blocker));
+    ASSERT_EQ(cbsp::spliter::findMember(&fp, "none", blocker), 0u);
+    ASSERT_NE(cbsp::spliter::findMember(&fp, "data", blocker), 0u);
+
+    std::string out(8192, '\0');
+    for (uint64_t offset : {0ul, 65530ul, 299000ul})
+    {
+        uint64_t length = out.size();
+        ASSERT_EQ(cbsp::spliter::readRange(&fp, blocker, offset, length, &out[0]), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(length, std::min<uint64_t>(out.size(), data.size() - offset));
+        ASSERT_EQ(out.substr(0, length), data.substr(offset, length));
+    }
+    uint64_t length = out.size();
+    ASSERT_EQ(cbsp::spliter::readRange(&fp, blocker, data.size(), length, &out[0]), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(length, 0u);
+
+    unlink(target.c_str());
+    unlink(source.c_str());
+    rmdir(dir);
+}
+
+TEST(SpliterTest, VERIFIED)
+{
+    char dir[] = "/tmp/cbsp_spliter_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string source = std::string(dir) + "/data";
+    std::string target = std::string(dir) + "/data.cbsp";
+    std::ofstream(source, std::ios::binary) << std::string(1000, 'x');
+
+    cbsp::clearVerified();
+    cbsp::CBSPFile fp;
+    ASSERT_EQ(fp.create(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(cbsp::combiner::add(&fp, source.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    auto generation = cbsp::getHeader(&fp).generation;
+    ASSERT_GT(generation, 0u);
+
+    // a matched chain is remembered, none does not check or remember
+    ASSERT_TRUE(cbsp::verifyMatch(&fp, cbsp::CBSP_VERIFY_NONE));
+    ASSERT_FALSE(cbsp::isVerified(&fp));
+    ASSERT_TRUE(cbsp::verifyMatch(&fp, cbsp::CBSP_VERIFY_META));
+    time_t at = 0;
+    ASSERT_TRUE(cbsp::isVerified(&fp, &at));
+    ASSERT_GT(at, 0);
+
+    // a write moves the generation on and drops it
+    ASSERT_EQ(cbsp::combiner::erase(&fp, source.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_GT(cbsp::getHeader(&fp).generation, generation);
+    ASSERT_FALSE(cbsp::isVerified(&fp));
+    cbsp::clearVerified();
+
+    unlink(target.c_str());
+    unlink(source.c_str());
+    rmdir(dir);
+}
+
+TEST(SpliterTest, TEST)
+{
+    char dir[] = "/tmp/cbsp_spliter_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string a = std::string(dir) + "/a", b = std::string(dir) + "/b";
+    std::string target = std::string(dir) + "/test.cbsp";
+    std::ofstream(a, std::ios::binary) << std::string(200000, 'a');
+    std::ofstream(b, std::ios::binary) << std::string(100, 'b');
+
+    auto block = cbsp::crcBlockSize();
+    cbsp::crcBlockSize() = 64 * 1024;
+    cbsp::CBSPFile fp;
+    ASSERT_EQ(fp.create(target.c_str(), cbsp::CBSP_MIX_LINEAR), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(cbsp::combiner::add(&fp, a.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(cbsp::combiner::add(&fp, b.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    cbsp::crcBlockSize() = block;
+
+    std::vector<std::string> broken;
+    ASSERT_EQ(cbsp::spliter::test(&fp, 4, &broken), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_TRUE(broken.empty());
+
+    // a byte in the third block of a
+    auto blocker = cbsp::getFirst(&fp);
+    char byte = 'z';
+    ASSERT_EQ(pwrite(fileno(&fp), &byte, 1, blocker.offset + 150000), 1);
+    ASSERT_NE(cbsp::spliter::test(&fp, 4, &broken), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(broken, std::vector<std::string>{a});
+
+    unlink(target.c_str());
+    unlink(a.c_str());
+    unlink(b.c_str());
+    rmdir(dir);
+}
+
+TEST(SpliterTest, LEGACY)
+{
+    char dir[] = "/tmp/cbsp_spliter_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string source = std::string(dir) + "/in/data";
+    std::string target = std::string(dir) + "/data.cbsp";
+    std::string outdir = std::string(dir) + "/out";
+    ASSERT_TRUE(cbsp::makeDirs((std::string(dir) + "/in").c_str()));
+    std::string data(100000, '\0');
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<char>(i * 13 + i / 5);
+    }
+    std::ofstream(source, std::ios::binary) << data;
+
+    // the crc of the first releases, 100000 bytes were taken as 34464
+    auto legacy = [&](const uint32_t &version)
+    {
+        cbsp::CBSPFile fp;
+        fp.create(target.c_str());
+        auto header = cbsp::getHeader(&fp);
+        auto blocker = cbsp::getCBSPBlocker(&fp, header.first);
+        blocker.crc = cbsp::crc32(data.c_str(), data.size() & 0xFFFF);
+        cbsp::write(&fp, blocker, header.first, blocker.size);
+        header.version.version = version;
+        header.crc = cbsp::crcBlocker(&fp, header);
+        cbsp::setHeader(&fp, header);
+    };
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, source.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+
+    // the header version tells the crc, a current archive with it is broken
+    legacy(cbsp::CBSP_HEADER().version.version);
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.open(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_NE(cbsp::spliter::test(&fp), cbsp::CBSP_ERR_SUCCESS);
+    }
+
+    // 22.2.10.0
+    cbsp::CBSP_HEADER old;
+    old.version.year = 22;
+    old.version.month = 2;
+    old.version.day = 10;
+    legacy(old.version.version);
+    cbsp::CBSPFile fp;
+    ASSERT_EQ(fp.open(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(cbsp::spliter::extract(&fp, outdir.c_str(), false, cbsp::CBSP_VERIFY_FULL), cbsp::CBSP_ERR_SUCCESS);
+    std::ifstream in(outdir + "/data", std::ios::binary);
+    std::string out((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(out, data);
+    ASSERT_EQ(cbsp::spliter::test(&fp), cbsp::CBSP_ERR_SUCCESS);
+
+    unlink((outdir + "/data").c_str());
+    rmdir(outdir.c_str());
+    unlink(target.c_str());
+    unlink(source.c_str());
+    rmdir((std::string(dir) + "/in").c_str());
+    rmdir(dir);
+}
@@ -0,0 +1,220 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "cbsp_combiner.hpp"
+#include "cbsp_streamer.hpp"
+
+namespace
+{
+    std::string readAll(const std::string &path)
+    {
+        std::stringstream out;
+        out << std::ifstream(path, std::ios::binary).rdbuf();
+        return out.str();
+    }
+
+    std::string makeData(const size_t &size, const size_t &seed)
+    {
+        std::string data(size, '\0');
+        for (size_t i = 0; i < size; i++)
+        {
+            data[i] = static_cast<char>(i * (13 + seed) + i / 11);
+        }
+        return data;
+    }
+
+    int streamOut(const std::string &target, const std::string &outdir, const bool &links = false)
+    {
+        std::ifstream in(target, std::ios::binary);
+        return cbsp::streamer::extract(in, outdir.c_str(), links);
+    }
+
+    // the entries of dir, the spool files included
+    size_t countEntries(const std::string &dir)
+    {
+        size_t count = 0;
+        DIR *d = opendir(dir.c_str());
+        if (!d)
+        {
+            return 0;
+        }
+        while (auto entry = readdir(d))
+        {
+            count += std::string(entry->d_name) != "." && std::string(entry->d_name) != "..";
+        }
+        closedir(d);
+        return count;
+    }
+}
+
+// a member which is a cbsp file holds blockers which look like ones of the outer file
+TEST(StreamerTest, NESTED)
+{
+    char dir[] = "/tmp/cbsp_streamer_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string src = std::string(dir) + "/src";
+    std::string in = std::string(dir) + "/in";
+    ASSERT_TRUE(cbsp::makeDirs(src.c_str()));
+    ASSERT_TRUE(cbsp::makeDirs(in.c_str()));
+    std::ofstream(src + "/x", std::ios::binary) << makeData(50000, 1);
+    std::ofstream(src + "/y", std::ios::binary) << makeData(7000, 2);
+    std::ofstream(in + "/z", std::ios::binary) << makeData(30000, 3);
+
+    std::string inner = in + "/inner.cbsp";
+    std::string outer = std::string(dir) + "/outer.cbsp";
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(inner.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, (src + "/x").c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, (src + "/y").c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+    {
+        // the inner content starts where the outer one does, so do their first blockers
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(outer.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, inner.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, (in + "/z").c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+
+    std::string out = std::string(dir) + "/out";
+    ASSERT_EQ(streamOut(outer, out), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(readAll(out + "/inner.cbsp"), readAll(inner));
+    ASSERT_EQ(readAll(out + "/z"), readAll(in + "/z"));
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
+
+// the spool files are 0600, the extracted members are not
+TEST(StreamerTest, MODE)
+{
+    char dir[] = "/tmp/cbsp_streamer_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string file = std::string(dir) + "/a";
+    std::string target = std::string(dir) + "/data.cbsp";
+    std::ofstream(file, std::ios::binary) << makeData(1000, 4);
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, file.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+
+    mode_t mask = umask(022);
+    std::string out = std::string(dir) + "/out";
+    int ret = streamOut(target, out);
+    umask(mask);
+    ASSERT_EQ(ret, cbsp::CBSP_ERR_SUCCESS);
+    struct stat sts;
+    ASSERT_EQ(stat((out + "/a").c_str(), &sts), 0);
+    ASSERT_EQ(sts.st_mode & 07777, 0644u);
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
+
+TEST(StreamerTest, LINKS)
+{
+    char dir[] = "/tmp/cbsp_streamer_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string in = std::string(dir) + "/in";
+    ASSERT_TRUE(cbsp::makeDirs(in.c_str()));
+    std::ofstream(in + "/a", std::ios::binary) << makeData(70000, 5);
+    ASSERT_EQ(link((in + "/a").c_str(), (in + "/b").c_str()), 0);
+    std::ofstream(in + "/c", std::ios::binary) << makeData(100, 6);
+
+    std::string target = std::string(dir) + "/data.cbsp";
+    {
+        cbsp::CBSPFile fp;
+        cbsp::combiner::CBSP_LINKS links;
+        ASSERT_EQ(fp.create(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        for (auto name : {"/a", "/b", "/c"})
+        {
+            ASSERT_EQ(cbsp::combiner::add(&fp, (in + name).c_str(), &links), cbsp::CBSP_ERR_SUCCESS);
+        }
+    }
+
+    // copies without links, one file with them
+    std::string out = std::string(dir) + "/out";
+    ASSERT_EQ(streamOut(target, out), cbsp::CBSP_ERR_SUCCESS);
+    struct stat sts;
+    ASSERT_EQ(stat((out + "/b").c_str(), &sts), 0);
+    ASSERT_EQ(sts.st_nlink, 1u);
+    ASSERT_EQ(readAll(out + "/b"), readAll(in + "/a"));
+
+    std::string linked = std::string(dir) + "/linked";
+    ASSERT_EQ(streamOut(target, linked, true), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(stat((linked + "/b").c_str(), &sts), 0);
+    ASSERT_EQ(sts.st_nlink, 2u);
+    ASSERT_EQ(readAll(linked + "/a"), readAll(in + "/a"));
+    ASSERT_EQ(readAll(linked + "/c"), readAll(in + "/c"));
+    ASSERT_EQ(countEntries(linked), 3u);
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
+
+TEST(StreamerTest, SPARSE)
+{
+    char dir[] = "/tmp/cbsp_streamer_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string file = std::string(dir) + "/sparse";
+    {
+        std::FILE *fp = std::fopen(file.c_str(), "wb");
+        ASSERT_NE(fp, nullptr);
+        std::string data = makeData(4096, 7);
+        ASSERT_EQ(ftruncate(fileno(fp), 3 << 20), 0);
+        ASSERT_EQ(pwrite(fileno(fp), data.data(), data.size(), 0), 4096);
+        ASSERT_EQ(pwrite(fileno(fp), data.data(), data.size(), 2 << 20), 4096);
+        std::fclose(fp);
+    }
+
+    // a file system without holes stores it dense, it round trips all the same
+    std::string target = std::string(dir) + "/data.cbsp";
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str(), cbsp::CBSP_MIX_XOR), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, file.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+
+    std::string out = std::string(dir) + "/out";
+    ASSERT_EQ(streamOut(target, out), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(readAll(out + "/sparse"), readAll(file));
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
+
+TEST(StreamerTest, CORRUPT)
+{
+    char dir[] = "/tmp/cbsp_streamer_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string file = std::string(dir) + "/a";
+    std::string target = std::string(dir) + "/data.cbsp";
+    std::ofstream(file, std::ios::binary) << makeData(20000, 8);
+    {
+        cbsp::CBSPFile fp;
+        ASSERT_EQ(fp.create(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+        ASSERT_EQ(cbsp::combiner::add(&fp, file.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    }
+    std::string data = readAll(target);
+
+    // a flipped content byte
+    std::string corrupt = std::string(dir) + "/corrupt.cbsp";
+    std::string flipped = data;
+    flipped[sizeof(cbsp::CBSP_HEADER) + 100] ^= 0x1;
+    std::ofstream(corrupt, std::ios::binary) << flipped;
+    std::string out = std::string(dir) + "/out";
+    ASSERT_NE(streamOut(corrupt, out), cbsp::CBSP_ERR_SUCCESS);
+    // nothing is left behind, not even a spool file
+    ASSERT_EQ(countEntries(out), 0u);
+
+    // a stream cut before its blocker
+    std::ofstream(corrupt, std::ios::binary | std::ios::trunc) << data.substr(0, data.size() / 2);
+    ASSERT_NE(streamOut(corrupt, out), cbsp::CBSP_ERR_SUCCESS);
+    ASSERT_EQ(countEntries(out), 0u);
+
+    // not a cbsp file
+    std::ofstream(corrupt, std::ios::binary | std::ios::trunc) << makeData(1000, 9);
+    ASSERT_EQ(streamOut(corrupt, out), cbsp::CBSP_ERR_NO_CBSP);
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
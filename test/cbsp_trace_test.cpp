@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <fstream>
+#include <sstream>
+
+#include "cbsp_trace.hpp"
+
+static size_t countOf(const std::string &text, const std::string &what)
+{
+    size_t count = 0;
+    for (auto pos = text.find(what); pos != std::string::npos; pos = text.find(what, pos + 1))
+    {
+        count++;
+    }
+    return count;
+}
+
+TEST(TraceTest, SAVE)
+{
+    {
+        CBSP_TRACE_SPAN("before");
+    }
+    cbsp::trace::start();
+    {
+        CBSP_TRACE_SPAN("main", std::string("/a/very/long/directory/that/is/longer/than/the/detail/\"quoted\"/file"));
+    }
+    std::thread([]
+                { CBSP_TRACE_SPAN("worker"); })
+        .join();
+
+    char path[] = "/tmp/cbsp-trace-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    ASSERT_EQ(cbsp::trace::save(path), cbsp::CBSP_ERR_SUCCESS);
+    // stopped by save
+    {
+        CBSP_TRACE_SPAN("after");
+    }
+
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    unlink(path);
+    auto json = text.str();
+
+#ifndef CBSP_NO_TRACE
+    ASSERT_EQ(countOf(json, "\"ph\": \"X\""), 2u);
+    ASSERT_EQ(countOf(json, "\"name\": \"main\""), 1u);
+    ASSERT_EQ(countOf(json, "\"name\": \"worker\""), 1u);
+    // the tail of the path, escaped
+    ASSERT_EQ(countOf(json, "\\\"quoted\\\"/file\""), 1u);
+    ASSERT_EQ(countOf(json, "/a/very"), 0u);
+#endif
+    ASSERT_EQ(countOf(json, "before"), 0u);
+    ASSERT_EQ(countOf(json, "after"), 0u);
+    ASSERT_EQ(json.back(), '\n');
+}
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cbsp_tree.hpp"
+
+TEST(TreeTest, CROP)
+{
+    cbsp::CBSP_TREE tree;
+    cbsp::insertTree(tree, std::string("/home/src/a/x"));
+    cbsp::insertTree(tree, std::string("/home/src/b/y"));
+    cbsp::insertTree(tree, std::list<std::string>{"home", "src", "a", "z"});
+    // home, src, a, b, x, y, z
+    ASSERT_EQ(tree.nodes.size(), 8);
+
+    cbsp::cropTree(tree);
+    ASSERT_EQ(cbsp::nodeName(tree, tree.crop), "src");
+    ASSERT_EQ(cbsp::matchTree(tree, "/home/src/a/z"), "a/z");
+    ASSERT_EQ(cbsp::matchTree(tree, "/home/src/b/y"), "b/y");
+    // members keep their insertion order
+    ASSERT_EQ(cbsp::memberPath(tree, 0), "a/x");
+    ASSERT_EQ(cbsp::memberPath(tree, 1), "b/y");
+    ASSERT_EQ(cbsp::memberPath(tree, 2), "a/z");
+}
+
+TEST(TreeTest, LEAF)
+{
+    cbsp::CBSP_TREE tree;
+    cbsp::insertTree(tree, std::string("/home/src/a/x"));
+    cbsp::cropTree(tree);
+    // a single file keeps its name
+    ASSERT_EQ(cbsp::matchTree(tree, "/home/src/a/x"), "x");
+}
+
+TEST(TreeTest, LOOKUP)
+{
+    cbsp::CBSP_TREE tree;
+    for (int i = 0; i < 10000; i++)
+    {
+        cbsp::insertTree(tree, "/d" + std::to_string(i % 100) + "/f" + std::to_string(i));
+    }
+    ASSERT_EQ(tree.nodes.size(), 1 + 100 + 10000);
+    auto d7 = cbsp::findChild(tree, 0, cbsp::internName(tree, "d7", 2, false));
+    ASSERT_NE(d7, 0);
+    auto f907 = cbsp::findChild(tree, d7, cbsp::internName(tree, "f907", 4, false));
+    ASSERT_NE(f907, 0);
+    ASSERT_TRUE(tree.nodes[f907].isFile);
+    ASSERT_EQ(cbsp::internName(tree, "nope", 4, false), UINT32_MAX);
+}
+
+TEST(TreeTest, DIRCACHE)
+{
+    char dir[] = "/tmp/cbsp_tree_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string root = dir;
+    ASSERT_EQ(cbsp::DirCache::normalize("a//b/./c/"), "a/b/c");
+    ASSERT_EQ(cbsp::DirCache::normalize("//"), "/");
+
+    // two handles, the parents of x are opened on the way and pushed out by it
+    cbsp::DirCache dirs(2);
+    int x = dirs.open(root + "/x/");
+    ASSERT_GE(x, 0);
+    ASSERT_EQ(dirs.open(root + "/x"), x);
+    struct stat sts;
+    ASSERT_EQ(stat((root + "/x").c_str(), &sts), 0);
+    ASSERT_TRUE(S_ISDIR(sts.st_mode));
+
+    // y uses the cached root and pushes out x, the least recently used
+    int y = dirs.open(root + "/y");
+    ASSERT_GE(y, 0);
+    ASSERT_EQ(fcntl(x, F_GETFD), -1);
+    ASSERT_NE(fcntl(y, F_GETFD), -1);
+
+    // x is opened again on demand, a handle works relative to its directory
+    std::string name;
+    x = dirs.parent(root + "/x/file", name);
+    ASSERT_EQ(name, "file");
+    ASSERT_NE(fcntl(x, F_GETFD), -1);
+    int fd = openat(x, name.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    ASSERT_EQ(access((root + "/x/file").c_str(), F_OK), 0);
+
+    // a file in the way is not a directory
+    ASSERT_EQ(dirs.open(root + "/x/file"), -1);
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "cbsp_volume.hpp"
+
+TEST(VolumeTest, PATH)
+{
+    ASSERT_EQ(cbsp::volume::volumePath("a.cbsp", 0), "a.cbsp.000");
+    ASSERT_EQ(cbsp::volume::volumePath("a.cbsp", 12), "a.cbsp.012");
+}
+
+TEST(VolumeTest, DISTRIBUTE)
+{
+    char dir[] = "/tmp/cbsp_volume_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    // 8, 5, 4, 3 and a link of the largest
+    std::vector<std::string> files;
+    for (auto size : {3, 8, 4, 5})
+    {
+        files.push_back(std::string(dir) + "/f" + std::to_string(size));
+        std::ofstream(files.back()) << std::string(size * 4096, 'x');
+    }
+    files.push_back(std::string(dir) + "/link");
+    ASSERT_EQ(link(files[1].c_str(), files.back().c_str()), 0);
+
+    auto plan = cbsp::volume::distribute(files, {0, 0});
+    ASSERT_EQ(plan.size(), 2u);
+    // 8 + 3 and 5 + 4, in their given order, the link follows 8
+    ASSERT_EQ(plan[0], (std::vector<std::string>{files[0], files[1], files[4]}));
+    ASSERT_EQ(plan[1], (std::vector<std::string>{files[2], files[3]}));
+
+    // a volume already filled gets the rest
+    plan = cbsp::volume::distribute({files[0]}, {1 << 20, 0});
+    ASSERT_TRUE(plan[0].empty());
+    ASSERT_EQ(plan[1].size(), 1u);
+
+    for (auto &file : files)
+    {
+        unlink(file.c_str());
+    }
+    rmdir(dir);
+}
+
+TEST(VolumeTest, PRINT)
+{
+    char dir[] = "/tmp/cbsp_volume_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string in = std::string(dir) + "/in";
+    ASSERT_TRUE(cbsp::makeDirs(in.c_str()));
+    std::vector<std::string> files;
+    for (auto name : {"a", "b", "c"})
+    {
+        files.push_back(in + "/" + name);
+        std::ofstream(files.back()) << std::string(4096, *name);
+    }
+    std::string target = std::string(dir) + "/data.cbsp";
+    ASSERT_EQ(cbsp::volume::combine(target.c_str(), files, 2), cbsp::CBSP_ERR_SUCCESS);
+
+    // the members of every volume are listed
+    testing::internal::CaptureStdout();
+    ASSERT_EQ(cbsp::volume::printTree(target.c_str()), cbsp::CBSP_ERR_SUCCESS);
+    std::string out = testing::internal::GetCapturedStdout();
+    for (auto name : {"a\n", "b\n", "c\n"})
+    {
+        ASSERT_NE(out.find(name), std::string::npos) << out;
+    }
+    ASSERT_EQ(cbsp::volume::printTree((target + ".none").c_str()), cbsp::CBSP_ERR_NO_CBSP);
+    ASSERT_EQ(cbsp::volume::printTree(nullptr), cbsp::CBSP_ERR_NO_TARGET);
+    ASSERT_EQ(cbsp::volume::extract(nullptr), cbsp::CBSP_ERR_NO_TARGET);
+    ASSERT_EQ(cbsp::volume::getVolumes(nullptr), 0u);
+    std::system((std::string("rm -rf ") + dir).c_str());
+}
@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cbsp_walker.hpp"
+
+TEST(WalkerTest, WALK)
+{
+    char dir[] = "/tmp/cbsp_walker_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string root = dir;
+    for (auto sub : {"/d", "/d/e", "/b", "/z"})
+    {
+        ASSERT_EQ(mkdir((root + sub).c_str(), 0755), 0);
+    }
+    for (auto file : {"/c", "/a", "/d/e/f", "/d/y", "/b/x"})
+    {
+        std::ofstream(root + file) << file;
+    }
+    // a link is walked as what it points to, a broken one is left out
+    ASSERT_EQ(symlink((root + "/a").c_str(), (root + "/la").c_str()), 0);
+    ASSERT_EQ(symlink((root + "/d/e").c_str(), (root + "/z/le").c_str()), 0);
+    ASSERT_EQ(symlink((root + "/none").c_str(), (root + "/broken").c_str()), 0);
+    // special files are files
+    ASSERT_EQ(mkfifo((root + "/fifo").c_str(), 0644), 0);
+
+    std::vector<std::string> expect;
+    for (auto file : {"/a", "/b/x", "/c", "/d/e/f", "/d/y", "/fifo", "/la", "/z/le/f"})
+    {
+        expect.push_back(root + file);
+    }
+    // sorted, the same with or without threads, with or without a trailing slash
+    ASSERT_EQ(cbsp::walker::walk(dir), expect);
+    ASSERT_EQ(cbsp::walker::walk(dir, 4), expect);
+    ASSERT_EQ(cbsp::walker::walk((root + "//").c_str(), 4), expect);
+
+    // a file is itself, a missing path is nothing
+    ASSERT_EQ(cbsp::walker::walk((root + "/c").c_str()), std::vector<std::string>{root + "/c"});
+    ASSERT_TRUE(cbsp::walker::walk((root + "/none").c_str()).empty());
+    ASSERT_TRUE(cbsp::walker::walk(nullptr).empty());
+    std::system((std::string("rm -rf ") + dir).c_str());
+}